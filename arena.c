@@ -0,0 +1,172 @@
+/*
+   +----------------------------------------------------------------------+
+   | Copyright (c) 1997-2019 Derick Rethans                               |
+   +----------------------------------------------------------------------+
+   | This source file is subject to the 2-Clause BSD license which is     |
+   | available through the LICENSE file, or online at                     |
+   | http://opensource.org/licenses/bsd-license.php                       |
+   +----------------------------------------------------------------------+
+   | Authors:  Derick Rethans <derick@derickrethans.nl>                   |
+   +----------------------------------------------------------------------+
+ */
+
+/* The arena hands out memory from large chunks by moving a pointer. The
+ * sets, jumps, branches and paths of an op_array are all allocated from it
+ * while it is analysed, and dropped together once it has been dumped, so
+ * that the analysis does not call malloc() and free() for every path. */
+
+#include <stdlib.h>
+#include <string.h>
+#include "arena.h"
+
+#define VLD_ARENA_ALIGN(n) (((n) + 7) & ~((size_t) 7))
+
+struct _vld_arena_chunk {
+	vld_arena_chunk *next;
+	size_t           size;
+	size_t           used;
+};
+
+#define VLD_ARENA_HEADER VLD_ARENA_ALIGN(sizeof(vld_arena_chunk))
+#define VLD_ARENA_DATA(c) ((char *) (c) + VLD_ARENA_HEADER)
+
+static vld_arena_chunk *vld_arena_chunk_new(size_t size)
+{
+	vld_arena_chunk *chunk = malloc(VLD_ARENA_HEADER + size);
+
+	if (!chunk) {
+		return NULL;
+	}
+	chunk->next = NULL;
+	chunk->size = size;
+	chunk->used = 0;
+
+	return chunk;
+}
+
+vld_arena *vld_arena_create(void)
+{
+	vld_arena *arena = calloc(1, sizeof(vld_arena));
+
+	arena->chunks = vld_arena_chunk_new(VLD_ARENA_CHUNK_SIZE);
+
+	return arena;
+}
+
+/* Forgets everything that was allocated. Only the newest chunk, which is
+ * also the largest, is kept. */
+void vld_arena_reset(vld_arena *arena)
+{
+	vld_arena_chunk *chunk, *next;
+
+	if (!arena->chunks) {
+		return;
+	}
+	for (chunk = arena->chunks->next; chunk; chunk = next) {
+		next = chunk->next;
+		free(chunk);
+	}
+	arena->chunks->next = NULL;
+	arena->chunks->used = 0;
+	arena->last = NULL;
+}
+
+void vld_arena_free(vld_arena *arena)
+{
+	vld_arena_chunk *chunk, *next;
+
+	for (chunk = arena->chunks; chunk; chunk = next) {
+		next = chunk->next;
+		free(chunk);
+	}
+	free(arena);
+}
+
+void *vld_arena_alloc(vld_arena *arena, size_t size)
+{
+	vld_arena_chunk *chunk;
+	void            *ptr;
+
+	if (!arena) {
+		return malloc(size ? size : 1);
+	}
+
+	size = VLD_ARENA_ALIGN(size ? size : 1);
+	chunk = arena->chunks;
+	if (!chunk || chunk->size - chunk->used < size) {
+		/* Every chunk is at least twice as large as the one before */
+		size_t chunk_size = chunk ? chunk->size * 2 : VLD_ARENA_CHUNK_SIZE;
+
+		while (chunk_size < size) {
+			chunk_size *= 2;
+		}
+		chunk = vld_arena_chunk_new(chunk_size);
+		if (!chunk) {
+			return NULL;
+		}
+		chunk->next = arena->chunks;
+		arena->chunks = chunk;
+	}
+
+	ptr = VLD_ARENA_DATA(chunk) + chunk->used;
+	chunk->used += size;
+	arena->last = ptr;
+
+	return ptr;
+}
+
+void *vld_arena_calloc(vld_arena *arena, size_t nmemb, size_t size)
+{
+	void *ptr;
+
+	if (!arena) {
+		return calloc(nmemb ? nmemb : 1, size ? size : 1);
+	}
+	if (size && nmemb > (size_t) -1 / size) {
+		return NULL;
+	}
+	ptr = vld_arena_alloc(arena, nmemb * size);
+	if (ptr) {
+		memset(ptr, 0, nmemb * size);
+	}
+	return ptr;
+}
+
+/* Grows 'ptr' from 'old_size' to 'size' bytes. The latest allocation grows
+ * in place while its chunk has room, anything else is copied. */
+void *vld_arena_realloc(vld_arena *arena, void *ptr, size_t old_size, size_t size)
+{
+	vld_arena_chunk *chunk;
+	void            *tmp;
+
+	if (!arena) {
+		return realloc(ptr, size ? size : 1);
+	}
+	if (!ptr) {
+		return vld_arena_alloc(arena, size);
+	}
+
+	chunk = arena->chunks;
+	if (ptr == arena->last) {
+		size_t offset = (char *) ptr - VLD_ARENA_DATA(chunk);
+
+		if (chunk->size - offset >= VLD_ARENA_ALIGN(size)) {
+			chunk->used = offset + VLD_ARENA_ALIGN(size);
+			return ptr;
+		}
+	}
+
+	tmp = vld_arena_alloc(arena, size);
+	if (tmp) {
+		memcpy(tmp, ptr, old_size < size ? old_size : size);
+	}
+	return tmp;
+}
+
+/* Memory from an arena stays until the next reset */
+void vld_arena_release(vld_arena *arena, void *ptr)
+{
+	if (!arena) {
+		free(ptr);
+	}
+}
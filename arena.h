@@ -0,0 +1,41 @@
+/*
+   +----------------------------------------------------------------------+
+   | Copyright (c) 1997-2019 Derick Rethans                               |
+   +----------------------------------------------------------------------+
+   | This source file is subject to the 2-Clause BSD license which is     |
+   | available through the LICENSE file, or online at                     |
+   | http://opensource.org/licenses/bsd-license.php                       |
+   +----------------------------------------------------------------------+
+   | Authors:  Derick Rethans <derick@derickrethans.nl>                   |
+   +----------------------------------------------------------------------+
+ */
+
+#ifndef __ARENA_H__
+#define __ARENA_H__
+
+#include <stddef.h>
+
+typedef struct _vld_arena_chunk vld_arena_chunk;
+
+/* Bump pointer memory for everything the analysis of one op_array needs.
+ * Nothing is freed on its own, vld_arena_reset() releases it all at once
+ * and keeps the largest chunk for the next op_array. */
+typedef struct _vld_arena {
+	vld_arena_chunk *chunks; /* The one being filled, the older ones after it */
+	void            *last;   /* The latest allocation, which can grow in place */
+} vld_arena;
+
+#define VLD_ARENA_CHUNK_SIZE (64 * 1024)
+
+vld_arena *vld_arena_create(void);
+void vld_arena_reset(vld_arena *arena);
+void vld_arena_free(vld_arena *arena);
+
+/* With a NULL 'arena' these go to malloc() and friends, for data that has
+ * to outlive the analysis. */
+void *vld_arena_alloc(vld_arena *arena, size_t size);
+void *vld_arena_calloc(vld_arena *arena, size_t nmemb, size_t size);
+void *vld_arena_realloc(vld_arena *arena, void *ptr, size_t old_size, size_t size);
+void vld_arena_release(vld_arena *arena, void *ptr);
+
+#endif
@@ -0,0 +1,449 @@
+/*
+   +----------------------------------------------------------------------+
+   | Copyright (c) 1997-2019 Derick Rethans                               |
+   +----------------------------------------------------------------------+
+   | This source file is subject to the 2-Clause BSD license which is     |
+   | available through the LICENSE file, or online at                     |
+   | http://opensource.org/licenses/bsd-license.php                       |
+   +----------------------------------------------------------------------+
+   | Authors:  Derick Rethans <derick@derickrethans.nl>                   |
+   +----------------------------------------------------------------------+
+ */
+
+/* Writes the analysis of an op_array as one binary record, laid out as
+ * described in binary.h. The operands are classified by the same code as the
+ * JSON output, so utils/vld-bin2json can turn a record back into the JSON
+ * that would have been written for it. */
+
+#include "php.h"
+#include "zend_smart_str.h"
+#include "branchinfo.h"
+#include "srm_oparray.h"
+#include "set.h"
+#include "php_vld.h"
+#include "json_patch.h"
+#include "binary.h"
+#include "profile.h"
+#include "coverage.h"
+
+ZEND_EXTERN_MODULE_GLOBALS(vld)
+
+/* extern data declaration, referring to "srm_oparray.c". */
+extern op_usage opcodes[199];
+
+#define NUM_KNOWN_OPCODES (sizeof(opcodes) / sizeof(opcodes[0]))
+
+/* One record while it is being written. The string table and the values are
+ * only complete once all ops have been seen, so they are collected apart
+ * from the rest of the body and put in front of it at the end. */
+typedef struct _vld_binary {
+	smart_str strings;
+	smart_str values;
+	smart_str body;
+	HashTable string_ids;
+	uint32_t  strings_count;
+	uint32_t  values_count;
+} vld_binary;
+
+typedef struct _vld_binary_operand {
+	unsigned char kind;
+	uint32_t      aux;
+	int32_t       value;
+} vld_binary_operand;
+
+static void vld_binary_u8(smart_str *buf, unsigned char v)
+{
+	smart_str_appendc(buf, (char) v);
+}
+
+static void vld_binary_u16(smart_str *buf, uint16_t v)
+{
+	char b[2];
+
+	b[0] = v & 0xff;
+	b[1] = (v >> 8) & 0xff;
+	smart_str_appendl(buf, b, 2);
+}
+
+static void vld_binary_u32(smart_str *buf, uint32_t v)
+{
+	char b[4];
+	int  i;
+
+	for (i = 0; i < 4; i++) {
+		b[i] = (v >> (8 * i)) & 0xff;
+	}
+	smart_str_appendl(buf, b, 4);
+}
+
+static void vld_binary_u64(smart_str *buf, uint64_t v)
+{
+	char b[8];
+	int  i;
+
+	for (i = 0; i < 8; i++) {
+		b[i] = (v >> (8 * i)) & 0xff;
+	}
+	smart_str_appendl(buf, b, 8);
+}
+
+/* Returns the index of a string in the string table, adding it when it is
+ * not there yet. */
+static uint32_t vld_binary_string(vld_binary *b, const char *str, size_t len)
+{
+	zval *found, id;
+
+	if (!str) {
+		return VLD_BIN_NONE;
+	}
+	if ((found = zend_hash_str_find(&b->string_ids, str, len)) != NULL) {
+		return (uint32_t) Z_LVAL_P(found);
+	}
+	ZVAL_LONG(&id, b->strings_count);
+	zend_hash_str_add_new(&b->string_ids, str, len, &id);
+	vld_binary_u32(&b->strings, (uint32_t) len);
+	smart_str_appendl(&b->strings, str, len);
+	return b->strings_count++;
+}
+
+static uint32_t vld_binary_cstring(vld_binary *b, const char *str)
+{
+	return vld_binary_string(b, str, str ? strlen(str) : 0);
+}
+
+static uint32_t vld_binary_text(vld_binary *b, const char *text)
+{
+	vld_binary_u8(&b->values, VLD_BIN_VAL_TEXT);
+	vld_binary_u32(&b->values, vld_binary_cstring(b, text));
+	return b->values_count++;
+}
+
+/* Adds a literal to the values, shown the way vld_json_dump_zval() does. */
+static uint32_t vld_binary_zval(vld_binary *b, zval *val)
+{
+	switch (Z_TYPE_P(val)) {
+		case IS_NULL:
+			vld_binary_u8(&b->values, VLD_BIN_VAL_NULL);
+			break;
+		case IS_LONG:
+			vld_binary_u8(&b->values, VLD_BIN_VAL_LONG);
+			vld_binary_u64(&b->values, (uint64_t) Z_LVAL_P(val));
+			break;
+		case IS_DOUBLE: {
+			uint64_t bits;
+
+			memcpy(&bits, &Z_DVAL_P(val), sizeof(bits));
+			vld_binary_u8(&b->values, VLD_BIN_VAL_DOUBLE);
+			vld_binary_u64(&b->values, bits);
+			break;
+		}
+		case IS_STRING:
+			vld_binary_u8(&b->values, VLD_BIN_VAL_STRING);
+			vld_binary_u32(&b->values, vld_binary_string(b, Z_STRVAL_P(val), Z_STRLEN_P(val)));
+			break;
+		case IS_ARRAY:     return vld_binary_text(b, "<array>");
+		case IS_OBJECT:    return vld_binary_text(b, "<object>");
+		case IS_RESOURCE:  return vld_binary_text(b, "<resource>");
+#if PHP_VERSION_ID < 70300
+		case IS_CONSTANT: {
+			char    *buf;
+			uint32_t nr;
+
+			spprintf(&buf, 0, "<const:'%s'>", Z_STRVAL_P(val));
+			nr = vld_binary_text(b, buf);
+			efree(buf);
+			return nr;
+		}
+#endif
+		case IS_CONSTANT_AST: return vld_binary_text(b, "<const ast>");
+		case IS_UNDEF:     return vld_binary_text(b, "<undef>");
+		case IS_FALSE:     return vld_binary_text(b, "<false>");
+		case IS_TRUE:      return vld_binary_text(b, "<true>");
+		case IS_REFERENCE: return vld_binary_text(b, "<reference>");
+		case IS_INDIRECT:  return vld_binary_text(b, "<indirect>");
+		case IS_PTR:       return vld_binary_text(b, "<ptr>");
+		default:           return vld_binary_text(b, "<unknown>");
+	}
+	return b->values_count++;
+}
+
+static zval *vld_binary_literal(zend_op_array *opa, int opline, VLD_ZNODE node)
+{
+#if PHP_VERSION_ID >= 70300
+	return RT_CONSTANT((opa->opcodes) + opline, node);
+#else
+	return RT_CONSTANT_EX(opa->literals, node);
+#endif
+}
+
+#if PHP_VERSION_ID >= 70200
+static uint32_t vld_binary_jmp_array(vld_binary *b, zend_op_array *opa, int opline, VLD_ZNODE node)
+{
+	HashTable   *myht = Z_ARRVAL_P(vld_binary_literal(opa, opline, node));
+	zend_ulong   num;
+	zend_string *key;
+	zval        *val;
+
+	vld_binary_u8(&b->values, VLD_BIN_VAL_JMP_ARRAY);
+	vld_binary_u32(&b->values, zend_hash_num_elements(myht));
+	ZEND_HASH_FOREACH_KEY_VAL_IND(myht, num, key, val) {
+		if (key == NULL) {
+			vld_binary_u8(&b->values, 0);
+			vld_binary_u64(&b->values, (uint64_t) num);
+		} else {
+			vld_binary_u8(&b->values, 1);
+			vld_binary_u64(&b->values, vld_binary_string(b, ZSTR_VAL(key), ZSTR_LEN(key)));
+		}
+		vld_binary_u32(&b->values, (uint32_t) (int32_t) (opline + (val->value.lval / sizeof(zend_op))));
+	} ZEND_HASH_FOREACH_END();
+	return b->values_count++;
+}
+#endif
+
+/* The counterpart of vld_json_dump_znode() */
+static void vld_binary_znode(vld_binary *b, vld_binary_operand *operand, unsigned int node_type, VLD_ZNODE node, unsigned int base_address, zend_op_array *opa, int opline)
+{
+	operand->aux = 0;
+	operand->value = 0;
+	switch (node_type) {
+		case IS_UNUSED:
+			operand->kind = VLD_BIN_KIND_UNUSED;
+			break;
+		case IS_CONST:
+			operand->kind = VLD_BIN_KIND_CONST;
+			operand->aux = (uint32_t) (VLD_ZNODE_ELEM(node, var) / sizeof(zval));
+			operand->value = vld_binary_zval(b, vld_binary_literal(opa, opline, node));
+			break;
+		case IS_TMP_VAR:
+			operand->kind = VLD_BIN_KIND_TMP;
+			operand->value = VAR_NUM(VLD_ZNODE_ELEM(node, var));
+			break;
+		case IS_VAR:
+			operand->kind = VLD_BIN_KIND_VAR;
+			operand->value = VAR_NUM(VLD_ZNODE_ELEM(node, var));
+			break;
+		case IS_CV:
+			operand->kind = VLD_BIN_KIND_CV;
+			operand->value = (int32_t) ((VLD_ZNODE_ELEM(node, var) - sizeof(zend_execute_data)) / sizeof(zval));
+			break;
+		case VLD_IS_OPNUM:
+			operand->kind = VLD_BIN_KIND_OPNUM;
+			operand->value = VLD_ZNODE_JMP_LINE(node, opline, base_address);
+			break;
+		case VLD_IS_OPLINE:
+			operand->kind = VLD_BIN_KIND_OPLINE;
+			operand->value = VLD_ZNODE_JMP_LINE(node, opline, base_address);
+			break;
+		case VLD_IS_CLASS:
+			operand->kind = VLD_BIN_KIND_CLASS;
+			operand->value = vld_binary_zval(b, vld_binary_literal(opa, opline, node));
+			break;
+#if PHP_VERSION_ID >= 70200
+		case VLD_IS_JMP_ARRAY:
+			operand->kind = VLD_BIN_KIND_JMP_ARRAY;
+			operand->value = vld_binary_jmp_array(b, opa, opline, node);
+			break;
+#endif
+		default:
+			operand->kind = VLD_BIN_KIND_NONE;
+	}
+}
+
+static const char *vld_binary_include_name(uint32_t extended_value)
+{
+	switch (extended_value) {
+		case ZEND_INCLUDE_ONCE: return "INCLUDE_ONCE";
+		case ZEND_REQUIRE_ONCE: return "REQUIRE_ONCE";
+		case ZEND_INCLUDE:      return "INCLUDE";
+		case ZEND_REQUIRE:      return "REQUIRE";
+		case ZEND_EVAL:         return "EVAL";
+	}
+	return "!!ERROR!!";
+}
+
+/* The counterpart of vld_json_dump_op() */
+static void vld_binary_dump_op(vld_binary *b, int nr, zend_op *op_ptr, unsigned int base_address, unsigned char marks, zend_op_array *opa)
+{
+	const zend_op      op = op_ptr[nr];
+	unsigned int       flags, op1_type, op2_type, res_type;
+	unsigned char      op_flags = 0;
+	vld_binary_operand operands[4];
+	int                i;
+
+	flags = vld_json_op_types(&op, base_address, &res_type, &op1_type, &op2_type);
+
+	if (flags & EXT_VAL) {
+		op_flags |= VLD_BIN_OP_EXT;
+#if PHP_VERSION_ID >= 70300
+		if (op.opcode == ZEND_CATCH) {
+			op_flags |= VLD_BIN_OP_EXT_LAST;
+		}
+#endif
+	}
+
+	memset(operands, 0, sizeof(operands));
+#if PHP_VERSION_ID >= 70100
+	if ((flags & RES_USED) && op.result_type != IS_UNUSED) {
+#else
+	if ((flags & RES_USED) && !(op.VLD_EXTENDED_VALUE(result) & EXT_TYPE_UNUSED)) {
+#endif
+		vld_binary_znode(b, &operands[0], res_type, op.result, base_address, opa, nr);
+	}
+	if (flags & OP1_USED) {
+		vld_binary_znode(b, &operands[1], op1_type, op.op1, base_address, opa, nr);
+	}
+	if (flags & OP2_USED) {
+		if (flags & OP2_INCLUDE) {
+			operands[2].kind = VLD_BIN_KIND_INCLUDE;
+			operands[2].aux = op.extended_value;
+			operands[2].value = vld_binary_cstring(b, vld_binary_include_name(op.extended_value));
+		} else {
+			vld_binary_znode(b, &operands[2], op2_type, op.op2, base_address, opa, nr);
+		}
+	}
+	if (flags & EXT_VAL_JMP_ABS) {
+		operands[3].kind = VLD_BIN_KIND_JMP_ABS;
+		operands[3].value = op.extended_value;
+	} else if (flags & EXT_VAL_JMP_REL) {
+		operands[3].kind = VLD_BIN_KIND_JMP_REL;
+		operands[3].value = (int32_t) (nr + ((int) op.extended_value / sizeof(zend_op)));
+	} else if (flags & NOP2_OPNUM) {
+		vld_binary_znode(b, &operands[3], VLD_IS_OPNUM, op_ptr[nr + 1].op2, base_address, opa, nr);
+	}
+
+	vld_binary_u32(&b->body, op.lineno);
+	vld_binary_u32(&b->body, vld_binary_cstring(b, (op.opcode >= NUM_KNOWN_OPCODES) ? "UNKNOWN_OPCODE" : opcodes[op.opcode].name));
+	vld_binary_u32(&b->body, vld_binary_cstring(b, vld_json_fetch_type(&op, flags)));
+	vld_binary_u32(&b->body, op.extended_value);
+	vld_binary_u16(&b->body, op.opcode);
+	vld_binary_u8(&b->body, marks);
+	vld_binary_u8(&b->body, op_flags);
+	for (i = 0; i < 4; i++) {
+		vld_binary_u8(&b->body, operands[i].kind);
+		smart_str_appendl(&b->body, "\0\0\0", 3);
+		vld_binary_u32(&b->body, operands[i].aux);
+		vld_binary_u32(&b->body, (uint32_t) operands[i].value);
+	}
+}
+
+static void vld_binary_dump_branches(vld_binary *b, zend_op_array *opa, vld_branch_info *branch_info)
+{
+	vld_coverage *coverage = vld_coverage_find(opa);
+	unsigned int  i, j;
+
+	vld_binary_u64(&b->body, branch_info->paths_total);
+	vld_binary_u8(&b->body, branch_info->truncated ? 1 : 0);
+	vld_binary_u32(&b->body, branch_info->branches_count);
+	for (i = 0; i < branch_info->branches_count; i++) {
+		vld_branch *br = &branch_info->branches[i];
+
+		vld_binary_u32(&b->body, br->start_op);
+		vld_binary_u32(&b->body, br->end_op);
+		vld_binary_u32(&b->body, br->start_lineno);
+		vld_binary_u32(&b->body, br->end_lineno);
+		vld_binary_u8(&b->body, vld_coverage_branch_hit(coverage, i) ? 1 : 0);
+		vld_binary_u32(&b->body, br->outs_count);
+		for (j = 0; j < br->outs_count; j++) {
+			vld_binary_u32(&b->body, (uint32_t) VLD_BRANCH_OUT(branch_info, i, j));
+		}
+		if (VLD_G(coverage)) {
+			for (j = 0; j < br->outs_count; j++) {
+				vld_binary_u32(&b->body, vld_coverage_out_hit(coverage, i, j));
+			}
+		}
+	}
+
+	vld_binary_u32(&b->body, branch_info->paths_count);
+	for (i = 0; i < branch_info->paths_count; i++) {
+		vld_path *path = branch_info->paths[i];
+
+		vld_binary_u32(&b->body, path->elements_count);
+		for (j = 0; j < path->elements_count; j++) {
+			vld_binary_u32(&b->body, branch_info->branches[path->elements[j]].start_op);
+		}
+		if (VLD_G(coverage)) {
+			vld_binary_u32(&b->body, vld_coverage_path_hit(coverage, path));
+		}
+	}
+}
+
+void vld_binary_dump_oparray(vld_analysis *analysis)
+{
+	zend_op_array   *opa = analysis->opa;
+	vld_branch_info *branch_info = analysis->branch_info;
+	unsigned int     base_address = (unsigned int)(zend_intptr_t) &(opa->opcodes[0]);
+	zend_ulong      *hits = vld_profile_hits(opa);
+	unsigned char    flags = 0;
+	vld_binary       b;
+	smart_str        record = {0};
+	unsigned int     i;
+	int              j;
+
+	memset(&b, 0, sizeof(b));
+	zend_hash_init(&b.string_ids, 16, NULL, NULL, 0);
+
+	vld_binary_u32(&b.body, vld_binary_cstring(&b, VLD_G(json_data)->class));
+	vld_binary_u32(&b.body, opa->filename ? vld_binary_string(&b, ZSTR_VAL(opa->filename), ZSTR_LEN(opa->filename)) : VLD_BIN_NONE);
+	vld_binary_u32(&b.body, opa->function_name ? vld_binary_string(&b, ZSTR_VAL(opa->function_name), ZSTR_LEN(opa->function_name)) : VLD_BIN_NONE);
+
+	vld_binary_u32(&b.body, opa->last_var);
+	for (j = 0; j < opa->last_var; j++) {
+		vld_binary_u32(&b.body, vld_binary_cstring(&b, OPARRAY_VAR_NAME(opa->vars[j])));
+	}
+
+	vld_binary_u32(&b.body, opa->last);
+	for (i = 0; i < opa->last; i++) {
+		unsigned char marks = 0;
+
+		if (!vld_set_in(analysis->set, i)) {
+			marks |= VLD_BIN_MARK_DEAD;
+		}
+		if (vld_set_in(branch_info->entry_points, i)) {
+			marks |= VLD_BIN_MARK_ENTRY;
+		}
+		if (vld_set_in(branch_info->starts, i)) {
+			marks |= VLD_BIN_MARK_START;
+		}
+		if (vld_set_in(branch_info->ends, i)) {
+			marks |= VLD_BIN_MARK_END;
+		}
+		vld_binary_dump_op(&b, i, opa->opcodes, base_address, marks, opa);
+	}
+
+	if (VLD_G(profile)) {
+		flags |= VLD_BIN_HAS_HITS;
+		for (i = 0; i < opa->last; i++) {
+			vld_binary_u64(&b.body, hits ? (uint64_t) hits[i] : 0);
+		}
+	}
+	if (analysis->paths) {
+		flags |= VLD_BIN_HAS_PATHS;
+		if (VLD_G(coverage)) {
+			flags |= VLD_BIN_HAS_COVERAGE;
+		}
+		vld_binary_dump_branches(&b, opa, branch_info);
+	}
+
+	smart_str_appendl(&record, VLD_BIN_MAGIC, 4);
+	vld_binary_u16(&record, VLD_BIN_VERSION);
+	vld_binary_u8(&record, flags);
+	vld_binary_u8(&record, (unsigned char) MIN(MAX(VLD_G(verbosity), 0), 255));
+	vld_binary_u32(&record, (uint32_t) (8 + (b.strings.s ? ZSTR_LEN(b.strings.s) : 0) + (b.values.s ? ZSTR_LEN(b.values.s) : 0) + ZSTR_LEN(b.body.s)));
+	vld_binary_u32(&record, b.strings_count);
+	if (b.strings.s) {
+		smart_str_appendl(&record, ZSTR_VAL(b.strings.s), ZSTR_LEN(b.strings.s));
+	}
+	vld_binary_u32(&record, b.values_count);
+	if (b.values.s) {
+		smart_str_appendl(&record, ZSTR_VAL(b.values.s), ZSTR_LEN(b.values.s));
+	}
+	smart_str_appendl(&record, ZSTR_VAL(b.body.s), ZSTR_LEN(b.body.s));
+
+	vld_output_write(stdout, ZSTR_VAL(record.s), ZSTR_LEN(record.s));
+
+	smart_str_free(&record);
+	smart_str_free(&b.strings);
+	smart_str_free(&b.values);
+	smart_str_free(&b.body);
+	zend_hash_destroy(&b.string_ids);
+}
@@ -0,0 +1,110 @@
+/*
+   +----------------------------------------------------------------------+
+   | Copyright (c) 1997-2019 Derick Rethans                               |
+   +----------------------------------------------------------------------+
+   | This source file is subject to the 2-Clause BSD license which is     |
+   | available through the LICENSE file, or online at                     |
+   | http://opensource.org/licenses/bsd-license.php                       |
+   +----------------------------------------------------------------------+
+   | Authors:  Derick Rethans <derick@derickrethans.nl>                   |
+   +----------------------------------------------------------------------+
+ */
+
+#ifndef VLD_BINARY_H
+#define VLD_BINARY_H
+
+/* The "binary" output format. Every op_array becomes one record; records
+ * are written back to back, and all numbers are little endian.
+ *
+ * header (VLD_BIN_HEADER_SIZE bytes)
+ *   char[4] "VLDB", u16 version, u8 flags (VLD_BIN_HAS_*), u8 verbosity,
+ *   u32 length of the body that follows
+ *
+ * body
+ *   strings  u32 count, then u32 length and the bytes of each string
+ *   values   u32 count, then a u8 VLD_BIN_VAL_* tag and its payload each:
+ *            NULL -, LONG i64, DOUBLE u64 (the bits), STRING and TEXT u32
+ *            string, JMP_ARRAY u32 count and VLD_BIN_JMP_SIZE bytes each
+ *            (u8 0 and i64 key, or u8 1 and the string of the key in the
+ *            i64, then i32 target op)
+ *   function u32 class, u32 filename, u32 function name
+ *   vars     u32 count, u32 string each
+ *   ops      u32 count, VLD_BIN_OP_SIZE bytes each:
+ *            u32 line, u32 name, u32 fetch, u32 extended value, u16 opcode,
+ *            u8 marks (VLD_BIN_MARK_*), u8 flags (VLD_BIN_OP_*), then the
+ *            result, op1, op2 and ext_op operands, VLD_BIN_OPERAND_SIZE
+ *            bytes each: u8 kind (VLD_BIN_KIND_*), 3 bytes padding, u32 aux,
+ *            i32 value
+ *   hits     (VLD_BIN_HAS_HITS) u64 per op
+ *   branches (VLD_BIN_HAS_PATHS) u64 estimated paths, u8 truncated, u32
+ *            count, and for each branch: u32 start op, end op, start line,
+ *            end line, u8 hit, u32 number of outs, i32 per out and (with
+ *            VLD_BIN_HAS_COVERAGE) u32 hit per out; then u32 number of
+ *            paths, and for each path: u32 length, u32 start op per branch
+ *            and (with VLD_BIN_HAS_COVERAGE) u32 hit
+ *
+ * Strings are referred to by their index in the string table of the same
+ * record, VLD_BIN_NONE stands for null. The meaning of the operand fields
+ * depends on the kind:
+ *   CONST, CLASS     aux is the literal number, value the index of a value
+ *   TMP, VAR, CV     value is the variable number
+ *   OPNUM, OPLINE,
+ *   JMP_ABS, JMP_REL value is the target op
+ *   JMP_ARRAY        value is the index of a VLD_BIN_VAL_JMP_ARRAY value
+ *   INCLUDE          value is the string with the kind of include
+ *
+ * This header does not depend on PHP, so that readers can use it too. */
+
+#define VLD_BIN_MAGIC        "VLDB"
+#define VLD_BIN_VERSION      1
+#define VLD_BIN_HEADER_SIZE  12
+#define VLD_BIN_OPERAND_SIZE 12
+#define VLD_BIN_OP_SIZE      (20 + 4 * VLD_BIN_OPERAND_SIZE)
+#define VLD_BIN_JMP_SIZE     13
+#define VLD_BIN_NONE         0xFFFFFFFFU
+
+/* header flags */
+#define VLD_BIN_HAS_HITS     (1<<0)
+#define VLD_BIN_HAS_PATHS    (1<<1)
+#define VLD_BIN_HAS_COVERAGE (1<<2)
+
+/* value tags; STRING is shown url encoded, TEXT as it is */
+#define VLD_BIN_VAL_NULL      0
+#define VLD_BIN_VAL_LONG      1
+#define VLD_BIN_VAL_DOUBLE    2
+#define VLD_BIN_VAL_STRING    3
+#define VLD_BIN_VAL_TEXT      4
+#define VLD_BIN_VAL_JMP_ARRAY 5
+
+/* op marks, the '*', 'E', 'I' and 'O' columns */
+#define VLD_BIN_MARK_DEAD  (1<<0)
+#define VLD_BIN_MARK_ENTRY (1<<1)
+#define VLD_BIN_MARK_START (1<<2)
+#define VLD_BIN_MARK_END   (1<<3)
+
+/* op flags */
+#define VLD_BIN_OP_EXT      (1<<0) /* The extended value is shown */
+#define VLD_BIN_OP_EXT_LAST (1<<1) /* ... as "last" */
+
+/* operand kinds */
+#define VLD_BIN_KIND_NONE      0
+#define VLD_BIN_KIND_UNUSED    1
+#define VLD_BIN_KIND_CONST     2
+#define VLD_BIN_KIND_TMP       3
+#define VLD_BIN_KIND_VAR       4
+#define VLD_BIN_KIND_CV        5
+#define VLD_BIN_KIND_OPNUM     6
+#define VLD_BIN_KIND_OPLINE    7
+#define VLD_BIN_KIND_CLASS     8
+#define VLD_BIN_KIND_JMP_ARRAY 9
+#define VLD_BIN_KIND_JMP_ABS   10
+#define VLD_BIN_KIND_JMP_REL   11
+#define VLD_BIN_KIND_INCLUDE   12
+
+#ifdef PHP_VERSION_ID
+struct _vld_analysis;
+
+void vld_binary_dump_oparray(struct _vld_analysis *analysis);
+#endif
+
+#endif
@@ -13,20 +13,36 @@
 
 #include <stdlib.h>
 #include <math.h>
+#ifdef PHP_WIN32
+# include "win32/time.h"
+#else
+# include <sys/time.h>
+#endif
 #include "branchinfo.h"
+#include "coverage.h"
 
 ZEND_EXTERN_MODULE_GLOBALS(vld)
 
-vld_branch_info *vld_branch_info_create(unsigned int size)
+vld_branch_info *vld_branch_info_create(vld_arena *arena, unsigned int size)
 {
 	vld_branch_info *tmp;
 
-	tmp = calloc(1, sizeof(vld_branch_info));
+	tmp = vld_arena_calloc(arena, 1, sizeof(vld_branch_info));
+	tmp->arena = arena;
 	tmp->size = size;
-	tmp->branches = calloc(size, sizeof(vld_branch));
-	tmp->entry_points = vld_set_create(size);
-	tmp->starts       = vld_set_create(size);
-	tmp->ends         = vld_set_create(size);
+	tmp->entry_points = vld_set_create(arena, size);
+	tmp->starts       = vld_set_create(arena, size);
+	tmp->ends         = vld_set_create(arena, size);
+
+	tmp->jumps_count = 0;
+	tmp->jumps_size  = 0;
+	tmp->jumps = NULL;
+
+	tmp->branches_count = 0;
+	tmp->branches = NULL;
+	tmp->outs_count = 0;
+	tmp->outs = NULL;
+	tmp->op_branch = NULL;
 
 	tmp->paths_count = 0;
 	tmp->paths_size  = 0;
@@ -38,28 +54,40 @@ vld_branch_info *vld_branch_info_create(unsigned int size)
 void vld_branch_info_free(vld_branch_info *branch_info)
 {
 	unsigned int i;
+	vld_arena   *arena = branch_info->arena;
 
 	for (i = 0; i < branch_info->paths_count; i++) {
-		free(branch_info->paths[i]->elements);
-		free(branch_info->paths[i]);
+		vld_arena_release(arena, branch_info->paths[i]->elements);
+		vld_arena_release(arena, branch_info->paths[i]);
 	}
-	free(branch_info->paths);
-	free(branch_info->branches);
+	vld_arena_release(arena, branch_info->paths);
+	vld_arena_release(arena, branch_info->jumps);
+	vld_arena_release(arena, branch_info->branches);
+	vld_arena_release(arena, branch_info->outs);
+	vld_arena_release(arena, branch_info->op_branch);
 	vld_set_free(branch_info->entry_points);
 	vld_set_free(branch_info->starts);
 	vld_set_free(branch_info->ends);
-	free(branch_info);
+	vld_arena_release(arena, branch_info);
 }
 
-void vld_branch_info_update(vld_branch_info *branch_info, unsigned int pos, unsigned int lineno, unsigned int outidx, unsigned int jump_pos)
+/* Records out number 'outidx' of the jump at 'pos'. The jumps are only
+ * gathered here; vld_branch_post_process() turns them into the outs of the
+ * branches. */
+void vld_branch_info_update(vld_branch_info *branch_info, unsigned int pos, unsigned int outidx, int jump_pos)
 {
 	vld_set_add(branch_info->ends, pos);
-	if (branch_info->branches[pos].outs_count < VLD_BRANCH_MAX_OUTS) {
-		branch_info->branches[pos].outs[branch_info->branches[pos].outs_count] = jump_pos;
-		branch_info->branches[pos].outs_count++;
-	}
 
-	branch_info->branches[pos].start_lineno = lineno;
+	if (branch_info->jumps_count == branch_info->jumps_size) {
+		unsigned int old_size = branch_info->jumps_size;
+
+		branch_info->jumps_size = old_size ? old_size * 2 : 32;
+		branch_info->jumps = vld_arena_realloc(branch_info->arena, branch_info->jumps, sizeof(vld_branch_jump) * old_size, sizeof(vld_branch_jump) * branch_info->jumps_size);
+	}
+	branch_info->jumps[branch_info->jumps_count].pos    = pos;
+	branch_info->jumps[branch_info->jumps_count].outidx = outidx;
+	branch_info->jumps[branch_info->jumps_count].target = jump_pos;
+	branch_info->jumps_count++;
 }
 
 void vld_only_leave_first_catch(zend_op_array *opa, vld_branch_info *branch_info, int position)
@@ -99,18 +127,33 @@ void vld_only_leave_first_catch(zend_op_array *opa, vld_branch_info *branch_info
 	vld_set_remove(branch_info->entry_points, position);
 }
 
+static int vld_branch_jump_compare(const void *a, const void *b)
+{
+	const vld_branch_jump *ja = a, *jb = b;
+
+	if (ja->pos != jb->pos) {
+		return ja->pos < jb->pos ? -1 : 1;
+	}
+	return ja->outidx < jb->outidx ? -1 : (ja->outidx > jb->outidx);
+}
+
+/* Numbers the branches densely in opcode order, and gathers their outs in
+ * one array, so that the memory used grows with the number of branches and
+ * edges instead of with the number of opcodes. */
 void vld_branch_post_process(zend_op_array *opa, vld_branch_info *branch_info)
 {
-	unsigned int i;
-	int in_branch = 0, last_start = VLD_JMP_NOT_SET;
+	unsigned int i, b, jump = 0;
+	int in_branch = 0;
+	vld_set *marks;
+	vld_branch *last = NULL;
 #if PHP_VERSION_ID >= 70300 && ZEND_USE_ABS_JMP_ADDR
 	zend_op *base_address = &(opa->opcodes[0]);
 #endif
 
 	/* Figure out which CATCHes are chained, and hence which ones should be
 	 * considered entry points */
-	for (i = 0; i < branch_info->entry_points->size; i++) {
-		if (vld_set_in(branch_info->entry_points, i) && opa->opcodes[i].opcode == ZEND_CATCH) {
+	for (i = vld_set_next(branch_info->entry_points, 0); i < branch_info->entry_points->size; i = vld_set_next(branch_info->entry_points, i + 1)) {
+		if (opa->opcodes[i].opcode == ZEND_CATCH) {
 #if PHP_VERSION_ID >= 70300
 # if ZEND_USE_ABS_JMP_ADDR
 			if (opa->opcodes[i].op2.jmp_addr != NULL) {
@@ -128,35 +171,68 @@ void vld_branch_post_process(zend_op_array *opa, vld_branch_info *branch_info)
 		}
 	}
 
-	for (i = 0; i < branch_info->starts->size; i++) {
+	qsort(branch_info->jumps, branch_info->jumps_count, sizeof(vld_branch_jump), vld_branch_jump_compare);
+
+	branch_info->branches = vld_arena_calloc(branch_info->arena, vld_set_count(branch_info->starts) + 1, sizeof(vld_branch));
+	branch_info->outs = vld_arena_calloc(branch_info->arena, branch_info->jumps_count + vld_set_count(branch_info->starts) + 1, sizeof(int));
+	branch_info->op_branch = vld_arena_alloc(branch_info->arena, sizeof(unsigned int) * (branch_info->size ? branch_info->size : 1));
+
+	/* Only the starts and ends of branches matter */
+	marks = vld_set_create(branch_info->arena, branch_info->starts->size);
+	vld_set_union(marks, branch_info->starts);
+	vld_set_union(marks, branch_info->ends);
+
+	for (i = vld_set_next(marks, 0); i < marks->size; i = vld_set_next(marks, i + 1)) {
 		if (vld_set_in(branch_info->starts, i)) {
 			if (in_branch) {
-				branch_info->branches[last_start].outs_count = 1;
-				branch_info->branches[last_start].outs[0] = i;
-				branch_info->branches[last_start].end_op = i-1;
-				branch_info->branches[last_start].end_lineno = branch_info->branches[i].start_lineno;
+				/* Falls through into the next branch */
+				last->outs_count = 1;
+				branch_info->outs[branch_info->outs_count++] = i;
+				last->end_op = i-1;
+				last->end_lineno = opa->opcodes[i].lineno;
 			}
-			last_start = i;
+			last = &branch_info->branches[branch_info->branches_count++];
+			last->start_op = i;
+			last->start_lineno = opa->opcodes[i].lineno;
+			last->outs_start = branch_info->outs_count;
 			in_branch = 1;
 		}
-		if (vld_set_in(branch_info->ends, i)) {
-			size_t j;
-			for (j = 0; j < branch_info->branches[i].outs_count; j++) {
-				branch_info->branches[last_start].outs[j] = branch_info->branches[i].outs[j];
+		if (vld_set_in(branch_info->ends, i) && last) {
+			/* An end outside of a branch replaces the outs of the last one */
+			branch_info->outs_count = last->outs_start;
+			last->outs_count = 0;
+
+			while (jump < branch_info->jumps_count && branch_info->jumps[jump].pos < i) {
+				jump++;
+			}
+			while (jump < branch_info->jumps_count && branch_info->jumps[jump].pos == i) {
+				branch_info->outs[branch_info->outs_count++] = branch_info->jumps[jump].target;
+				last->outs_count++;
+				jump++;
 			}
-			branch_info->branches[last_start].outs_count = branch_info->branches[i].outs_count;
-			branch_info->branches[last_start].end_op = i;
-			branch_info->branches[last_start].end_lineno = branch_info->branches[i].start_lineno;
+			last->end_op = i;
+			last->end_lineno = opa->opcodes[i].lineno;
 			in_branch = 0;
 		}
 	}
+	vld_set_free(marks);
+
+	for (i = 0; i < branch_info->size; i++) {
+		branch_info->op_branch[i] = VLD_NO_BRANCH;
+	}
+	for (b = 0; b < branch_info->branches_count; b++) {
+		branch_info->op_branch[branch_info->branches[b].start_op] = b;
+		for (i = branch_info->branches[b].start_op; i <= branch_info->branches[b].end_op && i < branch_info->size; i++) {
+			branch_info->op_branch[i] = b;
+		}
+	}
 }
 
-static void vld_path_add(vld_path *path, unsigned int nr)
+static void vld_path_add(vld_branch_info *branch_info, vld_path *path, unsigned int nr)
 {
 	if (path->elements_count == path->elements_size) {
 		path->elements_size += 32;
-		path->elements = realloc(path->elements, sizeof(unsigned int) * path->elements_size);
+		path->elements = vld_arena_realloc(branch_info->arena, path->elements, sizeof(unsigned int) * path->elements_count, sizeof(unsigned int) * path->elements_size);
 	}
 	path->elements[path->elements_count] = nr;
 	path->elements_count++;
@@ -166,38 +242,29 @@ static void vld_branch_info_add_path(vld_branch_info *branch_info, vld_path *pat
 {
 	if (branch_info->paths_count == branch_info->paths_size) {
 		branch_info->paths_size += 32;
-		branch_info->paths = realloc(branch_info->paths, sizeof(vld_path*) * branch_info->paths_size);
+		branch_info->paths = vld_arena_realloc(branch_info->arena, branch_info->paths, sizeof(vld_path*) * branch_info->paths_count, sizeof(vld_path*) * branch_info->paths_size);
 	}
 	branch_info->paths[branch_info->paths_count] = path;
 	branch_info->paths_count++;
 }
 
-static vld_path *vld_path_new(vld_path *old_path)
+static vld_path *vld_path_new(vld_branch_info *branch_info, vld_path *old_path)
 {
 	vld_path *tmp;
-	tmp = calloc(1, sizeof(vld_path));
-
-	if (old_path) {
-		unsigned i;
+	tmp = vld_arena_calloc(branch_info->arena, 1, sizeof(vld_path));
 
-		for (i = 0; i < old_path->elements_count; i++) {
-			vld_path_add(tmp, old_path->elements[i]);
-		}
+	if (old_path && old_path->elements_count) {
+		tmp->elements_count = tmp->elements_size = old_path->elements_count;
+		tmp->elements = vld_arena_alloc(branch_info->arena, sizeof(unsigned int) * old_path->elements_count);
+		memcpy(tmp->elements, old_path->elements, sizeof(unsigned int) * old_path->elements_count);
 	}
 	return tmp;
 }
 
-static void vld_path_free(vld_path *path)
-{
-	if (path->elements) {
-		free(path->elements);
-	}
-	free(path);
-}
-
-static unsigned int vld_branch_find_last_element(vld_path *path)
+static void vld_path_free(vld_branch_info *branch_info, vld_path *path)
 {
-	return path->elements[path->elements_count-1];
+	vld_arena_release(branch_info->arena, path->elements);
+	vld_arena_release(branch_info->arena, path);
 }
 
 static int vld_path_exists(vld_path *path, unsigned int elem1, unsigned int elem2)
@@ -212,106 +279,461 @@ static int vld_path_exists(vld_path *path, unsigned int elem1, unsigned int elem
 	return 0;
 }
 
-static void vld_branch_find_path(unsigned int nr, vld_branch_info *branch_info, vld_path *prev_path)
+static uint64_t vld_branch_clock(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return (uint64_t) tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+/* Whether the search for paths has to stop because of vld.path_limit, or
+ * the deadline from vld.path_time_limit and vld.path_budget. The clock is
+ * only read every 64 steps. */
+static int vld_branch_paths_exhausted(vld_branch_info *branch_info)
+{
+	if (branch_info->truncated) {
+		return 1;
+	}
+	if (VLD_G(path_limit) > 0 && branch_info->paths_count >= (zend_ulong) VLD_G(path_limit)) {
+		branch_info->truncated = 1;
+		return 1;
+	}
+	if (branch_info->deadline && (++branch_info->steps & 63) == 0 && vld_branch_clock() >= branch_info->deadline) {
+		branch_info->truncated = 1;
+		branch_info->truncated_by_time = 1;
+		return 1;
+	}
+	return 0;
+}
+
+/* The branch that out 'j' of branch 'nr' leads to, or VLD_NO_BRANCH when it
+ * leaves the function. */
+static unsigned int vld_branch_out_branch(vld_branch_info *branch_info, unsigned int nr, unsigned int j)
+{
+	int out = VLD_BRANCH_OUT(branch_info, nr, j);
+
+	if (out == VLD_JMP_EXIT || out < 0 || (unsigned int) out >= branch_info->size) {
+		return VLD_NO_BRANCH;
+	}
+	return branch_info->op_branch[out];
+}
+
+/* Extends 'stack', the path that led to 'nr', with every way out of 'nr'.
+ * The one stack is shared by the whole search, only complete paths are
+ * copied out of it. */
+static void vld_branch_find_path(unsigned int nr, vld_branch_info *branch_info, vld_path *stack)
 {
-	unsigned int last;
-	vld_path *new_path;
 	int found = 0;
 	size_t i = 0;
 
-	if (branch_info->paths_count > 255/*65535*/) {
+	if (vld_branch_paths_exhausted(branch_info)) {
 		return;
 	}
 
-	new_path = vld_path_new(prev_path);
-	vld_path_add(new_path, nr);
-
-	last = vld_branch_find_last_element(new_path);
+	vld_path_add(branch_info, stack, nr);
 
 	for (i = 0; i < branch_info->branches[nr].outs_count; i++) {
-		int out = branch_info->branches[nr].outs[i];
-		if (out != 0 && out != VLD_JMP_EXIT && !vld_path_exists(new_path, last, out)) {
-			vld_branch_find_path(out, branch_info, new_path);
+		unsigned int out = vld_branch_out_branch(branch_info, nr, i);
+		if (out != VLD_NO_BRANCH && !vld_path_exists(stack, nr, out)) {
+			vld_branch_find_path(out, branch_info, stack);
 			found = 1;
 		}
 	}
 	if (!found) {
-		vld_branch_info_add_path(branch_info, new_path);
-	} else {
-		vld_path_free(new_path);
+		vld_branch_info_add_path(branch_info, vld_path_new(branch_info, stack));
+	}
+	stack->elements_count--;
+}
+
+/* The branches as a graph, as far as they can be reached from an entry
+ * point. Edge 'j' of branch 'n' is number branches[n].outs_start + j. */
+typedef struct _vld_branch_graph {
+	unsigned char *back;   /* Whether the edge closes a loop */
+	unsigned int  *order;  /* The reachable branches, successors first */
+	unsigned int   order_count;
+	unsigned int  *parent; /* Predecessor in the depth first search tree */
+	unsigned int  *next;   /* Successor on a shortest way to an exit */
+} vld_branch_graph;
+
+#define VLD_BRANCH_EDGE(bi, n, j) ((bi)->branches[n].outs_start + (j))
+
+static void vld_branch_graph_build(vld_branch_info *branch_info, vld_branch_graph *graph)
+{
+	unsigned int   size = branch_info->branches_count;
+	vld_arena     *arena = branch_info->arena;
+	unsigned int  *stack, *out_pos, *dist, *queue, *pred_base, *preds;
+	unsigned char *state;
+	unsigned int   e, i, j, top, head, tail;
+
+	graph->back = vld_arena_calloc(arena, branch_info->outs_count + 1, 1);
+	graph->order = vld_arena_calloc(arena, size + 1, sizeof(unsigned int));
+	graph->order_count = 0;
+	graph->parent = vld_arena_calloc(arena, size + 1, sizeof(unsigned int));
+	graph->next = vld_arena_calloc(arena, size + 1, sizeof(unsigned int));
+
+	stack = vld_arena_calloc(arena, size + 1, sizeof(unsigned int));
+	out_pos = vld_arena_calloc(arena, size + 1, sizeof(unsigned int));
+	state = vld_arena_calloc(arena, size + 1, 1);
+
+	/* Depth first search without recursion. An edge to a branch that is
+	 * still on the stack is a back edge, and the post order lists every
+	 * branch after all of its successors along the other edges. */
+	for (e = vld_set_next(branch_info->entry_points, 0); e < branch_info->size; e = vld_set_next(branch_info->entry_points, e + 1)) {
+		i = branch_info->op_branch[e];
+		if (i == VLD_NO_BRANCH || state[i]) {
+			continue;
+		}
+		state[i] = 1;
+		graph->parent[i] = VLD_NO_BRANCH;
+		top = 0;
+		stack[top++] = i;
+
+		while (top > 0) {
+			unsigned int n = stack[top - 1];
+
+			if (out_pos[n] < branch_info->branches[n].outs_count) {
+				unsigned int out;
+
+				j = out_pos[n]++;
+				out = vld_branch_out_branch(branch_info, n, j);
+				if (out == VLD_NO_BRANCH) {
+					continue;
+				}
+				if (state[out] == 1) {
+					graph->back[VLD_BRANCH_EDGE(branch_info, n, j)] = 1;
+				} else if (state[out] == 0) {
+					state[out] = 1;
+					graph->parent[out] = n;
+					stack[top++] = out;
+				}
+			} else {
+				state[n] = 2;
+				graph->order[graph->order_count++] = n;
+				top--;
+			}
+		}
+	}
+
+	/* Breadth first search backwards from the exits, so that following
+	 * 'next' from any branch leaves the function without going around a
+	 * loop. */
+	dist = stack;
+	queue = out_pos;
+	pred_base = vld_arena_calloc(arena, size + 1, sizeof(unsigned int));
+	preds = vld_arena_calloc(arena, branch_info->outs_count + 1, sizeof(unsigned int));
+	memset(dist, 0, size * sizeof(unsigned int));
+
+	for (i = 0; i < graph->order_count; i++) {
+		unsigned int n = graph->order[i];
+
+		for (j = 0; j < branch_info->branches[n].outs_count; j++) {
+			unsigned int out = vld_branch_out_branch(branch_info, n, j);
+
+			if (out != VLD_NO_BRANCH) {
+				pred_base[out + 1]++;
+			}
+		}
+	}
+	for (i = 0; i < size; i++) {
+		pred_base[i + 1] += pred_base[i];
+	}
+	for (i = 0; i < graph->order_count; i++) {
+		unsigned int n = graph->order[i];
+
+		for (j = 0; j < branch_info->branches[n].outs_count; j++) {
+			unsigned int out = vld_branch_out_branch(branch_info, n, j);
+
+			if (out != VLD_NO_BRANCH) {
+				preds[pred_base[out] + dist[out]++] = n;
+			}
+		}
+	}
+
+	head = tail = 0;
+	for (i = 0; i < size; i++) {
+		dist[i] = VLD_NO_BRANCH;
+		graph->next[i] = VLD_NO_BRANCH;
+	}
+	for (i = 0; i < graph->order_count; i++) {
+		unsigned int n = graph->order[i];
+		int is_exit = 1;
+
+		for (j = 0; j < branch_info->branches[n].outs_count; j++) {
+			if (vld_branch_out_branch(branch_info, n, j) != VLD_NO_BRANCH) {
+				is_exit = 0;
+			}
+		}
+		if (is_exit) {
+			dist[n] = 0;
+			queue[tail++] = n;
+		}
+	}
+	while (head < tail) {
+		unsigned int n = queue[head++];
+
+		for (j = pred_base[n]; j < pred_base[n + 1]; j++) {
+			if (dist[preds[j]] == VLD_NO_BRANCH) {
+				dist[preds[j]] = dist[n] + 1;
+				graph->next[preds[j]] = n;
+				queue[tail++] = preds[j];
+			}
+		}
+	}
+
+	vld_arena_release(arena, preds);
+	vld_arena_release(arena, pred_base);
+	vld_arena_release(arena, state);
+	vld_arena_release(arena, out_pos);
+	vld_arena_release(arena, stack);
+}
+
+static void vld_branch_graph_free(vld_branch_info *branch_info, vld_branch_graph *graph)
+{
+	vld_arena_release(branch_info->arena, graph->back);
+	vld_arena_release(branch_info->arena, graph->order);
+	vld_arena_release(branch_info->arena, graph->parent);
+	vld_arena_release(branch_info->arena, graph->next);
+}
+
+/* Counts the paths from the entry points to an exit once the back edges are
+ * removed, in one pass over the branches. The count saturates instead of
+ * overflowing. */
+static uint64_t vld_branch_count_paths(vld_branch_info *branch_info, vld_branch_graph *graph)
+{
+	uint64_t    *counts = vld_arena_calloc(branch_info->arena, branch_info->branches_count + 1, sizeof(uint64_t));
+	uint64_t     total = 0;
+	unsigned int e, i, j;
+
+	for (i = 0; i < graph->order_count; i++) {
+		unsigned int n = graph->order[i];
+		uint64_t     count = 0;
+		int          found = 0;
+
+		for (j = 0; j < branch_info->branches[n].outs_count; j++) {
+			unsigned int out = vld_branch_out_branch(branch_info, n, j);
+
+			if (out != VLD_NO_BRANCH && !graph->back[VLD_BRANCH_EDGE(branch_info, n, j)]) {
+				count = (count > UINT64_MAX - counts[out]) ? UINT64_MAX : count + counts[out];
+				found = 1;
+			}
+		}
+		counts[n] = found ? count : 1;
+	}
+
+	for (e = vld_set_next(branch_info->entry_points, 0); e < branch_info->size; e = vld_set_next(branch_info->entry_points, e + 1)) {
+		i = branch_info->op_branch[e];
+		if (i != VLD_NO_BRANCH) {
+			total = (total > UINT64_MAX - counts[i]) ? UINT64_MAX : total + counts[i];
+		}
+	}
+	vld_arena_release(branch_info->arena, counts);
+
+	return total;
+}
+
+/* Adds the path that follows the search tree from an entry point to 'nr',
+ * optionally takes the edge to 'out', and then leaves the function along
+ * the shortest way. Marks all the edges that it uses. */
+static void vld_branch_add_basis_path(vld_branch_info *branch_info, vld_branch_graph *graph, unsigned char *covered, unsigned int nr, unsigned int out)
+{
+	vld_path    *path = vld_path_new(branch_info, NULL);
+	unsigned int n, i, j;
+
+	for (n = nr; n != VLD_NO_BRANCH; n = graph->parent[n]) {
+		vld_path_add(branch_info, path, n);
+	}
+	for (i = 0, j = path->elements_count - 1; i < j; i++, j--) {
+		n = path->elements[i];
+		path->elements[i] = path->elements[j];
+		path->elements[j] = n;
+	}
+
+	n = nr;
+	if (out != VLD_NO_BRANCH) {
+		n = out;
+		vld_path_add(branch_info, path, n);
+	}
+	while (graph->next[n] != VLD_NO_BRANCH) {
+		n = graph->next[n];
+		vld_path_add(branch_info, path, n);
+	}
+
+	for (i = 0; i + 1 < path->elements_count; i++) {
+		n = path->elements[i];
+		for (j = 0; j < branch_info->branches[n].outs_count; j++) {
+			if (vld_branch_out_branch(branch_info, n, j) == path->elements[i + 1]) {
+				covered[VLD_BRANCH_EDGE(branch_info, n, j)] = 1;
+			}
+		}
+	}
+
+	vld_branch_info_add_path(branch_info, path);
+}
+
+/* McCabe style basis paths: a shortest path out of every entry point, and
+ * then one path for every edge that no earlier path took. Each path has an
+ * edge that the others have not, so they are linearly independent, and
+ * together they use every edge of the function. */
+static void vld_branch_find_basis_paths(vld_branch_info *branch_info, vld_branch_graph *graph)
+{
+	unsigned char *covered = vld_arena_calloc(branch_info->arena, branch_info->outs_count + 1, 1);
+	unsigned int   e, i, j;
+
+	for (e = vld_set_next(branch_info->entry_points, 0); e < branch_info->size; e = vld_set_next(branch_info->entry_points, e + 1)) {
+		if (branch_info->op_branch[e] != VLD_NO_BRANCH) {
+			vld_branch_add_basis_path(branch_info, graph, covered, branch_info->op_branch[e], VLD_NO_BRANCH);
+		}
+	}
+
+	for (i = 0; i < graph->order_count; i++) {
+		unsigned int n = graph->order[graph->order_count - 1 - i];
+
+		for (j = 0; j < branch_info->branches[n].outs_count; j++) {
+			unsigned int out = vld_branch_out_branch(branch_info, n, j);
+
+			if (out == VLD_NO_BRANCH || covered[VLD_BRANCH_EDGE(branch_info, n, j)]) {
+				continue;
+			}
+			if (vld_branch_paths_exhausted(branch_info)) {
+				vld_arena_release(branch_info->arena, covered);
+				return;
+			}
+			vld_branch_add_basis_path(branch_info, graph, covered, n, out);
+		}
 	}
+	vld_arena_release(branch_info->arena, covered);
 }
 
 void vld_branch_find_paths(vld_branch_info *branch_info)
 {
-	unsigned int i;
+	unsigned int     i;
+	vld_branch_graph graph;
+	uint64_t         start = vld_branch_clock();
+
+	branch_info->deadline = 0;
+	if (VLD_G(path_time_limit) > 0) {
+		branch_info->deadline = start + (uint64_t) VLD_G(path_time_limit) * 1000;
+	}
+	if (VLD_G(path_budget) > 0) {
+		uint64_t budget = (uint64_t) VLD_G(path_budget) * 1000;
+
+		if (VLD_G(path_budget_used) >= budget) {
+			/* Nothing left for this request, the count is still cheap */
+			branch_info->truncated = 1;
+			branch_info->truncated_by_time = 1;
+		} else if (!branch_info->deadline || start + budget - VLD_G(path_budget_used) < branch_info->deadline) {
+			branch_info->deadline = start + budget - VLD_G(path_budget_used);
+		}
+	}
 
-	for (i = 0; i < branch_info->entry_points->size; i++) {
-		if (vld_set_in(branch_info->entry_points, i)) {
-			vld_branch_find_path(i, branch_info, NULL);
+	vld_branch_graph_build(branch_info, &graph);
+	branch_info->paths_total = vld_branch_count_paths(branch_info, &graph);
+
+	if (branch_info->truncated) {
+		/* Skip the search */
+	} else if (VLD_G(path_mode) == VLD_PATH_MODE_BASIS) {
+		vld_branch_find_basis_paths(branch_info, &graph);
+	} else {
+		vld_path *stack = vld_path_new(branch_info, NULL);
+
+		for (i = vld_set_next(branch_info->entry_points, 0); i < branch_info->entry_points->size; i = vld_set_next(branch_info->entry_points, i + 1)) {
+			if (branch_info->op_branch[i] != VLD_NO_BRANCH) {
+				vld_branch_find_path(branch_info->op_branch[i], branch_info, stack);
+			}
 		}
+		vld_path_free(branch_info, stack);
+	}
+
+	vld_branch_graph_free(branch_info, &graph);
+
+	if (VLD_G(path_budget) > 0) {
+		VLD_G(path_budget_used) += vld_branch_clock() - start;
 	}
 }
 
-void vld_branch_info_dump(zend_op_array *opa, vld_branch_info *branch_info)
+/* Writes the blocks and edges of 'opa' as a DOT subgraph to vld.save_dir's
+ * paths.dot. */
+void vld_branch_info_dump_dot(zend_op_array *opa, vld_branch_info *branch_info)
 {
 	unsigned int i, j;
 	const char *fname = opa->function_name ? ZSTRING_VALUE(opa->function_name) : "__main";
+	vld_branch *b;
 
-	if (VLD_G(path_dump_file)) {
-		fprintf(VLD_G(path_dump_file), "subgraph cluster_%p {\n\tlabel=\"%s\";\n\tgraph [rankdir=\"LR\"];\n\tnode [shape = record];\n", opa, fname);
-
-		for (i = 0; i < branch_info->starts->size; i++) {
-			if (vld_set_in(branch_info->starts, i)) {
-				fprintf(
-					VLD_G(path_dump_file), 
-					"\t\"%s_%d\" [ label = \"{ op #%d-%d | line %d-%d }\" ];\n", 
-					fname, i, i, 
-					branch_info->branches[i].end_op,
-					branch_info->branches[i].start_lineno,
-					branch_info->branches[i].end_lineno
-				);
-				if (vld_set_in(branch_info->entry_points, i)) {
-					fprintf(VLD_G(path_dump_file), "\t%s_ENTRY -> %s_%d\n", fname, fname, i);
-				}
-				for (j = 0; j < branch_info->branches[i].outs_count; j++) {
-					if (branch_info->branches[i].outs[j]) {
-						if (branch_info->branches[i].outs[j] == VLD_JMP_EXIT) {
-							fprintf(VLD_G(path_dump_file), "\t%s_%d -> %s_EXIT;\n", fname, i, fname);
-						} else {
-							fprintf(VLD_G(path_dump_file), "\t%s_%d -> %s_%d;\n", fname, i, fname, branch_info->branches[i].outs[j]);
-						}
-					}
-				}
+	if (!VLD_G(path_dump_file)) {
+		return;
+	}
+
+	fprintf(VLD_G(path_dump_file), "subgraph cluster_%p {\n\tlabel=\"%s\";\n\tgraph [rankdir=\"LR\"];\n\tnode [shape = record];\n", opa, fname);
+
+	for (i = 0; i < branch_info->branches_count; i++) {
+		b = &branch_info->branches[i];
+		fprintf(
+			VLD_G(path_dump_file), 
+			"\t\"%s_%d\" [ label = \"{ op #%d-%d | line %d-%d }\" ];\n", 
+			fname, b->start_op, b->start_op, 
+			b->end_op,
+			b->start_lineno,
+			b->end_lineno
+		);
+		if (vld_set_in(branch_info->entry_points, b->start_op)) {
+			fprintf(VLD_G(path_dump_file), "\t%s_ENTRY -> %s_%d\n", fname, fname, b->start_op);
+		}
+		for (j = 0; j < b->outs_count; j++) {
+			if (VLD_BRANCH_OUT(branch_info, i, j) == VLD_JMP_EXIT) {
+				fprintf(VLD_G(path_dump_file), "\t%s_%d -> %s_EXIT;\n", fname, b->start_op, fname);
+			} else {
+				fprintf(VLD_G(path_dump_file), "\t%s_%d -> %s_%d;\n", fname, b->start_op, fname, VLD_BRANCH_OUT(branch_info, i, j));
 			}
 		}
-		fprintf(VLD_G(path_dump_file), "}\n");
 	}
+	fprintf(VLD_G(path_dump_file), "}\n");
+}
 
-	for (i = 0; i < branch_info->starts->size; i++) {
-		if (vld_set_in(branch_info->starts, i)) {
-			printf("branch: #%3d; line: %5d-%5d; sop: %5d; eop: %5d",
-				i,
-				branch_info->branches[i].start_lineno,
-				branch_info->branches[i].end_lineno,
-				i,
-				branch_info->branches[i].end_op
-			);
-
-			for (j = 0; j < branch_info->branches[i].outs_count; j++) {
-				if (branch_info->branches[i].outs[j]) {
-					printf("; out%d: %3d", j, branch_info->branches[i].outs[j]);
-				}
+void vld_branch_info_dump(zend_op_array *opa, vld_branch_info *branch_info)
+{
+	unsigned int i, j;
+	vld_coverage *coverage = vld_coverage_find(opa);
+	vld_branch *b;
+
+	for (i = 0; i < branch_info->branches_count; i++) {
+		b = &branch_info->branches[i];
+		vld_output_printf(stdout, "branch: #%3d; line: %5d-%5d; sop: %5d; eop: %5d",
+			b->start_op,
+			b->start_lineno,
+			b->end_lineno,
+			b->start_op,
+			b->end_op
+		);
+
+		for (j = 0; j < b->outs_count; j++) {
+			vld_output_printf(stdout, "; out%d: %3d", j, VLD_BRANCH_OUT(branch_info, i, j));
+			if (VLD_G(coverage) && vld_coverage_out_hit(coverage, i, j)) {
+				vld_output_printf(stdout, " (taken)");
 			}
-			printf("\n");
 		}
+		if (VLD_G(coverage)) {
+			vld_output_printf(stdout, "; hit: %d", vld_coverage_branch_hit(coverage, i) ? 1 : 0);
+		}
+		vld_output_printf(stdout, "\n");
 	}
 
 	for (i = 0; i < branch_info->paths_count; i++) {
-		printf("path #%d: ", i + 1);
+		vld_output_printf(stdout, "path #%d: ", i + 1);
 		for (j = 0; j < branch_info->paths[i]->elements_count; j++) {
-			printf("%d, ", branch_info->paths[i]->elements[j]);
+			vld_output_printf(stdout, "%d, ", branch_info->branches[branch_info->paths[i]->elements[j]].start_op);
+		}
+		if (VLD_G(coverage)) {
+			vld_output_printf(stdout, "hit: %d", vld_coverage_path_hit(coverage, branch_info->paths[i]));
 		}
-		printf("\n");
+		vld_output_printf(stdout, "\n");
+	}
+
+	if (branch_info->truncated || VLD_G(path_mode) == VLD_PATH_MODE_BASIS) {
+		vld_output_printf(stdout, "paths: %u of %llu%s\n",
+			branch_info->paths_count,
+			(unsigned long long) branch_info->paths_total,
+			branch_info->truncated ? " (truncated)" : ""
+		);
 	}
 }
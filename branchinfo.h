@@ -26,41 +26,74 @@
 #define VLD_JMP_NOT_SET -1
 #define VLD_JMP_EXIT    -2
 
-#define VLD_BRANCH_MAX_OUTS 32
+/* Values of vld.path_mode */
+#define VLD_PATH_MODE_ALL   0
+#define VLD_PATH_MODE_BASIS 1
 
+/* A basic block. Its outs are branch_info->outs[outs_start] onwards, each
+ * being the opcode number of the target or VLD_JMP_EXIT. */
 typedef struct _vld_branch {
+	unsigned int start_op;
+	unsigned int end_op;
 	unsigned int start_lineno;
 	unsigned int end_lineno;
-	unsigned int end_op;
+	unsigned int outs_start;
 	unsigned int outs_count;
-	int          outs[VLD_BRANCH_MAX_OUTS];
 } vld_branch;
 
+/* One out of a jump opcode, as found by the analysis */
+typedef struct _vld_branch_jump {
+	unsigned int pos;
+	unsigned int outidx;
+	int          target;
+} vld_branch_jump;
+
 typedef struct _vld_path {
 	unsigned int elements_count;
 	unsigned int elements_size;
-	unsigned int *elements;
+	unsigned int *elements; /* Branch numbers */
 } vld_path;
 
+#define VLD_NO_BRANCH ((unsigned int) -1)
+
 typedef struct _vld_branch_info {
+	vld_arena    *arena; /* Where all of this lives, NULL for the heap */
 	unsigned int  size;
 	vld_set      *entry_points;
 	vld_set      *starts;
 	vld_set      *ends;
+
+	unsigned int     jumps_count;
+	unsigned int     jumps_size;
+	vld_branch_jump *jumps;
+
+	/* Filled by vld_branch_post_process(), numbered in opcode order */
+	unsigned int  branches_count;
 	vld_branch   *branches;
+	unsigned int  outs_count;
+	int          *outs;
+	unsigned int *op_branch; /* The branch of every opcode, or VLD_NO_BRANCH */
 
 	unsigned int  paths_count;
 	unsigned int  paths_size;
 	vld_path    **paths;
+	int           truncated;   /* Whether paths were left out */
+	int           truncated_by_time; /* ... because the deadline passed */
+	uint64_t      paths_total; /* Number of paths without going around loops */
+	uint64_t      deadline;    /* In microseconds, 0 when not timed */
+	unsigned int  steps;
 } vld_branch_info;
 
-vld_branch_info *vld_branch_info_create(unsigned int size);
+#define VLD_BRANCH_OUT(bi, nr, j) ((bi)->outs[(bi)->branches[nr].outs_start + (j)])
+
+vld_branch_info *vld_branch_info_create(vld_arena *arena, unsigned int size);
 
-void vld_branch_info_update(vld_branch_info *branch_info, unsigned int pos, unsigned int lineno, unsigned int outidx, unsigned int jump_pos);
+void vld_branch_info_update(vld_branch_info *branch_info, unsigned int pos, unsigned int outidx, int jump_pos);
 void vld_branch_post_process(zend_op_array *opa, vld_branch_info *branch_info);
 void vld_branch_find_paths(vld_branch_info *branch_info);
 
 void vld_branch_info_dump(zend_op_array *opa, vld_branch_info *branch_info);
+void vld_branch_info_dump_dot(zend_op_array *opa, vld_branch_info *branch_info);
 void vld_branch_info_free(vld_branch_info *branch_info);
 
 #endif
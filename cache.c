@@ -0,0 +1,229 @@
+/*
+   +----------------------------------------------------------------------+
+   | Copyright (c) 1997-2019 Derick Rethans                               |
+   +----------------------------------------------------------------------+
+   | This source file is subject to the 2-Clause BSD license which is     |
+   | available through the LICENSE file, or online at                     |
+   | http://opensource.org/licenses/bsd-license.php                       |
+   +----------------------------------------------------------------------+
+   | Authors:  Derick Rethans <derick@derickrethans.nl>                   |
+   +----------------------------------------------------------------------+
+ */
+
+/* The result cache stores everything that was dumped for one file, keyed by
+ * the identity of that file (path, mtime, size and inode) together with the
+ * settings that influence the output. When a file is compiled again and
+ * nothing changed, the stored output is written out instead of analysing and
+ * serialising the op_arrays again. */
+
+#include "php.h"
+#include "ext/standard/md5.h"
+#include "cache.h"
+
+#ifndef PHP_WIN32
+# include <unistd.h>
+#else
+# include <process.h>
+# define getpid _getpid
+#endif
+
+ZEND_EXTERN_MODULE_GLOBALS(vld)
+
+#define VLD_CACHE_MAGIC     "VLDCACHE2\n"
+#define VLD_CACHE_MAGIC_LEN (sizeof(VLD_CACHE_MAGIC) - 1)
+
+typedef struct _vld_cache_header {
+	uint32_t records;
+	uint32_t out_len;
+	uint32_t err_len;
+} vld_cache_header;
+
+static void vld_cache_key_add(PHP_MD5_CTX *context, const void *data, size_t len)
+{
+	PHP_MD5Update(context, (const unsigned char *) data, len);
+}
+
+/* Fills 'key' with the hex digest identifying the output for 'filename'.
+ * Returns 0 when the file can not be stat-ed. */
+static int vld_cache_key(const char *filename, char *key)
+{
+	PHP_MD5_CTX    context;
+	unsigned char  digest[16];
+	zend_stat_t    st;
+	zend_long      settings[12];
+
+	if (VCWD_STAT(filename, &st) != 0) {
+		return 0;
+	}
+
+	settings[0] = VLD_G(verbosity);
+	settings[1] = VLD_G(format);
+	settings[2] = VLD_G(dump_paths);
+	settings[3] = VLD_G(dump_json);
+	settings[4] = VLD_G(json_lines);
+	settings[5] = VLD_G(path_mode);
+	settings[6] = VLD_G(path_limit);
+	settings[7] = VLD_G(formats_mask);
+	settings[8] = VLD_G(json_fields_mask);
+	settings[9] = VLD_G(path_time_limit);
+	settings[10] = VLD_G(path_budget);
+	settings[11] = PHP_VERSION_ID;
+
+	PHP_MD5Init(&context);
+	vld_cache_key_add(&context, VLD_CACHE_MAGIC, VLD_CACHE_MAGIC_LEN);
+	vld_cache_key_add(&context, filename, strlen(filename) + 1);
+	vld_cache_key_add(&context, &st.st_mtime, sizeof(st.st_mtime));
+	vld_cache_key_add(&context, &st.st_size, sizeof(st.st_size));
+	vld_cache_key_add(&context, &st.st_ino, sizeof(st.st_ino));
+	vld_cache_key_add(&context, settings, sizeof(settings));
+	vld_cache_key_add(&context, VLD_G(col_sep), strlen(VLD_G(col_sep)) + 1);
+	PHP_MD5Final(digest, &context);
+
+	make_digest_ex(key, digest, 16);
+	return 1;
+}
+
+/* Writes a stored entry to the output. Returns 0 if the entry does not exist
+ * or is damaged, in which case nothing was written. */
+static int vld_cache_replay(const char *path)
+{
+	FILE             *in;
+	char              magic[VLD_CACHE_MAGIC_LEN];
+	vld_cache_header  header;
+	char             *data;
+	size_t            len;
+
+	if ((in = fopen(path, "rb")) == NULL) {
+		return 0;
+	}
+	if (
+		fread(magic, 1, VLD_CACHE_MAGIC_LEN, in) != VLD_CACHE_MAGIC_LEN ||
+		memcmp(magic, VLD_CACHE_MAGIC, VLD_CACHE_MAGIC_LEN) != 0 ||
+		fread(&header, sizeof(header), 1, in) != 1
+	) {
+		fclose(in);
+		return 0;
+	}
+
+	len = (size_t) header.out_len + header.err_len;
+	data = emalloc(len + 1);
+	if (fread(data, 1, len, in) != len) {
+		efree(data);
+		fclose(in);
+		return 0;
+	}
+	fclose(in);
+
+	if (VLD_G(dump_json) && header.records) {
+		if (!VLD_G(json_lines) && VLD_G(json_data)->outer_len) {
+			vld_json_write_separator(0);
+		}
+		VLD_G(json_data)->outer_len += header.records;
+	}
+	vld_output_write_raw(stdout, data, header.out_len);
+	vld_output_write_raw(stderr, data + header.out_len, header.err_len);
+	if (VLD_G(json_lines)) {
+		vld_output_flush();
+	}
+
+	efree(data);
+	return 1;
+}
+
+/* {{{ int vld_cache_begin (op_array)
+ *    Called once the main op_array of a file is compiled. Returns 1 if the
+ *    output for the file was found in the cache and has been written.
+ *    Otherwise capturing of the output starts, and vld_cache_end() stores
+ *    it once the file has been dumped. */
+int vld_cache_begin(zend_op_array *op_array)
+{
+	char  key[33];
+	char *path;
+	int   hit;
+
+	/* The DOT output is written to a file of its own, and can't be cached.
+	 * Neither can results that are returned instead of written, nor JSON
+	 * that refers to strings interned earlier in the request. */
+	if (!VLD_G(cache_dir) || !VLD_G(cache_dir)[0] || VLD_G(save_paths) || VLD_G(cache_key) || VLD_G(inspect) || (VLD_G(dump_json) && VLD_G(json_intern))) {
+		return 0;
+	}
+	if (!op_array->filename || !vld_cache_key(ZSTR_VAL(op_array->filename), key)) {
+		return 0;
+	}
+
+	spprintf(&path, 0, "%s/%s.vld", VLD_G(cache_dir), key);
+	hit = vld_cache_replay(path);
+	efree(path);
+
+	if (!hit) {
+		VLD_G(cache_key) = estrdup(key);
+		VLD_G(cache_records) = VLD_G(json_data)->outer_len;
+		VLD_G(cache_discard) = 0;
+	}
+	return hit;
+}
+/* }}} */
+
+/* {{{ void vld_cache_end ()
+ *    Stores the captured output. The entry is written to a temporary file
+ *    that is renamed into place, so that concurrent processes and threads
+ *    sharing the cache directory never see a partially written entry.
+ *    Output with paths that were cut short by vld.path_time_limit or
+ *    vld.path_budget is not stored. */
+void vld_cache_end(void)
+{
+	vld_cache_header  header;
+	char             *tmp_path, *path;
+	FILE             *out;
+	int               ok;
+
+	if (!VLD_G(cache_key)) {
+		return;
+	}
+
+	header.records = VLD_G(dump_json) ? VLD_G(json_data)->outer_len - VLD_G(cache_records) : 0;
+	header.out_len = VLD_G(cache_out).s ? ZSTR_LEN(VLD_G(cache_out).s) : 0;
+	header.err_len = VLD_G(cache_err).s ? ZSTR_LEN(VLD_G(cache_err).s) : 0;
+
+	spprintf(&path, 0, "%s/%s.vld", VLD_G(cache_dir), VLD_G(cache_key));
+#ifdef ZTS
+	spprintf(&tmp_path, 0, "%s.%d.%lu.tmp", path, (int) getpid(), (unsigned long) tsrm_thread_id());
+#else
+	spprintf(&tmp_path, 0, "%s.%d.tmp", path, (int) getpid());
+#endif
+
+	if (!VLD_G(cache_discard) && (out = fopen(tmp_path, "wb")) != NULL) {
+		ok =
+			fwrite(VLD_CACHE_MAGIC, 1, VLD_CACHE_MAGIC_LEN, out) == VLD_CACHE_MAGIC_LEN &&
+			fwrite(&header, sizeof(header), 1, out) == 1 &&
+			(!header.out_len || fwrite(ZSTR_VAL(VLD_G(cache_out).s), 1, header.out_len, out) == header.out_len) &&
+			(!header.err_len || fwrite(ZSTR_VAL(VLD_G(cache_err).s), 1, header.err_len, out) == header.err_len);
+		if (fclose(out) != 0) {
+			ok = 0;
+		}
+		if (!ok || VCWD_RENAME(tmp_path, path) != 0) {
+			VCWD_UNLINK(tmp_path);
+		}
+	}
+
+	efree(tmp_path);
+	efree(path);
+	efree(VLD_G(cache_key));
+	VLD_G(cache_key) = NULL;
+	smart_str_free(&VLD_G(cache_out));
+	smart_str_free(&VLD_G(cache_err));
+}
+/* }}} */
+
+/* Adds output that was just written to 'stream' to the current entry */
+void vld_cache_capture(FILE *stream, const char *buf, size_t len)
+{
+	if (!VLD_G(cache_key)) {
+		return;
+	}
+	if (stream == stdout) {
+		smart_str_appendl(&VLD_G(cache_out), buf, len);
+	} else {
+		smart_str_appendl(&VLD_G(cache_err), buf, len);
+	}
+}
@@ -0,0 +1,22 @@
+/*
+   +----------------------------------------------------------------------+
+   | Copyright (c) 1997-2019 Derick Rethans                               |
+   +----------------------------------------------------------------------+
+   | This source file is subject to the 2-Clause BSD license which is     |
+   | available through the LICENSE file, or online at                     |
+   | http://opensource.org/licenses/bsd-license.php                       |
+   +----------------------------------------------------------------------+
+   | Authors:  Derick Rethans <derick@derickrethans.nl>                   |
+   +----------------------------------------------------------------------+
+ */
+
+#ifndef __CACHE_H__
+#define __CACHE_H__
+
+#include "php_vld.h"
+
+int  vld_cache_begin(zend_op_array *op_array);
+void vld_cache_end(void);
+void vld_cache_capture(FILE *stream, const char *buf, size_t len);
+
+#endif
@@ -7,6 +7,12 @@ PHP_ARG_ENABLE(vld, whether to enable VLD support,
 PHP_ARG_ENABLE(vld-dev, whether to enable VLD developer build flags,
 [  --enable-vld-dev          VLD: Enable developer flags],, no)
 
+PHP_ARG_WITH(vld-zlib, for gzip output compression in VLD,
+[  --with-vld-zlib[=DIR]     VLD: Compress output with gzip], no, no)
+
+PHP_ARG_WITH(vld-zstd, for zstd output compression in VLD,
+[  --with-vld-zstd[=DIR]     VLD: Compress output with zstd], no, no)
+
 if test "$PHP_VLD" != "no"; then
   AC_MSG_CHECKING([Check for supported PHP versions])
   PHP_VLD_FOUND_VERSION=`${PHP_CONFIG} --version`
@@ -19,6 +25,50 @@ if test "$PHP_VLD" != "no"; then
 
   CPPFLAGS=$old_CPPFLAGS
 
+  if test "$PHP_VLD_ZLIB" != "no"; then
+    for i in $PHP_VLD_ZLIB /usr/local /usr; do
+      if test -f "$i/include/zlib.h"; then
+        VLD_ZLIB_DIR=$i
+        break
+      fi
+    done
+    if test -z "$VLD_ZLIB_DIR"; then
+      AC_MSG_ERROR([Cannot find zlib.h])
+    fi
+    PHP_CHECK_LIBRARY(z, deflateInit2_, [
+      PHP_ADD_INCLUDE($VLD_ZLIB_DIR/include)
+      PHP_ADD_LIBRARY_WITH_PATH(z, $VLD_ZLIB_DIR/$PHP_LIBDIR, VLD_SHARED_LIBADD)
+      AC_DEFINE(HAVE_VLD_ZLIB, 1, [Whether vld can compress its output with gzip])
+    ], [
+      AC_MSG_ERROR([zlib not found])
+    ], [
+      -L$VLD_ZLIB_DIR/$PHP_LIBDIR
+    ])
+  fi
+
+  if test "$PHP_VLD_ZSTD" != "no"; then
+    for i in $PHP_VLD_ZSTD /usr/local /usr; do
+      if test -f "$i/include/zstd.h"; then
+        VLD_ZSTD_DIR=$i
+        break
+      fi
+    done
+    if test -z "$VLD_ZSTD_DIR"; then
+      AC_MSG_ERROR([Cannot find zstd.h])
+    fi
+    dnl ZSTD_compressStream2() is stable since zstd 1.4.0
+    PHP_CHECK_LIBRARY(zstd, ZSTD_compressStream2, [
+      PHP_ADD_INCLUDE($VLD_ZSTD_DIR/include)
+      PHP_ADD_LIBRARY_WITH_PATH(zstd, $VLD_ZSTD_DIR/$PHP_LIBDIR, VLD_SHARED_LIBADD)
+      AC_DEFINE(HAVE_VLD_ZSTD, 1, [Whether vld can compress its output with zstd])
+    ], [
+      AC_MSG_ERROR([zstd 1.4.0 or later not found])
+    ], [
+      -L$VLD_ZSTD_DIR/$PHP_LIBDIR
+    ])
+  fi
+  PHP_SUBST(VLD_SHARED_LIBADD)
+
   if test "$PHP_VLD_DEV" = "yes"; then
     PHP_CHECK_GCC_ARG(-Wbool-conversion,                _MAINTAINER_CFLAGS="$_MAINTAINER_CFLAGS -Wbool-conversion")
     PHP_CHECK_GCC_ARG(-Wdeclaration-after-statement,    _MAINTAINER_CFLAGS="$_MAINTAINER_CFLAGS -Wdeclaration-after-statement")
@@ -63,5 +113,5 @@ if test "$PHP_VLD" != "no"; then
 
   PHP_VLD_CFLAGS="$STD_CFLAGS $MAINTAINER_CFLAGS"
   PHP_ADD_MAKEFILE_FRAGMENT($abs_srcdir/Makefile.frag, $abs_srcdir)
-  PHP_NEW_EXTENSION(vld, vld.c srm_oparray.c set.c branchinfo.c cJSON.c json_patch.c, $ext_shared,,$PHP_VLD_CFLAGS)
+  PHP_NEW_EXTENSION(vld, vld.c srm_oparray.c set.c arena.c output.c branchinfo.c json_patch.c binary.c cache.c profile.c coverage.c symbols.c, $ext_shared,,$PHP_VLD_CFLAGS)
 fi
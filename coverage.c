@@ -0,0 +1,222 @@
+/*
+   +----------------------------------------------------------------------+
+   | Copyright (c) 1997-2019 Derick Rethans                               |
+   +----------------------------------------------------------------------+
+   | This source file is subject to the 2-Clause BSD license which is     |
+   | available through the LICENSE file, or online at                     |
+   | http://opensource.org/licenses/bsd-license.php                       |
+   +----------------------------------------------------------------------+
+   | Authors:  Derick Rethans <derick@derickrethans.nl>                   |
+   +----------------------------------------------------------------------+
+ */
+
+/* Run time branch coverage. The execute_ex hook keeps a stack of running
+ * frames, each remembering the branch it is in. The user opcode handler of
+ * vld.profile calls vld_coverage_record() for every opline: entering the
+ * start of a branch marks that branch, and the edge from the previous one.
+ * Memory is only allocated the first time an op_array runs and when the
+ * frame stack has to grow, never per opline. */
+
+#include "php.h"
+#include "coverage.h"
+
+ZEND_EXTERN_MODULE_GLOBALS(vld)
+
+void vld_analyse_oparray(zend_op_array *opa, vld_set *set, vld_branch_info *branch_info, int quiet);
+
+static void (*vld_coverage_old_execute_ex)(zend_execute_data *execute_data);
+
+static void vld_coverage_dtor(zval *zv)
+{
+	vld_coverage *coverage = Z_PTR_P(zv);
+
+	vld_branch_info_free(coverage->branch_info);
+	vld_set_free(coverage->branches_hit);
+	vld_set_free(coverage->edges_hit);
+	efree(coverage);
+}
+
+/* The hook is installed once for the whole process */
+void vld_coverage_minit(void (*execute_ex)(zend_execute_data *execute_data))
+{
+	vld_coverage_old_execute_ex = execute_ex;
+}
+
+void vld_coverage_rinit(void)
+{
+	zend_hash_init(&VLD_G(coverage_info), 32, NULL, vld_coverage_dtor, 0);
+	VLD_G(coverage_stack)      = NULL;
+	VLD_G(coverage_stack_top)  = 0;
+	VLD_G(coverage_stack_size) = 0;
+}
+
+void vld_coverage_rshutdown(void)
+{
+	zend_hash_destroy(&VLD_G(coverage_info));
+	if (VLD_G(coverage_stack)) {
+		efree(VLD_G(coverage_stack));
+		VLD_G(coverage_stack) = NULL;
+	}
+	VLD_G(coverage_stack_top)  = 0;
+	VLD_G(coverage_stack_size) = 0;
+}
+
+/* {{{ vld_coverage *vld_coverage_create (op_array)
+ *    Finds the branches of 'op_array' in the same way the dump does, so
+ *    that the branch numbers of both agree. */
+static vld_coverage *vld_coverage_create(zend_op_array *op_array)
+{
+	vld_coverage *coverage;
+	vld_set      *set;
+
+	coverage = emalloc(sizeof(vld_coverage));
+	coverage->branch_info = vld_branch_info_create(NULL, op_array->last);
+	set = vld_set_create(NULL, op_array->last);
+	vld_analyse_oparray(op_array, set, coverage->branch_info, 1);
+	vld_branch_post_process(op_array, coverage->branch_info);
+	vld_set_free(set);
+
+	coverage->branches_hit = vld_set_create(NULL, coverage->branch_info->branches_count);
+	coverage->edges_hit    = vld_set_create(NULL, coverage->branch_info->outs_count);
+
+	zend_hash_index_add_ptr(&VLD_G(coverage_info), (zend_ulong) (zend_uintptr_t) op_array->opcodes, coverage);
+
+	return coverage;
+}
+/* }}} */
+
+static void vld_coverage_mark_out(vld_coverage *coverage, int branch, int target)
+{
+	vld_branch   *b = &coverage->branch_info->branches[branch];
+	unsigned int  j;
+
+	for (j = 0; j < b->outs_count; j++) {
+		if (coverage->branch_info->outs[b->outs_start + j] == target) {
+			vld_set_add(coverage->edges_hit, b->outs_start + j);
+			return;
+		}
+	}
+}
+
+/* {{{ void vld_coverage_execute_ex (execute_data)
+ *    Pushes a frame for every call. Generators resume through here too, so
+ *    a resumed generator starts without a previous branch. */
+void vld_coverage_execute_ex(zend_execute_data *execute_data)
+{
+	vld_coverage_frame *frame;
+
+	if (VLD_G(coverage_stack_top) == VLD_G(coverage_stack_size)) {
+		VLD_G(coverage_stack_size) = VLD_G(coverage_stack_size) ? VLD_G(coverage_stack_size) * 2 : 64;
+		VLD_G(coverage_stack) = safe_erealloc(VLD_G(coverage_stack), VLD_G(coverage_stack_size), sizeof(vld_coverage_frame), 0);
+	}
+	frame = &VLD_G(coverage_stack)[VLD_G(coverage_stack_top)++];
+	frame->execute_data = execute_data;
+	frame->coverage     = NULL;
+	frame->branch       = VLD_JMP_NOT_SET;
+
+	zend_try {
+		vld_coverage_old_execute_ex(execute_data);
+	} zend_catch {
+		VLD_G(coverage_stack_top)--;
+		zend_bailout();
+	} zend_end_try();
+
+	VLD_G(coverage_stack_top)--;
+}
+/* }}} */
+
+/* {{{ void vld_coverage_record (execute_data)
+ *    Called before every user opline runs. */
+void vld_coverage_record(zend_execute_data *execute_data)
+{
+	vld_coverage_frame *frame;
+	vld_coverage       *coverage;
+	zend_op_array      *op_array = &EX(func)->op_array;
+	int                 nr = EX(opline) - op_array->opcodes;
+
+	if (!VLD_G(coverage_stack_top)) {
+		return;
+	}
+	frame = &VLD_G(coverage_stack)[VLD_G(coverage_stack_top) - 1];
+	if (frame->execute_data != execute_data) {
+		return;
+	}
+
+	if (!frame->coverage) {
+		frame->coverage = zend_hash_index_find_ptr(&VLD_G(coverage_info), (zend_ulong) (zend_uintptr_t) op_array->opcodes);
+		if (!frame->coverage) {
+			frame->coverage = vld_coverage_create(op_array);
+		}
+	}
+	coverage = frame->coverage;
+
+	if (vld_set_in(coverage->branch_info->starts, nr) && coverage->branch_info->op_branch[nr] != VLD_NO_BRANCH) {
+		vld_set_add(coverage->branches_hit, coverage->branch_info->op_branch[nr]);
+		if (frame->branch != VLD_JMP_NOT_SET) {
+			vld_coverage_mark_out(coverage, frame->branch, nr);
+		}
+		frame->branch = coverage->branch_info->op_branch[nr];
+	}
+
+	/* Leaving the function from the last opline of a branch */
+	if (frame->branch != VLD_JMP_NOT_SET && (unsigned int) nr == coverage->branch_info->branches[frame->branch].end_op) {
+		vld_coverage_mark_out(coverage, frame->branch, VLD_JMP_EXIT);
+	}
+}
+/* }}} */
+
+/* Returns the coverage of 'op_array', or NULL if it never ran */
+vld_coverage *vld_coverage_find(zend_op_array *op_array)
+{
+	if (!VLD_G(coverage) || !op_array->opcodes) {
+		return NULL;
+	}
+	return zend_hash_index_find_ptr(&VLD_G(coverage_info), (zend_ulong) (zend_uintptr_t) op_array->opcodes);
+}
+
+int vld_coverage_branch_hit(vld_coverage *coverage, unsigned int branch)
+{
+	return coverage && branch < coverage->branches_hit->size && vld_set_in(coverage->branches_hit, branch);
+}
+
+/* Whether the out with index 'out' of 'branch' was taken */
+int vld_coverage_out_hit(vld_coverage *coverage, unsigned int branch, unsigned int out)
+{
+	if (!vld_coverage_branch_hit(coverage, branch) || out >= coverage->branch_info->branches[branch].outs_count) {
+		return 0;
+	}
+	return vld_set_in(coverage->edges_hit, coverage->branch_info->branches[branch].outs_start + out) != 0;
+}
+
+/* {{{ int vld_coverage_path_hit (coverage, path)
+ *    A path counts as hit when every branch on it ran, and every edge
+ *    between two of its branches was taken. Edges are not tracked per call,
+ *    so a path made up of edges taken in different calls also counts. */
+int vld_coverage_path_hit(vld_coverage *coverage, vld_path *path)
+{
+	unsigned int i, j;
+	vld_branch  *b;
+	int          found;
+
+	for (i = 0; i < path->elements_count; i++) {
+		if (!vld_coverage_branch_hit(coverage, path->elements[i])) {
+			return 0;
+		}
+		if (i + 1 == path->elements_count) {
+			break;
+		}
+		b = &coverage->branch_info->branches[path->elements[i]];
+		found = 0;
+		for (j = 0; j < b->outs_count; j++) {
+			if (coverage->branch_info->outs[b->outs_start + j] == (int) coverage->branch_info->branches[path->elements[i + 1]].start_op && vld_coverage_out_hit(coverage, path->elements[i], j)) {
+				found = 1;
+				break;
+			}
+		}
+		if (!found) {
+			return 0;
+		}
+	}
+	return 1;
+}
+/* }}} */
@@ -0,0 +1,47 @@
+/*
+   +----------------------------------------------------------------------+
+   | Copyright (c) 1997-2019 Derick Rethans                               |
+   +----------------------------------------------------------------------+
+   | This source file is subject to the 2-Clause BSD license which is     |
+   | available through the LICENSE file, or online at                     |
+   | http://opensource.org/licenses/bsd-license.php                       |
+   +----------------------------------------------------------------------+
+   | Authors:  Derick Rethans <derick@derickrethans.nl>                   |
+   +----------------------------------------------------------------------+
+ */
+
+#ifndef __COVERAGE_H__
+#define __COVERAGE_H__
+
+#include "php_vld.h"
+#include "branchinfo.h"
+
+/* Run time coverage of one op_array. The branches are found once, the first
+ * time the op_array runs; after that only bits are set. Every out of every
+ * branch has its own bit in 'edges_hit', with the same number as its place
+ * in branch_info->outs. */
+typedef struct _vld_coverage {
+	vld_branch_info *branch_info;
+	vld_set         *branches_hit;
+	vld_set         *edges_hit;
+} vld_coverage;
+
+/* The branch that is running in a stack frame */
+typedef struct _vld_coverage_frame {
+	zend_execute_data *execute_data;
+	vld_coverage      *coverage;
+	int                branch;
+} vld_coverage_frame;
+
+void vld_coverage_minit(void (*execute_ex)(zend_execute_data *execute_data));
+void vld_coverage_rinit(void);
+void vld_coverage_rshutdown(void);
+void vld_coverage_execute_ex(zend_execute_data *execute_data);
+void vld_coverage_record(zend_execute_data *execute_data);
+
+vld_coverage *vld_coverage_find(zend_op_array *op_array);
+int vld_coverage_branch_hit(vld_coverage *coverage, unsigned int branch);
+int vld_coverage_out_hit(vld_coverage *coverage, unsigned int branch, unsigned int out);
+int vld_coverage_path_hit(vld_coverage *coverage, vld_path *path);
+
+#endif
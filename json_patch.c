@@ -12,8 +12,13 @@
 
 /**
  * The major of json patch is implemented in this file.
+ *
+ * The JSON is streamed: every column is rendered as text while the op_array
+ * is walked, and the columns are then stitched together into one output
+ * buffer. No intermediate document tree is built.
 */
 
+#include <math.h>
 #include "php.h"
 #include "zend_alloc.h"
 #include "branchinfo.h"
@@ -21,12 +26,13 @@
 #include "ext/standard/url.h"
 #include "set.h"
 #include "php_vld.h"
+#include "profile.h"
+#include "coverage.h"
 
 ZEND_EXTERN_MODULE_GLOBALS(vld)
 
 /* extern data declaration, referring to "srm_oparray.c". */
 extern op_usage opcodes[199];
-extern int vld_find_jumps(zend_op_array *opa, unsigned int position, size_t *jump_count, int *jumps);
 extern unsigned int vld_get_special_flags(const zend_op *op, unsigned int base_address);
 #if PHP_VERSION_ID >= 70400
 extern const char *get_assign_operation(uint32_t extended_value);
@@ -35,419 +41,717 @@ extern const char *get_assign_operation(uint32_t extended_value);
 #define STR_ARRAY_LEN(arr) (sizeof(arr) / sizeof(char *))
 #define NUM_KNOWN_OPCODES (sizeof(opcodes) / sizeof(opcodes[0]))
 
-#ifdef VLD_DEBUG
-#define cJSON_Delet_Wrap(O) \
-    cJSON_Delete(O);        \
-    O = NULL;               \
-    fprintf(stderr, "%s:%d\n", __FILE__, __LINE__);
-#else
-#define cJSON_Delet_Wrap(O) \
-    cJSON_Delete(O);        \
-    O = NULL;
-#endif
+const char *op_cols[] = {"line", "#", "*", "E", "I", "O", "op_code", "op", "fetch", "ext", "return_type", "return", "op1_type", "op1", "op2_type", "op2", "ext_op_type", "ext_op", "hits"};
+const int verbosity_flags[] = {1, 1, 1, 1, 1, 1, 3, 1, 1, 1, 3, 1, 3, 1, 3, 1, 3, 1, 1};
+const char *branch_cols[] = {"sline", "eline", "sop", "eop", "outs", "hit", "outs_hit"};
+const char *path_cols[] = {"path", "path_hit", "paths_total_estimate", "truncated"};
+
+/* Records of the line delimited mode have to stay on a single line. */
+#define VLD_JSON_PRETTY() (VLD_G(format) && !VLD_G(json_lines))
+
+#define VLD_JSON_OP_COLS     (STR_ARRAY_LEN(op_cols))
+#define VLD_JSON_HITS_COL    18
+
+/* Repeated strings are written as ids with vld.json_intern. The PHP arrays
+ * of vld_inspect_*() do not need that. */
+#define VLD_JSON_INTERN() (VLD_G(json_intern) && !VLD_G(inspect))
+
+/* Bits of vld.json_fields: the columns of "ops", then those of "branch",
+ * then the path members. No bit set means every field. */
+#define VLD_JSON_FIELD_BRANCH VLD_JSON_OP_COLS
+#define VLD_JSON_FIELD_PATH   (VLD_JSON_FIELD_BRANCH + VLD_JSON_BRANCH_COLS)
+#define VLD_JSON_FIELD(n) (!VLD_G(json_fields_mask) || (VLD_G(json_fields_mask) & (1 << (n))))
+
+/* Whether column 'j' of the "ops" object is written. */
+#define VLD_JSON_OP_COL_USED(j) (VLD_G(verbosity) >= verbosity_flags[j] && ((j) != VLD_JSON_HITS_COL || VLD_G(profile)) && VLD_JSON_FIELD(j))
+#define VLD_JSON_BRANCH_COLS (STR_ARRAY_LEN(branch_cols))
+
+/* The last two branch columns only exist with vld.coverage. */
+#define VLD_JSON_BRANCH_COL_USED(j) (((j) < 5 || VLD_G(coverage)) && VLD_JSON_FIELD(VLD_JSON_FIELD_BRANCH + (j)))
+
+/* Members of the path section: "path", "path_hit", "paths_total_estimate"
+ * and "truncated". */
+#define VLD_JSON_PATH_COL_USED(j) (((j) != 1 || VLD_G(coverage)) && VLD_JSON_FIELD(VLD_JSON_FIELD_PATH + (j)))
+
+/* A column owns its text buffer or PHP array, its array writes into it. */
+typedef struct _vld_json_col
+{
+    smart_str str;
+    zval zv;
+    vld_json_array array;
+} vld_json_col;
+
+/* State of one function dump. */
+typedef struct _vld_json_dump
+{
+    vld_json_col ops[sizeof(op_cols) / sizeof(op_cols[0])];
+    vld_json_array *col[sizeof(op_cols) / sizeof(op_cols[0])]; /* NULL for the columns left out */
+    unsigned int last_lineno;
+    zend_ulong *hits;
+} vld_json_dump;
 
-const char *op_cols[] = {"line", "#", "*", "E", "I", "O", "op_code", "op", "fetch", "ext", "return_type", "return", "op1_type", "op1", "op2_type", "op2", "ext_op_type", "ext_op"};
-const int verbosity_flags[] = {1, 1, 1, 1, 1, 1, 3, 1, 1, 1, 3, 1, 3, 1, 3, 1, 3, 1};
+/* JSON writer functions. */
 
-/* cJSON helper functions. */
-cJSON *cJSON_AddArrayToObjectCS(cJSON *obj, const char *key)
+static void vld_json_append_escaped(smart_str *buf, const char *str, size_t len)
 {
-    cJSON *array = cJSON_CreateArray();
-    if (cJSON_AddItemToObjectCS(obj, key, array))
+    static const char hex[] = "0123456789abcdef";
+    size_t i, start = 0;
+
+    smart_str_appendc(buf, '"');
+    for (i = 0; i < len; i++)
     {
-        return array;
+        unsigned char c = (unsigned char)str[i];
+
+        if (c > 31 && c != '"' && c != '\\')
+        {
+            continue;
+        }
+        smart_str_appendl(buf, str + start, i - start);
+        start = i + 1;
+        switch (c)
+        {
+        case '"':
+            smart_str_appendl(buf, "\\\"", 2);
+            break;
+        case '\\':
+            smart_str_appendl(buf, "\\\\", 2);
+            break;
+        case '\b':
+            smart_str_appendl(buf, "\\b", 2);
+            break;
+        case '\f':
+            smart_str_appendl(buf, "\\f", 2);
+            break;
+        case '\n':
+            smart_str_appendl(buf, "\\n", 2);
+            break;
+        case '\r':
+            smart_str_appendl(buf, "\\r", 2);
+            break;
+        case '\t':
+            smart_str_appendl(buf, "\\t", 2);
+            break;
+        default:
+            smart_str_appendl(buf, "\\u00", 4);
+            smart_str_appendc(buf, hex[c >> 4]);
+            smart_str_appendc(buf, hex[c & 0xf]);
+            break;
+        }
     }
-    cJSON_Delete(array);
-    return NULL;
+    smart_str_appendl(buf, str + start, len - start);
+    smart_str_appendc(buf, '"');
 }
 
-cJSON *cJSON_AddObjectToObjectCS(cJSON *obj, const char *key)
+static void vld_json_append_double(smart_str *buf, double number)
 {
-    cJSON *item = cJSON_CreateObject();
-    if (cJSON_AddItemToObjectCS(obj, key, item))
+    char tmp[32];
+    char *p;
+    double test = 0.0;
+
+    if (isnan(number) || isinf(number))
     {
-        return item;
+        smart_str_appendl(buf, "null", 4);
+        return;
     }
-    cJSON_Delete(item);
-    return NULL;
+    /* Try 15 digits first, and only fall back to 17 when the value would not
+     * survive a round trip, so the output matches what cJSON used to print. */
+    snprintf(tmp, sizeof(tmp), "%1.15g", number);
+    if (sscanf(tmp, "%lg", &test) != 1 || test != number)
+    {
+        snprintf(tmp, sizeof(tmp), "%1.17g", number);
+    }
+    for (p = tmp; *p; p++)
+    {
+        if (*p == ',')
+        {
+            *p = '.';
+        }
+    }
+    smart_str_appends(buf, tmp);
 }
 
-cJSON *cJSON_AddNumberToObjectCS(cJSON *obj, const char *key, const double number)
+static void vld_json_indent(smart_str *buf, int depth)
 {
-    cJSON *item = cJSON_CreateNumber(number);
-    if (cJSON_AddItemToObjectCS(obj, key, item))
+    int i;
+
+    for (i = 0; i < depth; i++)
     {
-        return item;
+        smart_str_appendc(buf, '\t');
     }
-    cJSON_Delete(item);
-    return NULL;
 }
 
-cJSON *cJSON_AddNumberToArray(cJSON *array, const double number)
+/* Writes the key of an object member, preceded by the separator of the
+ * previous member unless it is the first one. */
+static void vld_json_key(smart_str *buf, int depth, const char *key, int first)
 {
-    cJSON *item = cJSON_CreateNumber(number);
-    if (cJSON_AddItemToArray(array, item))
+    if (!first)
     {
-        return item;
+        smart_str_appendc(buf, ',');
+    }
+    if (VLD_JSON_PRETTY())
+    {
+        if (!first)
+        {
+            smart_str_appendc(buf, '\n');
+        }
+        vld_json_indent(buf, depth);
+    }
+    vld_json_append_escaped(buf, key, strlen(key));
+    if (VLD_JSON_PRETTY())
+    {
+        smart_str_appendl(buf, ":\t", 2);
+    }
+    else
+    {
+        smart_str_appendc(buf, ':');
     }
-    cJSON_Delete(item);
-    return NULL;
 }
 
-cJSON *cJSON_AddStringToObjectCS(cJSON *obj, const char *key, const char *string)
+static void vld_json_object_open(smart_str *buf)
 {
-    cJSON *item = cJSON_CreateString(string);
-    if (cJSON_AddItemToObjectCS(obj, key, item))
+    smart_str_appendc(buf, '{');
+    if (VLD_JSON_PRETTY())
     {
-        return item;
+        smart_str_appendc(buf, '\n');
     }
-    cJSON_Delete(item);
-    return NULL;
 }
 
-cJSON *cJSON_AddStringRefToObjectCS(cJSON *obj, const char *key, const char *string)
+static void vld_json_object_close(smart_str *buf, int depth)
 {
-    cJSON *item = cJSON_CreateStringReference(string);
-    if (cJSON_AddItemToObjectCS(obj, key, item))
+    if (VLD_JSON_PRETTY())
     {
-        return item;
+        smart_str_appendc(buf, '\n');
+        vld_json_indent(buf, depth);
     }
-    cJSON_Delet_Wrap(item);
-    return NULL;
+    smart_str_appendc(buf, '}');
+}
+
+static void vld_json_array_init(vld_json_array *array, smart_str *buf)
+{
+    array->buf = buf;
+    array->zv = NULL;
+    array->count = 0;
 }
 
-cJSON *cJSON_AddNullObjectCS(cJSON *obj, const char *key)
+static void vld_json_array_init_zval(vld_json_array *array, zval *zv)
 {
-    cJSON *item = cJSON_CreateNull();
-    if (cJSON_AddItemToObjectCS(obj, key, item))
+    array->buf = NULL;
+    array->zv = zv;
+    array->count = 0;
+}
+
+static void vld_json_array_sep(vld_json_array *array)
+{
+    if (array->count++ && !array->zv)
     {
-        return item;
+        if (VLD_JSON_PRETTY())
+        {
+            smart_str_appendl(array->buf, ", ", 2);
+        }
+        else
+        {
+            smart_str_appendc(array->buf, ',');
+        }
     }
-    cJSON_Delet_Wrap(item);
-    return NULL;
 }
 
-cJSON *cJSON_AddStringToArray(cJSON *array, const char *string)
+/* Adding to a NULL array does nothing, that is how fields left out by
+ * vld.json_fields are skipped. */
+static void vld_json_add_null(vld_json_array *array)
 {
-    cJSON *item = cJSON_CreateString(string);
-    if (cJSON_AddItemToArray(array, item))
+    if (!array)
+    {
+        return;
+    }
+    vld_json_array_sep(array);
+    if (array->zv)
     {
-        return item;
+        add_next_index_null(array->zv);
+        return;
     }
-    cJSON_Delet_Wrap(item);
-    return NULL;
+    smart_str_appendl(array->buf, "null", 4);
 }
 
-cJSON *cJSON_AddStringRefToArray(cJSON *array, const char *string)
+static void vld_json_add_long(vld_json_array *array, zend_long number)
 {
-    cJSON *item = cJSON_CreateStringReference(string);
-    if (cJSON_AddItemToArray(array, item))
+    if (!array)
+    {
+        return;
+    }
+    vld_json_array_sep(array);
+    if (array->zv)
     {
-        return item;
+        add_next_index_long(array->zv, number);
+        return;
     }
-    cJSON_Delet_Wrap(item);
-    return NULL;
+    smart_str_append_long(array->buf, number);
 }
 
-cJSON *cJSON_AddNullToArray(cJSON *array)
+static void vld_json_add_double(vld_json_array *array, double number)
 {
-    cJSON *item = cJSON_CreateNull();
-    if (cJSON_AddItemToArray(array, item))
+    if (!array)
     {
-        return item;
+        return;
     }
-    cJSON_Delet_Wrap(item);
-    return NULL;
+    vld_json_array_sep(array);
+    if (array->zv)
+    {
+        add_next_index_double(array->zv, number);
+        return;
+    }
+    vld_json_append_double(array->buf, number);
 }
 
-/* json patch functions. */
+static void vld_json_add_stringl(vld_json_array *array, const char *str, size_t len)
+{
+    if (!array)
+    {
+        return;
+    }
+    vld_json_array_sep(array);
+    if (array->zv)
+    {
+        add_next_index_stringl(array->zv, str, len);
+        return;
+    }
+    vld_json_append_escaped(array->buf, str, len);
+}
 
-static inline cJSON *cJSON_vld_dump_zval_null(ZVAL_VALUE_TYPE value, cJSON *array)
+static void vld_json_add_string(vld_json_array *array, const char *str)
 {
-    cJSON *item = cJSON_CreateNull();
-    if (cJSON_AddItemToArray(array, item))
+    vld_json_add_stringl(array, str, strlen(str));
+}
+
+/* Starts a nested array as the next element of 'parent'. */
+static void vld_json_add_array(vld_json_array *parent, vld_json_array *child)
+{
+    zval tmp;
+
+    vld_json_array_sep(parent);
+    if (parent->zv)
     {
-        return item;
+        array_init(&tmp);
+        vld_json_array_init_zval(child, zend_hash_next_index_insert(Z_ARRVAL_P(parent->zv), &tmp));
+        return;
     }
-    cJSON_Delet_Wrap(item);
-    return NULL;
+    smart_str_appendc(parent->buf, '[');
+    vld_json_array_init(child, parent->buf);
 }
 
-static inline cJSON *cJSON_vld_dump_zval_long(ZVAL_VALUE_TYPE value, cJSON *array)
+static void vld_json_end_array(vld_json_array *child)
 {
-    cJSON *item = cJSON_CreateNumber((double)value.lval);
-    if (cJSON_AddItemToArray(array, item))
+    if (!child->zv)
     {
-        return item;
+        smart_str_appendc(child->buf, ']');
     }
-    cJSON_Delet_Wrap(item);
-    return NULL;
 }
 
-static inline cJSON *cJSON_vld_dump_zval_double(ZVAL_VALUE_TYPE value, cJSON *array)
+/* Buffers larger than this are not worth keeping around. */
+#define VLD_JSON_POOL_KEEP (1024 * 1024)
+
+/* Every function dump needs a text buffer per column. Instead of allocating
+ * and growing them again for each function, emptied buffers go back to a
+ * pool in the json_wrap and keep their size until the end of the request. */
+static void vld_json_buf_get(smart_str *buf)
 {
-    cJSON *item = cJSON_CreateNumber(value.dval);
-    if (cJSON_AddItemToArray(array, item))
+    json_wrap *json_data = VLD_G(json_data);
+
+    if (json_data->pool_count)
+    {
+        *buf = json_data->pool[--json_data->pool_count];
+        ZSTR_LEN(buf->s) = 0;
+    }
+    else
     {
-        return item;
+        memset(buf, 0, sizeof(smart_str));
     }
-    cJSON_Delet_Wrap(item);
-    return NULL;
 }
 
-static inline cJSON *cJSON_vld_dump_zval_string(ZVAL_VALUE_TYPE value, cJSON *array)
+static void vld_json_buf_put(smart_str *buf)
 {
-    ZVAL_VALUE_STRING_TYPE *new_str;
-    cJSON *item;
-    new_str = php_url_encode(ZVAL_STRING_VALUE(value), ZVAL_STRING_LEN(value) PHP_URLENCODE_NEW_LEN(new_len));
-    item = cJSON_AddStringToArray(array, ZSTRING_VALUE(new_str));
-    efree(new_str);
-    return item;
+    json_wrap *json_data = VLD_G(json_data);
+
+    if (buf->s && buf->a <= VLD_JSON_POOL_KEEP && json_data->pool_count < VLD_JSON_POOL_SIZE)
+    {
+        json_data->pool[json_data->pool_count++] = *buf;
+        memset(buf, 0, sizeof(smart_str));
+        return;
+    }
+    smart_str_free(buf);
 }
 
-static inline cJSON *cJSON_vld_dump_zval_array(ZVAL_VALUE_TYPE value, cJSON *array)
+/* Releases the pooled buffers, they are request memory. */
+void vld_json_pool_clear(void)
 {
-    return cJSON_AddStringRefToArray(array, "<array>");
+    json_wrap *json_data = VLD_G(json_data);
+
+    while (json_data->pool_count)
+    {
+        smart_str_free(&json_data->pool[--json_data->pool_count]);
+    }
 }
 
-static inline cJSON *cJSON_vld_dump_zval_object(ZVAL_VALUE_TYPE value, cJSON *array)
+/* Returns the id of a string in the dictionary of the request, adding it when
+ * it is new. Ids are handed out in order, and the strings that have not been
+ * written yet are collected in 'strings_new', so that the next record can
+ * carry them in front of its columns. */
+static zend_long vld_json_intern(const char *str, size_t len)
 {
-    return cJSON_AddStringRefToArray(array, "<object>");
+    json_wrap *json_data = VLD_G(json_data);
+    vld_json_array pending;
+    zval *found, id;
+
+    if (!json_data->strings)
+    {
+        ALLOC_HASHTABLE(json_data->strings);
+        zend_hash_init(json_data->strings, 64, NULL, NULL, 0);
+    }
+    if ((found = zend_hash_str_find(json_data->strings, str, len)) != NULL)
+    {
+        return Z_LVAL_P(found);
+    }
+    ZVAL_LONG(&id, zend_hash_num_elements(json_data->strings));
+    zend_hash_str_add_new(json_data->strings, str, len, &id);
+
+    vld_json_array_init(&pending, &json_data->strings_new);
+    pending.count = Z_LVAL(id) - json_data->strings_first;
+    vld_json_add_stringl(&pending, str, len);
+    return Z_LVAL(id);
 }
 
-static inline cJSON *cJSON_vld_dump_zval_bool(ZVAL_VALUE_TYPE value, cJSON *array)
+/* Adds a string that repeats across ops, as an id with vld.json_intern. */
+static void vld_json_add_interned(vld_json_array *array, const char *str)
 {
-    return cJSON_AddStringRefToArray(array, "<bool>");
+    if (!array)
+    {
+        return;
+    }
+    if (VLD_JSON_INTERN())
+    {
+        vld_json_add_long(array, vld_json_intern(str, strlen(str)));
+        return;
+    }
+    vld_json_add_string(array, str);
 }
 
-static inline cJSON *cJSON_vld_dump_zval_true(ZVAL_VALUE_TYPE value, cJSON *array)
+/* Writes the strings interned since the previous record as the members
+ * "strings_first" (the id of the first one) and "strings". Returns whether
+ * anything was written. */
+static int vld_json_strings_flush(smart_str *fn)
 {
-    return cJSON_AddStringRefToArray(array, "<true>");
+    json_wrap *json_data = VLD_G(json_data);
+
+    if (!json_data->strings || zend_hash_num_elements(json_data->strings) == json_data->strings_first)
+    {
+        return 0;
+    }
+    vld_json_key(fn, 1, "strings_first", 1);
+    smart_str_append_unsigned(fn, json_data->strings_first);
+    vld_json_key(fn, 1, "strings", 0);
+    smart_str_appendc(fn, '[');
+    smart_str_appendl(fn, ZSTR_VAL(json_data->strings_new.s), ZSTR_LEN(json_data->strings_new.s));
+    smart_str_appendc(fn, ']');
+
+    json_data->strings_first = zend_hash_num_elements(json_data->strings);
+    ZSTR_LEN(json_data->strings_new.s) = 0;
+    return 1;
 }
 
-static inline cJSON *cJSON_vld_dump_zval_false(ZVAL_VALUE_TYPE value, cJSON *array)
+/* Forgets the interned strings, the next record starts a new dictionary. */
+void vld_json_strings_reset(void)
 {
-    return cJSON_AddStringRefToArray(array, "<false>");
+    json_wrap *json_data = VLD_G(json_data);
+
+    if (json_data->strings)
+    {
+        zend_hash_destroy(json_data->strings);
+        FREE_HASHTABLE(json_data->strings);
+        json_data->strings = NULL;
+    }
+    json_data->strings_first = 0;
+    smart_str_free(&json_data->strings_new);
 }
 
-static inline cJSON *cJSON_vld_dump_zval_resource(ZVAL_VALUE_TYPE value, cJSON *array)
+/* Looks up 'len' bytes of 'name' in 'cols', returns the index or -1. */
+static int vld_json_field_find(const char **cols, int count, const char *name, size_t len)
 {
-    return cJSON_AddStringRefToArray(array, "<resource>");
+    int i;
+
+    for (i = 0; i < count; i++)
+    {
+        if (strlen(cols[i]) == len && strncmp(cols[i], name, len) == 0)
+        {
+            return i;
+        }
+    }
+    return -1;
 }
 
-static inline cJSON *cJSON_vld_dump_zval_constant(ZVAL_VALUE_TYPE value, cJSON *array)
+/* Turns the comma separated field names of vld.json_fields into the mask of
+ * VLD_JSON_FIELD(). "branch" stands for all columns of the branch object.
+ * Returns -1 for an unknown name. */
+int vld_json_fields_parse(const char *fields)
 {
-    cJSON *item;
-    char *buf;
-    buf = (char *)malloc(ZVAL_STRING_LEN(value) + 11);
-    sprintf(buf, "<const:'%s'>", ZVAL_STRING_VALUE(value));
-    item = cJSON_AddStringToArray(array, buf);
-    free(buf);
-    return item;
+    const char *p = fields, *end;
+    size_t len;
+    int mask = 0, i;
+
+    while (*p)
+    {
+        while (*p == ',' || *p == ' ')
+        {
+            p++;
+        }
+        for (end = p; *end && *end != ',' && *end != ' '; end++);
+        len = end - p;
+        if (len)
+        {
+            if ((i = vld_json_field_find(op_cols, VLD_JSON_OP_COLS, p, len)) >= 0)
+            {
+                mask |= 1 << i;
+            }
+            else if ((i = vld_json_field_find(branch_cols, VLD_JSON_BRANCH_COLS, p, len)) >= 0)
+            {
+                mask |= 1 << (VLD_JSON_FIELD_BRANCH + i);
+            }
+            else if ((i = vld_json_field_find(path_cols, STR_ARRAY_LEN(path_cols), p, len)) >= 0)
+            {
+                mask |= 1 << (VLD_JSON_FIELD_PATH + i);
+            }
+            else if (len == sizeof("branch") - 1 && strncmp(p, "branch", len) == 0)
+            {
+                mask |= ((1 << VLD_JSON_BRANCH_COLS) - 1) << VLD_JSON_FIELD_BRANCH;
+            }
+            else
+            {
+                return -1;
+            }
+        }
+        p = end;
+    }
+    return mask;
+}
+
+static void vld_json_col_init(vld_json_col *col, int as_zval)
+{
+    memset(&col->str, 0, sizeof(smart_str));
+    if (as_zval)
+    {
+        array_init(&col->zv);
+        vld_json_array_init_zval(&col->array, &col->zv);
+    }
+    else
+    {
+        vld_json_buf_get(&col->str);
+        vld_json_array_init(&col->array, &col->str);
+    }
+}
+
+/* Prepares a column that is written when 'used' is set, and returns the
+ * array to add its elements to. A column that is left out gets no buffer,
+ * and NULL is returned. */
+static vld_json_array *vld_json_col_use(vld_json_col *col, int used, int as_zval)
+{
+    if (!used)
+    {
+        memset(col, 0, sizeof(vld_json_col));
+        return NULL;
+    }
+    vld_json_col_init(col, as_zval);
+    return &col->array;
 }
 
-static inline cJSON *cJSON_vld_dump_zval_constant_ast(ZVAL_VALUE_TYPE value, cJSON *array)
+/* Appends a column as the member 'key' of the object in 'buf'. */
+static void vld_json_col_flush(smart_str *buf, int depth, const char *key, int first, vld_json_col *col)
 {
-    return cJSON_AddStringRefToArray(array, "<const ast>");
+    vld_json_key(buf, depth, key, first);
+    smart_str_appendc(buf, '[');
+    if (col->str.s)
+    {
+        smart_str_appendl(buf, ZSTR_VAL(col->str.s), ZSTR_LEN(col->str.s));
+    }
+    smart_str_appendc(buf, ']');
 }
 
-static inline cJSON *cJSON_vld_dump_zval_undef(ZVAL_VALUE_TYPE value, cJSON *array)
+/* Moves a column into the PHP array 'obj' as the element 'key'. */
+static void vld_json_col_flush_zval(zval *obj, const char *key, vld_json_col *col)
 {
-    return cJSON_AddStringRefToArray(array, "<undef>");
+    add_assoc_zval(obj, key, &col->zv);
+    col->array.zv = NULL;
 }
 
-static inline cJSON *cJSON_vld_dump_zval_reference(ZVAL_VALUE_TYPE value, cJSON *array)
+static void vld_json_col_free(vld_json_col *col)
 {
-    return cJSON_AddStringRefToArray(array, "<reference>");
+    vld_json_buf_put(&col->str);
+    if (col->array.zv)
+    {
+        zval_ptr_dtor(&col->zv);
+        col->array.zv = NULL;
+    }
 }
 
-static inline cJSON *cJSON_vld_dump_zval_indirect(ZVAL_VALUE_TYPE value, cJSON *array)
+/* json patch functions. */
+
+static void vld_json_dump_zval_string(ZVAL_VALUE_TYPE value, vld_json_array *array)
 {
-    return cJSON_AddStringRefToArray(array, "<indirect>");
+    ZVAL_VALUE_STRING_TYPE *new_str;
+
+    new_str = php_url_encode(ZVAL_STRING_VALUE(value), ZVAL_STRING_LEN(value) PHP_URLENCODE_NEW_LEN(new_len));
+    vld_json_add_stringl(array, ZSTRING_VALUE(new_str), new_str->len);
+    efree(new_str);
 }
 
-static inline cJSON *cJSON_vld_dump_zval_ptr(ZVAL_VALUE_TYPE value, cJSON *array)
+#if PHP_VERSION_ID < 70300
+static void vld_json_dump_zval_constant(ZVAL_VALUE_TYPE value, vld_json_array *array)
 {
-    return cJSON_AddStringRefToArray(array, "<ptr>");
+    char *buf;
+
+    spprintf(&buf, 0, "<const:'%s'>", ZVAL_STRING_VALUE(value));
+    vld_json_add_string(array, buf);
+    efree(buf);
 }
+#endif
 
-cJSON *cJSON_vld_dump_zval(zval val, cJSON *array)
+void vld_json_dump_zval(zval val, vld_json_array *array)
 {
     switch (val.u1.v.type)
     {
     case IS_NULL:
-        return cJSON_vld_dump_zval_null(val.value, array);
+        vld_json_add_null(array);
+        return;
     case IS_LONG:
-        return cJSON_vld_dump_zval_long(val.value, array);
+        vld_json_add_long(array, val.value.lval);
+        return;
     case IS_DOUBLE:
-        return cJSON_vld_dump_zval_double(val.value, array);
+        vld_json_add_double(array, val.value.dval);
+        return;
     case IS_STRING:
-        return cJSON_vld_dump_zval_string(val.value, array);
+        vld_json_dump_zval_string(val.value, array);
+        return;
     case IS_ARRAY:
-        return cJSON_vld_dump_zval_array(val.value, array);
+        vld_json_add_string(array, "<array>");
+        return;
     case IS_OBJECT:
-        return cJSON_vld_dump_zval_object(val.value, array);
+        vld_json_add_string(array, "<object>");
+        return;
     case IS_RESOURCE:
-        return cJSON_vld_dump_zval_resource(val.value, array);
+        vld_json_add_string(array, "<resource>");
+        return;
 #if PHP_VERSION_ID < 70300
     case IS_CONSTANT:
-        return cJSON_vld_dump_zval_constant(val.value, array);
+        vld_json_dump_zval_constant(val.value, array);
+        return;
 #endif
     case IS_CONSTANT_AST:
-        return cJSON_vld_dump_zval_constant_ast(val.value, array);
+        vld_json_add_string(array, "<const ast>");
+        return;
     case IS_UNDEF:
-        return cJSON_vld_dump_zval_undef(val.value, array);
+        vld_json_add_string(array, "<undef>");
+        return;
     case IS_FALSE:
-        return cJSON_vld_dump_zval_false(val.value, array);
+        vld_json_add_string(array, "<false>");
+        return;
     case IS_TRUE:
-        return cJSON_vld_dump_zval_true(val.value, array);
+        vld_json_add_string(array, "<true>");
+        return;
     case IS_REFERENCE:
-        return cJSON_vld_dump_zval_reference(val.value, array);
+        vld_json_add_string(array, "<reference>");
+        return;
     case IS_INDIRECT:
-        return cJSON_vld_dump_zval_indirect(val.value, array);
+        vld_json_add_string(array, "<indirect>");
+        return;
     case IS_PTR:
-        return cJSON_vld_dump_zval_ptr(val.value, array);
+        vld_json_add_string(array, "<ptr>");
+        return;
     }
-    return cJSON_AddStringRefToArray(array, "<unknown>");
+    vld_json_add_string(array, "<unknown>");
 }
 
-int cJSON_vld_dump_znode(cJSON *type_array, cJSON *value_array, unsigned int node_type, VLD_ZNODE node, unsigned int base_address, zend_op_array *op_array, int opline)
+/* Writes the type of a node into 'type_array', and its value into
+ * 'value_array'. Either may be NULL when that column is not written (the type
+ * columns only exist with verbosity >= 3), and is then not worked out. */
+void vld_json_dump_znode(vld_json_array *type_array, vld_json_array *value_array, unsigned int node_type, VLD_ZNODE node, unsigned int base_address, zend_op_array *op_array, int opline)
 {
-    char *tbuf;
     char buf[128];
-    int index = 0;
-    cJSON *cols[2] = {NULL, NULL};
 
-    switch (node_type)
+    if (type_array)
     {
-    case IS_UNUSED:
-        if (VLD_G(verbosity) >= 3)
+        switch (node_type)
         {
-            if (!cJSON_AddStringRefToArray(type_array, "IS_UNUSED"))
-            {
-                goto fail;
-            }
-        }
-        if (!cJSON_AddNullToArray(value_array))
-        {
-            goto fail;
+        case IS_UNUSED:
+            vld_json_add_interned(type_array, "IS_UNUSED");
+            break;
+        case IS_CONST: /* 1 */
+            snprintf(buf, sizeof(buf), "IS_CONST (%d)", (int)(VLD_ZNODE_ELEM(node, var) / sizeof(zval)));
+            vld_json_add_interned(type_array, buf);
+            break;
+        case IS_TMP_VAR: /* 2 */
+            vld_json_add_interned(type_array, "IS_TMP_VAR");
+            break;
+        case IS_VAR: /* 4 */
+            vld_json_add_interned(type_array, "IS_VAR");
+            break;
+        case IS_CV: /* 16 */
+            vld_json_add_interned(type_array, "IS_CV");
+            break;
+        case VLD_IS_OPNUM:
+            vld_json_add_interned(type_array, "IS_OPNUM");
+            break;
+        case VLD_IS_OPLINE:
+            vld_json_add_interned(type_array, "IS_OPLINE");
+            break;
+        case VLD_IS_CLASS:
+            vld_json_add_interned(type_array, "IS_CLASS");
+            break;
+#if PHP_VERSION_ID >= 70200
+        case VLD_IS_JMP_ARRAY:
+            vld_json_add_interned(type_array, "IS_JMP_ARRAY");
+            break;
+#endif
+        default:
+            vld_json_add_null(type_array);
         }
+    }
+    if (!value_array)
+    {
+        return;
+    }
+
+    switch (node_type)
+    {
+    case IS_UNUSED:
+        vld_json_add_null(value_array);
         break;
     case IS_CONST: /* 1 */
-        if (VLD_G(verbosity) >= 3)
-        {
-            memset(buf, 0, 128);
-            sprintf(buf, "IS_CONST (%d)", VLD_ZNODE_ELEM(node, var) / sizeof(zval));
-            if (!cJSON_AddStringToArray(type_array, buf))
-            {
-                goto fail;
-            }
-        }
 #if PHP_VERSION_ID >= 70300
-        if (!cJSON_vld_dump_zval(*RT_CONSTANT((op_array->opcodes) + opline, node), value_array))
-        {
-            goto fail;
-        }
+        vld_json_dump_zval(*RT_CONSTANT((op_array->opcodes) + opline, node), value_array);
 #else
-        if (!cJSON_vld_dump_zval(*RT_CONSTANT_EX(op_array->literals, node), value_array))
-        {
-            goto fail;
-        }
+        vld_json_dump_zval(*RT_CONSTANT_EX(op_array->literals, node), value_array);
 #endif
         break;
 
     case IS_TMP_VAR: /* 2 */
-        if (VLD_G(verbosity) >= 3)
-        {
-            if (!cJSON_AddStringRefToArray(type_array, "IS_TMP_VAR"))
-            {
-                goto fail;
-            }
-        }
-        memset(buf, 0, 128);
-        sprintf(buf, "~%d", VAR_NUM(VLD_ZNODE_ELEM(node, var)));
-        if (!cJSON_AddStringToArray(value_array, buf))
-        {
-            goto fail;
-        }
+        snprintf(buf, sizeof(buf), "~%d", VAR_NUM(VLD_ZNODE_ELEM(node, var)));
+        vld_json_add_string(value_array, buf);
         break;
     case IS_VAR: /* 4 */
-        if (VLD_G(verbosity) >= 3)
-        {
-            if (!cJSON_AddStringRefToArray(type_array, "IS_VAR"))
-            {
-                goto fail;
-            }
-        }
-        memset(buf, 0, 128);
-        sprintf(buf, "$%d", VAR_NUM(VLD_ZNODE_ELEM(node, var)));
-        if (!cJSON_AddStringToArray(value_array, buf))
-        {
-            goto fail;
-        }
+        snprintf(buf, sizeof(buf), "$%d", VAR_NUM(VLD_ZNODE_ELEM(node, var)));
+        vld_json_add_string(value_array, buf);
         break;
     case IS_CV: /* 16 */
-        if (VLD_G(verbosity) >= 3)
-        {
-            if (!cJSON_AddStringRefToArray(type_array, "IS_CV"))
-            {
-                goto fail;
-            }
-        }
-        sprintf(buf, "!%d", (VLD_ZNODE_ELEM(node, var) - sizeof(zend_execute_data)) / sizeof(zval));
-        if (!cJSON_AddStringToArray(value_array, buf))
-        {
-            goto fail;
-        }
+        snprintf(buf, sizeof(buf), "!%d", (int)((VLD_ZNODE_ELEM(node, var) - sizeof(zend_execute_data)) / sizeof(zval)));
+        vld_json_add_string(value_array, buf);
         break;
     case VLD_IS_OPNUM:
-        if (VLD_G(verbosity) >= 3)
-        {
-            if (!cJSON_AddStringRefToArray(type_array, "IS_OPNUM"))
-            {
-                goto fail;
-            }
-        }
-        sprintf(buf, "->%d", VLD_ZNODE_JMP_LINE(node, opline, base_address));
-        if (!cJSON_AddStringToArray(value_array, buf))
-        {
-            goto fail;
-        }
-        /* Cleanup flag is not necessary for the last one. */
-        /* cols[1] = value_array; */
-        break;
     case VLD_IS_OPLINE:
-        if (VLD_G(verbosity) >= 3)
-        {
-            if (!cJSON_AddStringRefToArray(type_array, "IS_OPLINE"))
-            {
-                goto fail;
-            }
-        }
-        sprintf(buf, "->%d", VLD_ZNODE_JMP_LINE(node, opline, base_address));
-        if (!cJSON_AddStringToArray(value_array, buf))
-        {
-            goto fail;
-        }
+        snprintf(buf, sizeof(buf), "->%d", VLD_ZNODE_JMP_LINE(node, opline, base_address));
+        vld_json_add_string(value_array, buf);
         break;
     case VLD_IS_CLASS:
-        if (VLD_G(verbosity) >= 3)
-        {
-            if (!cJSON_AddStringRefToArray(type_array, "IS_CLASS"))
-            {
-                goto fail;
-            }
-        }
 #if PHP_VERSION_ID >= 70300
-        if (!cJSON_vld_dump_zval(*RT_CONSTANT((op_array->opcodes) + opline, node), value_array))
-        {
-            goto fail;
-        }
+        vld_json_dump_zval(*RT_CONSTANT((op_array->opcodes) + opline, node), value_array);
 #else
-        if (!cJSON_vld_dump_zval(*RT_CONSTANT_EX(op_array->literals, node), value_array))
-        {
-            goto fail;
-        }
+        vld_json_dump_zval(*RT_CONSTANT_EX(op_array->literals, node), value_array);
 #endif
         break;
 #if PHP_VERSION_ID >= 70200
@@ -458,15 +762,9 @@ int cJSON_vld_dump_znode(cJSON *type_array, cJSON *value_array, unsigned int nod
         zend_ulong num;
         zend_string *key;
         zval *val;
-        cJSON *jump_list;
-
-        if (VLD_G(verbosity) >= 3)
-        {
-            if (!cJSON_AddStringRefToArray(type_array, "IS_JMP_ARRAY"))
-            {
-                goto fail;
-            }
-        }
+        vld_json_array jump_list;
+        ZVAL_VALUE_STRING_TYPE *new_str;
+        char *tbuf;
 
 #if PHP_VERSION_ID >= 70300
         array_value = RT_CONSTANT((op_array->opcodes) + opline, node);
@@ -474,150 +772,114 @@ int cJSON_vld_dump_znode(cJSON *type_array, cJSON *value_array, unsigned int nod
         array_value = RT_CONSTANT_EX(op_array->literals, node);
 #endif
         myht = Z_ARRVAL_P(array_value);
-        jump_list = cJSON_CreateArray();
-        ZVAL_VALUE_STRING_TYPE *new_str;
+        vld_json_add_array(value_array, &jump_list);
         ZEND_HASH_FOREACH_KEY_VAL_IND(myht, num, key, val)
         {
-            memset(buf, 0, 128);
             if (key == NULL)
             {
-                sprintf(buf, "%d:->%d, ", num, opline + (val->value.lval / sizeof(zend_op)));
-                if (!cJSON_AddStringToArray(jump_list, buf))
-                {
-                    cJSON_Delet_Wrap(jump_list);
-                    goto fail;
-                }
+                snprintf(buf, sizeof(buf), ZEND_LONG_FMT ":->%d, ", num, (int)(opline + (val->value.lval / sizeof(zend_op))));
+                vld_json_add_string(&jump_list, buf);
             }
             else
             {
                 new_str = php_url_encode(ZSTRING_VALUE(key), key->len PHP_URLENCODE_NEW_LEN(new_len));
-                tbuf = (char *)malloc(new_str->len + 6);
-                sprintf(tbuf, "'%s':->%d, ", ZSTRING_VALUE(new_str), opline + (val->value.lval / sizeof(zend_op)));
-                if (!cJSON_AddStringToArray(jump_list, tbuf))
-                {
-                    efree(new_str);
-                    free(tbuf);
-                    cJSON_Delet_Wrap(jump_list);
-                    goto fail;
-                }
+                spprintf(&tbuf, 0, "'%s':->%d, ", ZSTRING_VALUE(new_str), (int)(opline + (val->value.lval / sizeof(zend_op))));
+                vld_json_add_string(&jump_list, tbuf);
                 efree(new_str);
-                free(tbuf);
+                efree(tbuf);
             }
         }
         ZEND_HASH_FOREACH_END();
-        if (!cJSON_AddItemToArray(value_array, jump_list))
-        {
-            goto fail;
-        }
+        vld_json_end_array(&jump_list);
     }
     break;
 #endif
     default:
-        if (VLD_G(verbosity) >= 3)
-        {
-            if (!cJSON_AddNullToArray(type_array))
-            {
-                goto fail;
-            }
-        }
-        if (!cJSON_AddNullToArray(value_array))
-        {
-            goto fail;
-        }
+        vld_json_add_null(value_array);
     }
-    return 1;
-fail:
-    return 0;
 }
 
-int cJSON_vld_dump_op(int nr, zend_op *op_ptr, unsigned int base_address, int notdead, int entry, int start, int end, zend_op_array *opa, cJSON *op_arrays)
+/* Prepares the columns of a function dump. Columns that are not written get
+ * no buffer, and nothing is worked out for them. */
+static void vld_json_dump_init(vld_json_dump *dump, zend_op_array *opa, int as_zval)
 {
-    static unsigned int last_lineno = (unsigned int)-1;
-    int print_sep = 0, len;
-    const char *fetch_type = "";
-    unsigned int flags, op1_type, op2_type, res_type;
-    const zend_op op = op_ptr[nr];
-    char buf[64];
-    const char *const_table[] = {"*", "E", ">", ">"};
-    int const_flags[] = {notdead ? 0 : 1, entry, start, end};
-    static cJSON *pre_opa = NULL;
-    static cJSON *cols[18];
-    cJSON *col = NULL;
-    cJSON *tmp = NULL;
+    int j;
 
-    if (pre_opa == op_arrays)
-    {
-        goto handle;
-    }
-    else
+    for (j = 0; j < VLD_JSON_OP_COLS; j++)
     {
-        memset(cols, 0, sizeof(cols));
-        pre_opa = NULL;
+        dump->col[j] = vld_json_col_use(&dump->ops[j], VLD_JSON_OP_COL_USED(j), as_zval);
     }
+    dump->last_lineno = (unsigned int)-1;
+    dump->hits = dump->col[VLD_JSON_HITS_COL] ? vld_profile_hits(opa) : NULL;
+}
 
-    if (op.lineno == 0)
-    {
-        return 1;
-    }
+/* Writes a pair of unused type/value cells. */
+static void vld_json_dump_unused(vld_json_array *type_array, vld_json_array *value_array)
+{
+    vld_json_add_null(type_array);
+    vld_json_add_null(value_array);
+}
 
-    for (int i = 0; i < STR_ARRAY_LEN(op_cols); i++)
-    {
-        if (VLD_G(verbosity) >= verbosity_flags[i] && !(cols[i] = cJSON_GetObjectItem(op_arrays, op_cols[i])))
-        {
-            memset(cols, 0, sizeof(cols));
-            pre_opa = NULL;
-            return 0;
-        }
-    }
-    pre_opa = op_arrays;
+/* Works out how the operands of 'op' are shown: returns the opcode flags,
+ * and the types of the result and operands, with vld's own types for jump
+ * targets, classes and jump tables. */
+unsigned int vld_json_op_types(const zend_op *op, unsigned int base_address, unsigned int *res_type, unsigned int *op1_type, unsigned int *op2_type)
+{
+    unsigned int flags;
 
-handle:
-    memset(buf, '\0', 64);
-    if (op.opcode >= NUM_KNOWN_OPCODES)
+    if (op->opcode >= NUM_KNOWN_OPCODES)
     {
         flags = ALL_USED;
     }
     else
     {
-        flags = opcodes[op.opcode].flags;
+        flags = opcodes[op->opcode].flags;
     }
 
-    op1_type = op.VLD_TYPE(op1);
-    op2_type = op.VLD_TYPE(op2);
-    res_type = op.VLD_TYPE(result);
+    *op1_type = op->VLD_TYPE(op1);
+    *op2_type = op->VLD_TYPE(op2);
+    *res_type = op->VLD_TYPE(result);
 
     if (flags == SPECIAL)
     {
-        flags = vld_get_special_flags(&op, base_address);
+        flags = vld_get_special_flags(op, base_address);
     }
     if (flags & OP1_OPLINE)
     {
-        op1_type = VLD_IS_OPLINE;
+        *op1_type = VLD_IS_OPLINE;
     }
     if (flags & OP2_OPLINE)
     {
-        op2_type = VLD_IS_OPLINE;
+        *op2_type = VLD_IS_OPLINE;
     }
     if (flags & OP1_OPNUM)
     {
-        op1_type = VLD_IS_OPNUM;
+        *op1_type = VLD_IS_OPNUM;
     }
     if (flags & OP2_OPNUM)
     {
-        op2_type = VLD_IS_OPNUM;
+        *op2_type = VLD_IS_OPNUM;
     }
     if (flags & OP1_CLASS)
     {
-        op1_type = VLD_IS_CLASS;
+        *op1_type = VLD_IS_CLASS;
     }
     if (flags & RES_CLASS)
     {
-        res_type = VLD_IS_CLASS;
+        *res_type = VLD_IS_CLASS;
     }
     if (flags & OP2_JMP_ARRAY)
     {
-        op2_type = VLD_IS_JMP_ARRAY;
+        *op2_type = VLD_IS_JMP_ARRAY;
     }
+    return flags;
+}
+
+/* The text of the "fetch" column of 'op'. */
+const char *vld_json_fetch_type(const zend_op *op_ptr, unsigned int flags)
+{
+    const char *fetch_type = "";
+    const zend_op op = *op_ptr;
 
 #if PHP_VERSION_ID >= 70000 && PHP_VERSION_ID < 70100
     switch (op.opcode)
@@ -707,70 +969,76 @@ handle:
         }
     }
 
-    if (!cJSON_AddStringRefToArray(cols[8], fetch_type))
+    return fetch_type;
+}
+
+void vld_json_dump_op(int nr, zend_op *op_ptr, unsigned int base_address, int notdead, int entry, int start, int end, zend_op_array *opa, vld_json_dump *dump)
+{
+    unsigned int flags, op1_type, op2_type, res_type;
+    const zend_op op = op_ptr[nr];
+    char buf[64];
+    const char *const_table[] = {"*", "E", ">", ">"};
+    int const_flags[] = {notdead ? 0 : 1, entry, start, end};
+    vld_json_array **col = dump->col;
+    int i;
+
+    flags = vld_json_op_types(&op, base_address, &res_type, &op1_type, &op2_type);
+    if (col[8])
     {
-        goto fail;
+        vld_json_add_interned(col[8], vld_json_fetch_type(&op, flags));
     }
 
-    if (op.lineno == last_lineno)
+    if (op.lineno == dump->last_lineno)
     {
-        tmp = cJSON_AddNullToArray(cols[0]);
+        vld_json_add_null(col[0]);
     }
     else
     {
-        tmp = cJSON_AddNumberToArray(cols[0], (double)op.lineno);
-        last_lineno = op.lineno;
+        vld_json_add_long(col[0], op.lineno);
+        dump->last_lineno = op.lineno;
     }
-    if (!tmp)
+    vld_json_add_long(col[1], nr);
+    if (col[VLD_JSON_HITS_COL])
     {
-        goto fail;
-    }
-    if (!cJSON_AddNumberToArray(cols[1], (double)nr))
-    {
-        goto fail;
+        vld_json_add_long(col[VLD_JSON_HITS_COL], dump->hits ? (zend_long)dump->hits[nr] : 0);
     }
     /* Process col '*'\'E'\'I'\'O' */
-    for (int i = 0; i < 4; i++)
+    for (i = 0; i < 4; i++)
     {
-        col = cols[i + 2];
-        tmp = (const_flags[i]) ? cJSON_AddStringRefToArray(col, const_table[i]) : cJSON_AddNullToArray(col);
-        if (!tmp)
+        if (const_flags[i])
         {
-            goto fail;
+            vld_json_add_string(col[i + 2], const_table[i]);
+        }
+        else
+        {
+            vld_json_add_null(col[i + 2]);
         }
     }
 
-    col = cols[7];
-    tmp = (op.opcode >= NUM_KNOWN_OPCODES) ? cJSON_AddStringRefToArray(col, "UNKNOWN_OPCODE") : cJSON_AddStringRefToArray(col, opcodes[op.opcode].name);
-    if (!tmp)
-    {
-        goto fail;
-    }
-
-    if (VLD_G(verbosity) >= 3)
+    if (col[7])
     {
-        if (!cJSON_AddNumberToArray(cols[6], (double)op.opcode))
-        {
-            goto fail;
-        }
+        vld_json_add_interned(col[7], (op.opcode >= NUM_KNOWN_OPCODES) ? "UNKNOWN_OPCODE" : opcodes[op.opcode].name);
     }
+    vld_json_add_long(col[6], op.opcode);
 
-    col = cols[9];
     if (flags & EXT_VAL)
     {
 #if PHP_VERSION_ID >= 70300
-        tmp = op.opcode == ZEND_CATCH ? cJSON_AddStringRefToArray(col, "last") : cJSON_AddNumberToArray(col, (double)op.extended_value);
+        if (op.opcode == ZEND_CATCH)
+        {
+            vld_json_add_string(col[9], "last");
+        }
+        else
+        {
+            vld_json_add_long(col[9], op.extended_value);
+        }
 #else
-        tmp = cJSON_AddNumberToArray(col, (double)op.extended_value);
+        vld_json_add_long(col[9], op.extended_value);
 #endif
     }
     else
     {
-        tmp = cJSON_AddNullToArray(col);
-    }
-    if (!tmp)
-    {
-        goto fail;
+        vld_json_add_null(col[9]);
     }
 
 #if PHP_VERSION_ID >= 70100
@@ -780,58 +1048,26 @@ handle:
     if ((flags & RES_USED) && !(op.VLD_EXTENDED_VALUE(result) & EXT_TYPE_UNUSED))
     {
 #endif
-        if (!cJSON_vld_dump_znode(cols[10], cols[11], res_type, op.result, base_address, opa, nr))
-        {
-            goto fail;
-        }
+        vld_json_dump_znode(col[10], col[11], res_type, op.result, base_address, opa, nr);
     }
     else
     {
-        if (VLD_G(verbosity) >= 3)
-        {
-            if (!cJSON_AddNullToArray(cols[10]))
-            {
-                goto fail;
-            }
-        }
-        if (!cJSON_AddNullToArray(cols[11]))
-        {
-            goto fail;
-        }
+        vld_json_dump_unused(col[10], col[11]);
     }
     if (flags & OP1_USED)
     {
-        if (!cJSON_vld_dump_znode(cols[12], cols[13], op1_type, op.op1, base_address, opa, nr))
-        {
-            goto fail;
-        }
+        vld_json_dump_znode(col[12], col[13], op1_type, op.op1, base_address, opa, nr);
     }
     else
     {
-        if (VLD_G(verbosity) >= 3)
-        {
-            if (!cJSON_AddNullToArray(cols[12]))
-            {
-                goto fail;
-            }
-        }
-        if (!cJSON_AddNullToArray(cols[13]))
-        {
-            goto fail;
-        }
+        vld_json_dump_unused(col[12], col[13]);
     }
     if (flags & OP2_USED)
     {
         if (flags & OP2_INCLUDE)
         {
-            char *op2_name = NULL;
-            if (VLD_G(verbosity) >= 3)
-            {
-                if (!cJSON_AddStringRefToArray(cols[14], "OP2_INCLUDE"))
-                {
-                    goto fail;
-                }
-            }
+            const char *op2_name = NULL;
+            vld_json_add_interned(col[14], "OP2_INCLUDE");
             switch (op.extended_value)
             {
             case ZEND_INCLUDE_ONCE:
@@ -853,447 +1089,507 @@ handle:
                 op2_name = "!!ERROR!!";
                 break;
             }
-            if (!cJSON_AddStringRefToArray(cols[15], op2_name))
-            {
-                goto fail;
-            }
+            vld_json_add_string(col[15], op2_name);
         }
         else
         {
-            if (!cJSON_vld_dump_znode(cols[14], cols[15], op2_type, op.op2, base_address, opa, nr))
-            {
-                goto fail;
-            }
+            vld_json_dump_znode(col[14], col[15], op2_type, op.op2, base_address, opa, nr);
         }
     }
     else
     {
-        if (VLD_G(verbosity) >= 3)
-        {
-            if (!cJSON_AddNullToArray(cols[14]))
-            {
-                goto fail;
-            }
-        }
-        if (!cJSON_AddNullToArray(cols[15]))
-        {
-            goto fail;
-        }
+        vld_json_dump_unused(col[14], col[15]);
     }
     if (flags & EXT_VAL_JMP_ABS)
     {
-        if (VLD_G(verbosity) >= 3)
-        {
-            if (!cJSON_AddStringRefToArray(cols[16], "EXT_JMP_ABS"))
-            {
-                goto fail;
-            }
-        }
-        sprintf(buf, "->%d", op.extended_value);
-        if (!cJSON_AddStringToArray(cols[17], buf))
+        vld_json_add_interned(col[16], "EXT_JMP_ABS");
+        if (col[17])
         {
-            goto fail;
+            snprintf(buf, sizeof(buf), "->%d", op.extended_value);
+            vld_json_add_string(col[17], buf);
         }
     }
     else if (flags & EXT_VAL_JMP_REL)
     {
-        if (VLD_G(verbosity) >= 3)
-        {
-            if (!cJSON_AddStringRefToArray(cols[16], "EXT_JMP_REL"))
-            {
-                goto fail;
-            }
-        }
-        sprintf(buf, "->%d", nr + ((int)op.extended_value / sizeof(zend_op)));
-        if (!cJSON_AddStringToArray(cols[17], buf))
+        vld_json_add_interned(col[16], "EXT_JMP_REL");
+        if (col[17])
         {
-            goto fail;
+            snprintf(buf, sizeof(buf), "->%d", (int)(nr + ((int)op.extended_value / sizeof(zend_op))));
+            vld_json_add_string(col[17], buf);
         }
     }
     /*  FIXME: Not sure if it would accessiable along with 'flag & EXT_VAL_JMP_*'. */
     else if (flags & NOP2_OPNUM)
     {
         zend_op next_op = op_ptr[nr + 1];
-        if (!cJSON_vld_dump_znode(cols[16], cols[17], VLD_IS_OPNUM, next_op.op2, base_address, opa, nr))
-        {
-            goto fail;
-        }
+        vld_json_dump_znode(col[16], col[17], VLD_IS_OPNUM, next_op.op2, base_address, opa, nr);
     }
     else
     {
-        if (VLD_G(verbosity) >= 3)
-        {
-            if (!cJSON_AddNullToArray(cols[16]))
-            {
-                goto fail;
-            }
-        }
-        if (!cJSON_AddNullToArray(cols[17]))
-        {
-            goto fail;
-        }
+        vld_json_dump_unused(col[16], col[17]);
     }
     VLD_G(json_data)->inner_len++;
-    return 1;
-fail:
-    memset(cols, 0, sizeof(cols));
-    pre_opa = NULL;
-    return 0;
 }
 
-void vld_analyse_oparray_quiet(zend_op_array *opa, vld_set *set, vld_branch_info *branch_info);
-void vld_analyse_branch_quiet(zend_op_array *opa, unsigned int position, vld_set *set, vld_branch_info *branch_info);
-
-int cJSON_vld_branch_info_dump(zend_op_array *opa, vld_branch_info *branch_info, cJSON *fn)
+/* Collects the "branch" columns and the "path" and "path_hit" members of a
+ * function, leaving out those that are not written. */
+static void vld_json_branch_cols(zend_op_array *opa, vld_branch_info *branch_info, vld_json_col *cols, vld_json_col *paths, int as_zval)
 {
     unsigned int i, j;
-    const char *fname = opa->function_name ? ZSTRING_VALUE(opa->function_name) : "__main";
-    cJSON *col;
-    cJSON *sline;
-    cJSON *eline;
-    cJSON *sop;
-    cJSON *eop;
-    cJSON *outs;
-    cJSON *tmp;
+    vld_json_array tmp, tmp_hit;
+    vld_json_array *col[sizeof(branch_cols) / sizeof(branch_cols[0])];
+    vld_json_array *path = vld_json_col_use(&paths[0], VLD_JSON_PATH_COL_USED(0), as_zval);
+    vld_json_array *path_hit = vld_json_col_use(&paths[1], VLD_JSON_PATH_COL_USED(1), as_zval);
+    vld_coverage *coverage = vld_coverage_find(opa);
 
-    if (VLD_G(path_dump_file))
+    for (i = 0; i < VLD_JSON_BRANCH_COLS; i++)
     {
-        fprintf(VLD_G(path_dump_file), "subgraph cluster_%p {\n\tlabel=\"%s\";\n\tgraph [rankdir=\"LR\"];\n\tnode [shape = record];\n", opa, fname);
-
-        for (i = 0; i < branch_info->starts->size; i++)
-        {
-            if (vld_set_in(branch_info->starts, i))
-            {
-                fprintf(
-                    VLD_G(path_dump_file),
-                    "\t\"%s_%d\" [ label = \"{ op #%d-%d | line %d-%d }\" ];\n",
-                    fname, i, i,
-                    branch_info->branches[i].end_op,
-                    branch_info->branches[i].start_lineno,
-                    branch_info->branches[i].end_lineno);
-                if (vld_set_in(branch_info->entry_points, i))
-                {
-                    fprintf(VLD_G(path_dump_file), "\t%s_ENTRY -> %s_%d\n", fname, fname, i);
-                }
-                for (j = 0; j < branch_info->branches[i].outs_count; j++)
-                {
-                    if (branch_info->branches[i].outs[j])
-                    {
-                        if (branch_info->branches[i].outs[j] == VLD_JMP_EXIT)
-                        {
-                            fprintf(VLD_G(path_dump_file), "\t%s_%d -> %s_EXIT;\n", fname, i, fname);
-                        }
-                        else
-                        {
-                            fprintf(VLD_G(path_dump_file), "\t%s_%d -> %s_%d;\n", fname, i, fname, branch_info->branches[i].outs[j]);
-                        }
-                    }
-                }
-            }
-        }
-        fprintf(VLD_G(path_dump_file), "}\n");
+        col[i] = vld_json_col_use(&cols[i], VLD_JSON_BRANCH_COL_USED(i), as_zval);
     }
 
-    if (!fn)
-    {
-        return 1;
-    }
-    col = cJSON_GetObjectItem(fn, "branch");
-    if (!col)
-    {
-        return 0;
-    }
-    sline = cJSON_GetObjectItem(col, "sline");
-    eline = cJSON_GetObjectItem(col, "eline");
-    sop = cJSON_GetObjectItem(col, "sop");
-    eop = cJSON_GetObjectItem(col, "eop");
-    outs = cJSON_GetObjectItem(col, "outs");
-    if (!sline || !eline || !sop || !eop || !outs)
+    for (i = 0; i < branch_info->branches_count; i++)
     {
-        return 0;
-    }
+        vld_branch *b = &branch_info->branches[i];
 
-    for (i = 0; i < branch_info->starts->size; i++)
-    {
-        if (vld_set_in(branch_info->starts, i))
+        vld_json_add_long(col[0], b->start_lineno);
+        vld_json_add_long(col[1], b->end_lineno);
+        vld_json_add_long(col[2], b->start_op);
+        vld_json_add_long(col[3], b->end_op);
+        if (col[5])
         {
-            if (!cJSON_AddNumberToArray(sline, (double)branch_info->branches[i].start_lineno))
-            {
-                return 0;
-            }
-            if (!cJSON_AddNumberToArray(eline, (double)branch_info->branches[i].end_lineno))
+            vld_json_add_long(col[5], vld_coverage_branch_hit(coverage, i) ? 1 : 0);
+        }
+
+        if (col[4])
+        {
+            vld_json_add_array(col[4], &tmp);
+            for (j = 0; j < b->outs_count; j++)
             {
-                return 0;
+                vld_json_add_long(&tmp, VLD_BRANCH_OUT(branch_info, i, j));
             }
-            if (!cJSON_AddNumberToArray(sop, (double)i))
+            vld_json_end_array(&tmp);
+        }
+        if (col[6])
+        {
+            vld_json_add_array(col[6], &tmp_hit);
+            for (j = 0; j < b->outs_count; j++)
             {
-                return 0;
+                vld_json_add_long(&tmp_hit, vld_coverage_out_hit(coverage, i, j));
             }
-            if (!cJSON_AddNumberToArray(eop, (double)branch_info->branches[i].end_op))
+            vld_json_end_array(&tmp_hit);
+        }
+    }
+    for (i = 0; i < branch_info->paths_count; i++)
+    {
+        if (path)
+        {
+            vld_json_add_array(path, &tmp);
+            for (j = 0; j < branch_info->paths[i]->elements_count; j++)
             {
-                return 0;
+                vld_json_add_long(&tmp, branch_info->branches[branch_info->paths[i]->elements[j]].start_op);
             }
+            vld_json_end_array(&tmp);
+        }
+        if (path_hit)
+        {
+            vld_json_add_long(path_hit, vld_coverage_path_hit(coverage, branch_info->paths[i]));
+        }
+    }
+}
 
-            tmp = cJSON_CreateArray();
-
-            for (j = 0; j < branch_info->branches[i].outs_count; j++)
-            {
-                if (branch_info->branches[i].outs[j] && !cJSON_AddNumberToArray(tmp, (double)branch_info->branches[i].outs[j]))
-                {
-                    cJSON_Delet_Wrap(tmp);
-                    return 0;
-                }
-            }
+/* Whether any column of the "branch" object is written. */
+static int vld_json_branch_used(void)
+{
+    unsigned int i;
 
-            if (!cJSON_AddItemToArray(outs, tmp))
-            {
-                cJSON_Delet_Wrap(tmp);
-                return 0;
-            }
+    for (i = 0; i < VLD_JSON_BRANCH_COLS; i++)
+    {
+        if (VLD_JSON_BRANCH_COL_USED(i))
+        {
+            return 1;
         }
     }
-    col = cJSON_GetObjectItem(fn, "path");
-    if (!col)
+    return 0;
+}
+
+/* Writes the "path" and "branch" members of the function object in 'fn'. */
+static void vld_json_branch_info_dump(zend_op_array *opa, vld_branch_info *branch_info, smart_str *fn)
+{
+    unsigned int i;
+    int first;
+    vld_json_col cols[sizeof(branch_cols) / sizeof(branch_cols[0])];
+    vld_json_col paths[2];
+
+    vld_json_branch_cols(opa, branch_info, cols, paths, 0);
+
+    if (VLD_JSON_PATH_COL_USED(2))
     {
-        return 0;
+        vld_json_key(fn, 1, path_cols[2], 0);
+        smart_str_append_unsigned(fn, (zend_ulong) MIN(branch_info->paths_total, (uint64_t) ZEND_LONG_MAX));
     }
-    for (i = 0; i < branch_info->paths_count; i++)
+    if (VLD_JSON_PATH_COL_USED(3))
     {
-        tmp = cJSON_CreateArray();
-        for (j = 0; j < branch_info->paths[i]->elements_count; j++)
+        vld_json_key(fn, 1, path_cols[3], 0);
+        smart_str_appends(fn, branch_info->truncated ? "true" : "false");
+    }
+    for (i = 0; i < 2; i++)
+    {
+        if (VLD_JSON_PATH_COL_USED(i))
         {
-            if (!cJSON_AddNumberToArray(tmp, (double)branch_info->paths[i]->elements[j]))
-            {
-                cJSON_Delet_Wrap(tmp);
-                return 0;
-            }
+            vld_json_col_flush(fn, 1, path_cols[i], 0, &paths[i]);
         }
-        if (!cJSON_AddItemToArray(col, tmp))
+        vld_json_col_free(&paths[i]);
+    }
+
+    if (vld_json_branch_used())
+    {
+        vld_json_key(fn, 1, "branch", 0);
+        vld_json_object_open(fn);
+    }
+    first = 1;
+    for (i = 0; i < VLD_JSON_BRANCH_COLS; i++)
+    {
+        if (VLD_JSON_BRANCH_COL_USED(i))
         {
-            cJSON_Delet_Wrap(tmp);
-            return 0;
+            vld_json_col_flush(fn, 2, branch_cols[i], first, &cols[i]);
+            first = 0;
         }
+        vld_json_col_free(&cols[i]);
+    }
+    if (!first)
+    {
+        vld_json_object_close(fn, 1);
     }
 }
 
-void cJSON_vld_dump_oparray(zend_op_array *opa)
+/* Builds the same record as vld_json_dump_oparray() as a PHP array, and
+ * appends it to the records being collected by vld_inspect_*(). */
+static void vld_json_inspect_oparray(vld_analysis *analysis)
 {
     unsigned int i;
     int j;
-    vld_set *set;
-    vld_branch_info *branch_info;
+    zend_op_array *opa = analysis->opa;
+    vld_set *set = analysis->set;
+    vld_branch_info *branch_info = analysis->branch_info;
     unsigned int base_address = (unsigned int)(zend_intptr_t) & (opa->opcodes[0]);
-    const char *path_cols[] = {"sline", "eline", "sop", "eop", "outs"};
-    cJSON *fn = cJSON_CreateObject();
-    cJSON *tmp;
-
-    set = vld_set_create(opa->last);
-    branch_info = vld_branch_info_create(opa->last);
+    vld_json_dump dump;
+    vld_json_col vars, paths[2];
+    vld_json_col cols[sizeof(branch_cols) / sizeof(branch_cols[0])];
+    zval record, ops, branch;
 
-    if (VLD_G(dump_paths))
+    array_init(&record);
+    if (VLD_G(json_data)->class)
     {
-        vld_analyse_oparray_quiet(opa, set, branch_info);
+        add_assoc_string(&record, "class", VLD_G(json_data)->class);
     }
-
-    if (!((VLD_G(json_data)->class) ? cJSON_AddStringToObjectCS(fn, "class", VLD_G(json_data)->class) : cJSON_AddNullObjectCS(fn, "class")))
+    else
     {
-        cJSON_Delet_Wrap(fn);
-        goto dump;
+        add_assoc_null(&record, "class");
     }
-    if (!(ZSTRING_VALUE(opa->filename) ? cJSON_AddStringToObjectCS(fn, "filename", ZSTRING_VALUE(opa->filename)) : cJSON_AddNullObjectCS(fn, "filename")))
+    if (opa->filename)
     {
-        cJSON_Delet_Wrap(fn);
-        goto dump;
+        add_assoc_str(&record, "filename", zend_string_copy(opa->filename));
     }
-    if (!(ZSTRING_VALUE(opa->function_name) ? cJSON_AddStringToObjectCS(fn, "function name", ZSTRING_VALUE(opa->function_name)) : cJSON_AddNullObjectCS(fn, "function name")))
+    else
     {
-        cJSON_Delet_Wrap(fn);
-        goto dump;
+        add_assoc_null(&record, "filename");
     }
-    if (!cJSON_AddNumberToObjectCS(fn, "number of ops", (double)opa->last))
+    if (opa->function_name)
     {
-        cJSON_Delet_Wrap(fn);
-        goto dump;
+        add_assoc_str(&record, "function name", zend_string_copy(opa->function_name));
     }
-
-    tmp = cJSON_AddArrayToObjectCS(fn, "compiled vars");
-    for (j = 0; j < opa->last_var; j++)
+    else
     {
-        if (!cJSON_AddStringToArray(tmp, OPARRAY_VAR_NAME(opa->vars[j])))
-        {
-            cJSON_Delet_Wrap(fn);
-            goto dump;
-        }
+        add_assoc_null(&record, "function name");
     }
-    /* Pre allocate arrays. */
-    tmp = cJSON_AddObjectToObjectCS(fn, "ops");
-    for (j = 0; j < STR_ARRAY_LEN(op_cols); j++)
+    add_assoc_long(&record, "number of ops", opa->last);
+
+    vld_json_col_init(&vars, 1);
+    for (j = 0; j < opa->last_var; j++)
     {
-        if (VLD_G(verbosity) >= verbosity_flags[j] && !cJSON_AddArrayToObjectCS(tmp, op_cols[j]))
-        {
-            cJSON_Delet_Wrap(fn);
-            goto dump;
-        }
+        vld_json_add_string(&vars.array, OPARRAY_VAR_NAME(opa->vars[j]));
     }
+    vld_json_col_flush_zval(&record, "compiled vars", &vars);
+
+    vld_json_dump_init(&dump, opa, 1);
+
     VLD_G(json_data)->inner_len = 0;
     for (i = 0; i < opa->last; i++)
     {
-        if (!cJSON_vld_dump_op(i, opa->opcodes, base_address, vld_set_in(set, i), vld_set_in(branch_info->entry_points, i), vld_set_in(branch_info->starts, i), vld_set_in(branch_info->ends, i), opa, tmp))
+        vld_json_dump_op(i, opa->opcodes, base_address, vld_set_in(set, i), vld_set_in(branch_info->entry_points, i), vld_set_in(branch_info->starts, i), vld_set_in(branch_info->ends, i), opa, &dump);
+    }
+
+    array_init(&ops);
+    for (j = 0; j < VLD_JSON_OP_COLS; j++)
+    {
+        if (VLD_JSON_OP_COL_USED(j))
         {
-            cJSON_Delet_Wrap(fn);
-            goto dump;
+            vld_json_col_flush_zval(&ops, op_cols[j], &dump.ops[j]);
         }
+        vld_json_col_free(&dump.ops[j]);
     }
-dump:
-    if (VLD_G(dump_paths))
+    add_assoc_zval(&record, "ops", &ops);
+
+    if (analysis->paths)
     {
-        if (fn)
+        vld_json_branch_cols(opa, branch_info, cols, paths, 1);
+
+        if (VLD_JSON_PATH_COL_USED(2))
         {
-            if (!cJSON_AddArrayToObjectCS(fn, "path"))
-            {
-                cJSON_Delet_Wrap(fn);
-                goto only_dump;
-            }
-            tmp = cJSON_AddObjectToObjectCS(fn, "branch");
-            if (!tmp)
-            {
-                cJSON_Delet_Wrap(fn);
-                goto only_dump;
-            }
-            for (j = 0; j < STR_ARRAY_LEN(path_cols); j++)
-            {
-                if (!cJSON_AddArrayToObjectCS(tmp, path_cols[j]))
-                {
-                    cJSON_Delet_Wrap(fn);
-                    break;
-                }
-            }
+            add_assoc_long(&record, path_cols[2], (zend_long) MIN(branch_info->paths_total, (uint64_t) ZEND_LONG_MAX));
         }
-    only_dump:
-        vld_branch_post_process(opa, branch_info);
-        vld_branch_find_paths(branch_info);
-        if (!cJSON_vld_branch_info_dump(opa, branch_info, fn))
+        if (VLD_JSON_PATH_COL_USED(3))
         {
-            cJSON_Delet_Wrap(fn);
+            add_assoc_bool(&record, path_cols[3], branch_info->truncated);
         }
-    }
-    vld_set_free(set);
-    vld_branch_info_free(branch_info);
-    if (fn)
-    {
-        /* Print delimiter before every function block, except the first one. */
-        if (VLD_G(json_data)->outer_len)
+        for (j = 0; j < 2; j++)
         {
-            if (VLD_G(format))
+            if (VLD_JSON_PATH_COL_USED(j))
             {
-                fputs(",\n", stdout);
-            }
-            else
-            {
-                fputs(",", stdout);
+                vld_json_col_flush_zval(&record, path_cols[j], &paths[j]);
             }
+            vld_json_col_free(&paths[j]);
         }
-        char *func;
-        if (VLD_G(format))
+        if (vld_json_branch_used())
         {
-            func = cJSON_Print(fn);
+            array_init(&branch);
         }
-        else
+        for (j = 0; j < VLD_JSON_BRANCH_COLS; j++)
+        {
+            if (VLD_JSON_BRANCH_COL_USED(j))
+            {
+                vld_json_col_flush_zval(&branch, branch_cols[j], &cols[j]);
+            }
+            vld_json_col_free(&cols[j]);
+        }
+        if (vld_json_branch_used())
         {
-            func = cJSON_PrintUnformatted(fn);
+            add_assoc_zval(&record, "branch", &branch);
         }
-        fputs(func, stdout);
-        VLD_G(json_data)->outer_len++;
-        /* Free it every time. */
-        cJSON_Delet_Wrap(fn);
     }
-    return;
+
+    add_next_index_zval(VLD_G(inspect), &record);
 }
 
-void vld_analyse_oparray_quiet(zend_op_array *opa, vld_set *set, vld_branch_info *branch_info)
+void vld_json_dump_oparray(vld_analysis *analysis)
 {
-    unsigned int position = 0;
+    unsigned int i;
+    int j, first;
+    zend_op_array *opa = analysis->opa;
+    vld_set *set = analysis->set;
+    vld_branch_info *branch_info = analysis->branch_info;
+    unsigned int base_address = (unsigned int)(zend_intptr_t) & (opa->opcodes[0]);
+    vld_json_dump dump;
+    vld_json_array vars;
+    smart_str fn;
+    zend_long class_id = -1, filename_id = -1;
+
+    if (VLD_G(inspect))
+    {
+        vld_json_inspect_oparray(analysis);
+        return;
+    }
+
+    /* The ops go first, so that the strings they intern can be written in
+     * front of everything else. */
+    vld_json_dump_init(&dump, opa, 0);
+
+    VLD_G(json_data)->inner_len = 0;
+    for (i = 0; i < opa->last; i++)
+    {
+        vld_json_dump_op(i, opa->opcodes, base_address, vld_set_in(set, i), vld_set_in(branch_info->entry_points, i), vld_set_in(branch_info->starts, i), vld_set_in(branch_info->ends, i), opa, &dump);
+    }
+    if (VLD_JSON_INTERN())
+    {
+        class_id = VLD_G(json_data)->class ? vld_json_intern(VLD_G(json_data)->class, strlen(VLD_G(json_data)->class)) : -1;
+        filename_id = opa->filename ? vld_json_intern(ZSTR_VAL(opa->filename), ZSTR_LEN(opa->filename)) : -1;
+    }
+
+    vld_json_buf_get(&fn);
+
+    vld_json_object_open(&fn);
+    first = !(VLD_JSON_INTERN() && vld_json_strings_flush(&fn));
+    vld_json_key(&fn, 1, "class", first);
+    if (class_id >= 0)
+    {
+        smart_str_append_long(&fn, class_id);
+    }
+    else if (VLD_G(json_data)->class)
+    {
+        vld_json_append_escaped(&fn, VLD_G(json_data)->class, strlen(VLD_G(json_data)->class));
+    }
+    else
+    {
+        smart_str_appendl(&fn, "null", 4);
+    }
+    vld_json_key(&fn, 1, "filename", 0);
+    if (filename_id >= 0)
+    {
+        smart_str_append_long(&fn, filename_id);
+    }
+    else if (opa->filename)
+    {
+        vld_json_append_escaped(&fn, ZSTR_VAL(opa->filename), ZSTR_LEN(opa->filename));
+    }
+    else
+    {
+        smart_str_appendl(&fn, "null", 4);
+    }
+    vld_json_key(&fn, 1, "function name", 0);
+    if (opa->function_name)
+    {
+        vld_json_append_escaped(&fn, ZSTR_VAL(opa->function_name), ZSTR_LEN(opa->function_name));
+    }
+    else
+    {
+        smart_str_appendl(&fn, "null", 4);
+    }
+    vld_json_key(&fn, 1, "number of ops", 0);
+    smart_str_append_unsigned(&fn, opa->last);
+
+    vld_json_key(&fn, 1, "compiled vars", 0);
+    smart_str_appendc(&fn, '[');
+    vld_json_array_init(&vars, &fn);
+    for (j = 0; j < opa->last_var; j++)
+    {
+        vld_json_add_string(&vars, OPARRAY_VAR_NAME(opa->vars[j]));
+    }
+    smart_str_appendc(&fn, ']');
 
-    while (position < opa->last)
+    vld_json_key(&fn, 1, "ops", 0);
+    vld_json_object_open(&fn);
+    first = 1;
+    for (j = 0; j < VLD_JSON_OP_COLS; j++)
     {
-        if (position == 0)
+        if (VLD_JSON_OP_COL_USED(j))
         {
-            vld_analyse_branch_quiet(opa, position, set, branch_info);
-            vld_set_add(branch_info->entry_points, position);
+            vld_json_col_flush(&fn, 2, op_cols[j], first, &dump.ops[j]);
+            first = 0;
         }
-        else if (opa->opcodes[position].opcode == ZEND_CATCH)
+        vld_json_col_free(&dump.ops[j]);
+    }
+    vld_json_object_close(&fn, 1);
+
+    if (analysis->paths)
+    {
+        vld_json_branch_info_dump(opa, branch_info, &fn);
+    }
+    vld_json_object_close(&fn, 0);
+    smart_str_0(&fn);
+
+    if (VLD_G(json_lines))
+    {
+        /* Every record is complete on its own, so make sure it has left the
+         * process before the next function is analysed. */
+        smart_str_appendc(&fn, '\n');
+        vld_output_write(stdout, ZSTR_VAL(fn.s), ZSTR_LEN(fn.s));
+        vld_output_flush();
+    }
+    else
+    {
+        /* Print delimiter before every function block, except the first one.
+         * The one in front of the first block of a cached file depends on
+         * what was written before it, so it is not cached. */
+        if (VLD_G(json_data)->outer_len)
         {
-            vld_analyse_branch_quiet(opa, position, set, branch_info);
-            vld_set_add(branch_info->entry_points, position);
+            vld_json_write_separator(VLD_G(json_data)->outer_len != VLD_G(cache_records));
         }
-        position++;
+        vld_output_write(stdout, ZSTR_VAL(fn.s), ZSTR_LEN(fn.s));
+    }
+    VLD_G(json_data)->outer_len++;
+    vld_json_buf_put(&fn);
+}
+
+/* Writes the delimiter between two function blocks. */
+void vld_json_write_separator(int capture)
+{
+    const char *sep = VLD_JSON_PRETTY() ? ",\n" : ",";
+
+    if (capture)
+    {
+        vld_output_write(stdout, sep, strlen(sep));
+    }
+    else
+    {
+        vld_output_write_raw(stdout, sep, strlen(sep));
+    }
+}
+
+/* Starts the top level array, unless it is already open or line delimited
+ * records are written. Returns whether the array was opened by this call. */
+int vld_json_document_open(void)
+{
+    if (VLD_G(json_lines) || VLD_G(json_data)->opened)
+    {
+        return 0;
+    }
+    if (VLD_G(format))
+    {
+        vld_output_write_raw(stdout, "[\n", 2);
+    }
+    else
+    {
+        vld_output_write_raw(stdout, "[", 1);
     }
-    vld_set_add(branch_info->ends, opa->last - 1);
-    branch_info->branches[opa->last - 1].start_lineno = opa->opcodes[opa->last - 1].lineno;
+    VLD_G(json_data)->opened = 1;
+    VLD_G(json_data)->outer_len = 0;
+    /* Every document has a dictionary of its own */
+    vld_json_strings_reset();
+    return 1;
 }
 
-void vld_analyse_branch_quiet(zend_op_array *opa, unsigned int position, vld_set *set, vld_branch_info *branch_info)
+void vld_json_document_close(void)
 {
-    vld_set_add(branch_info->starts, position);
-    branch_info->branches[position].start_lineno = opa->opcodes[position].lineno;
-    /* First we see if the branch has been visited, if so we bail out. */
-    if (vld_set_in(set, position))
+    if (!VLD_G(json_data)->opened)
     {
         return;
     }
-    /* Loop over the opcodes until the end of the array, or until a jump point has been found */
-    vld_set_add(set, position);
-    while (position < opa->last)
+    vld_output_write_raw(stdout, "]\n", 2);
+    vld_output_flush();
+    VLD_G(json_data)->opened = 0;
+}
+
+/* Starts a new document, with a dictionary of its own, for the output of one
+ * file of vld.save_per_file. The current document is kept in 'saved'. */
+void vld_json_document_push(vld_json_document *saved)
+{
+    json_wrap *json_data = VLD_G(json_data);
+
+    saved->outer_len = json_data->outer_len;
+    saved->opened = json_data->opened;
+    saved->strings = json_data->strings;
+    saved->strings_first = json_data->strings_first;
+    saved->strings_new = json_data->strings_new;
+
+    json_data->outer_len = 0;
+    json_data->opened = 0;
+    json_data->strings = NULL;
+    json_data->strings_first = 0;
+    memset(&json_data->strings_new, 0, sizeof(smart_str));
+    if (VLD_G(dump_json))
     {
-        size_t jump_count = 0;
-        int jumps[VLD_BRANCH_MAX_OUTS];
-        size_t i;
-        /* See if we have a jump instruction */
-        if (vld_find_jumps(opa, position, &jump_count, jumps))
-        {
-            for (i = 0; i < jump_count; i++)
-            {
-                if (jumps[i] == VLD_JMP_EXIT || jumps[i] >= 0)
-                {
-                    vld_branch_info_update(branch_info, position, opa->opcodes[position].lineno, i, jumps[i]);
-                    if (jumps[i] != VLD_JMP_EXIT)
-                    {
-                        vld_analyse_branch_quiet(opa, jumps[i], set, branch_info);
-                    }
-                }
-            }
-            break;
-        }
-        /* See if we have a throw instruction */
-        if (opa->opcodes[position].opcode == ZEND_THROW)
-        {
-            vld_set_add(branch_info->ends, position);
-            branch_info->branches[position].start_lineno = opa->opcodes[position].lineno;
-            break;
-        }
-        /* See if we have an exit instruction */
-        if (opa->opcodes[position].opcode == ZEND_EXIT)
-        {
-            vld_set_add(branch_info->ends, position);
-            branch_info->branches[position].start_lineno = opa->opcodes[position].lineno;
-            break;
-        }
-        /* See if we have a return instruction */
-        if (
-            opa->opcodes[position].opcode == ZEND_RETURN || opa->opcodes[position].opcode == ZEND_RETURN_BY_REF)
-        {
-            vld_set_add(branch_info->ends, position);
-            branch_info->branches[position].start_lineno = opa->opcodes[position].lineno;
-            break;
-        }
-        position++;
-        vld_set_add(set, position);
+        vld_json_document_open();
     }
 }
 
+/* Finishes the document of vld_json_document_push(), and continues with the
+ * one in 'saved'. */
+void vld_json_document_pop(vld_json_document *saved)
+{
+    json_wrap *json_data = VLD_G(json_data);
+
+    vld_json_document_close();
+    vld_json_strings_reset();
+
+    json_data->outer_len = saved->outer_len;
+    json_data->opened = saved->opened;
+    json_data->strings = saved->strings;
+    json_data->strings_first = saved->strings_first;
+    json_data->strings_new = saved->strings_new;
+}
+
 json_wrap *json_patch_init(void)
 {
-    cJSON_InitHooks(NULL);
     json_wrap *res = (json_wrap *)calloc(1, sizeof(json_wrap));
     if (!res)
     {
@@ -1303,10 +1599,10 @@ json_wrap *json_patch_init(void)
     return res;
 }
 
-void json_patch_free(void)
+void json_patch_free(json_wrap *json_data)
 {
-    if (VLD_G(json_data))
+    if (json_data)
     {
-        free(VLD_G(json_data));
+        free(json_data);
     }
-}
\ No newline at end of file
+}
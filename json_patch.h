@@ -13,18 +13,60 @@
 #ifndef JSON_PATCH_H
 #define JSON_PATCH_H
 
-#include "cJSON.h"
+#include "zend_smart_str.h"
+
+/* Number of emptied text buffers kept between two function dumps. */
+#define VLD_JSON_POOL_SIZE 32
 
 typedef struct _json_wrap
 {
-    cJSON *date; /* Reserved field for future development. */
     unsigned int inner_len;
     unsigned int outer_len;
+    int opened; /* Whether the top level array has been started. */
     char *class;
+    smart_str pool[VLD_JSON_POOL_SIZE]; /* See vld_json_buf_get(). */
+    unsigned int pool_count;
+    HashTable *strings;        /* Interned strings and their ids, see vld_json_intern(). */
+    unsigned int strings_first; /* Id of the first string not written yet. */
+    smart_str strings_new;      /* Those strings, as JSON array elements. */
 } json_wrap;
 
+/* The state of a JSON document that is put aside while the output of a
+ * single file is written as a document of its own. */
+typedef struct _vld_json_document
+{
+    unsigned int outer_len;
+    int opened;
+    HashTable *strings;
+    unsigned int strings_first;
+    smart_str strings_new;
+} vld_json_document;
+
+/* A JSON array that is written straight into a text buffer. Every column of
+ * the "ops" and "branch" objects is one of these, nested arrays share the
+ * buffer of their parent column. When 'zv' is set, the elements are added to
+ * that PHP array instead. */
+typedef struct _vld_json_array
+{
+    smart_str *buf;
+    zval *zv;
+    unsigned int count;
+} vld_json_array;
+
+struct _vld_analysis;
+
 json_wrap *json_patch_init(void);
-void json_patch_free(void);
-void cJSON_vld_dump_oparray(zend_op_array *opa);
+void json_patch_free(json_wrap *json_data);
+int vld_json_document_open(void);
+void vld_json_document_close(void);
+void vld_json_document_push(vld_json_document *saved);
+void vld_json_document_pop(vld_json_document *saved);
+void vld_json_write_separator(int capture);
+void vld_json_pool_clear(void);
+void vld_json_strings_reset(void);
+int vld_json_fields_parse(const char *fields);
+void vld_json_dump_oparray(struct _vld_analysis *analysis);
+unsigned int vld_json_op_types(const zend_op *op, unsigned int base_address, unsigned int *res_type, unsigned int *op1_type, unsigned int *op2_type);
+const char *vld_json_fetch_type(const zend_op *op, unsigned int flags);
 
-#endif /*JSON_PATCH_H*/
\ No newline at end of file
+#endif /*JSON_PATCH_H*/
@@ -0,0 +1,524 @@
+/*
+   +----------------------------------------------------------------------+
+   | Copyright (c) 1997-2019 Derick Rethans                               |
+   +----------------------------------------------------------------------+
+   | This source file is subject to the 2-Clause BSD license which is     |
+   | available through the LICENSE file, or online at                     |
+   | http://opensource.org/licenses/bsd-license.php                       |
+   +----------------------------------------------------------------------+
+   | Authors:  Derick Rethans <derick@derickrethans.nl>                   |
+   +----------------------------------------------------------------------+
+ */
+
+/* All dump output ends up here. It is collected in a user space buffer per
+ * sink and only written out when the buffer is full or at the points where
+ * a dump is complete: after every compiled file, after every record of
+ * vld.json_lines, and at the end of the request. With vld.output set, both
+ * channels share one sink, so the op listing and the branches that follow
+ * it stay in the order they were produced.
+ *
+ * With vld.output_compression, a sink compresses what it writes out. Every
+ * flush ends a compressed frame (a gzip member or a zstd frame). Both
+ * formats allow frames to be concatenated, so the output still decompresses
+ * as a whole, while every compiled file and every record of vld.json_lines
+ * can also be decompressed on its own.
+ *
+ * With vld.save_per_file, the dump of every compiled file gets a sink of its
+ * own, see vld_output_file_begin(). */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "php.h"
+#include "php_vld.h"
+#include "cache.h"
+#include "output.h"
+
+#ifndef PHP_WIN32
+# include <unistd.h>
+#else
+# include <process.h>
+# define getpid _getpid
+#endif
+
+#ifdef HAVE_VLD_ZLIB
+# include <zlib.h>
+#endif
+#ifdef HAVE_VLD_ZSTD
+# include <zstd.h>
+#endif
+
+ZEND_EXTERN_MODULE_GLOBALS(vld)
+
+/* Maps the value of vld.output_compression to VLD_COMPRESS_*. Returns -1
+ * for an unknown name, or one that this build can not compress with. */
+int vld_output_compression_parse(const char *name)
+{
+	if (!name[0] || strcasecmp(name, "none") == 0) {
+		return VLD_COMPRESS_NONE;
+	}
+#ifdef HAVE_VLD_ZLIB
+	if (strcasecmp(name, "gzip") == 0) {
+		return VLD_COMPRESS_GZIP;
+	}
+#endif
+#ifdef HAVE_VLD_ZSTD
+	if (strcasecmp(name, "zstd") == 0) {
+		return VLD_COMPRESS_ZSTD;
+	}
+#endif
+	return -1;
+}
+
+/* Gives 'sink' its buffer, and sets up the compressor. A level of 0 picks
+ * the default of the library. */
+static void vld_sink_init(vld_sink *sink)
+{
+	zend_long level = VLD_G(output_compression_level);
+
+	/* Without a buffer, everything is written through */
+	sink->buf = malloc(VLD_OUTPUT_BUFFER_SIZE);
+	sink->codec = VLD_G(output_codec);
+	sink->frame = 0;
+
+	switch (sink->codec) {
+#ifdef HAVE_VLD_ZLIB
+		case VLD_COMPRESS_GZIP: {
+			z_stream *z = calloc(1, sizeof(z_stream));
+
+			if (level <= 0) {
+				level = Z_DEFAULT_COMPRESSION;
+			} else if (level > 9) {
+				level = 9;
+			}
+			/* 16 more window bits ask for a gzip header and trailer */
+			if (z && deflateInit2(z, (int) level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+				free(z);
+				z = NULL;
+			}
+			sink->stream = z;
+			break;
+		}
+#endif
+#ifdef HAVE_VLD_ZSTD
+		case VLD_COMPRESS_ZSTD:
+			sink->stream = ZSTD_createCCtx();
+			if (sink->stream && level) {
+				/* zstd clamps the level to the range it supports */
+				ZSTD_CCtx_setParameter(sink->stream, ZSTD_c_compressionLevel, (int) level);
+			}
+			break;
+#endif
+	}
+
+	if (sink->codec != VLD_COMPRESS_NONE) {
+		sink->out = malloc(VLD_OUTPUT_BUFFER_SIZE);
+		if (!sink->stream || !sink->out) {
+			php_error_docref(NULL, E_WARNING, "Can not set up output compression, writing uncompressed output");
+			free(sink->out);
+			sink->out = NULL;
+			sink->codec = VLD_COMPRESS_NONE;
+		}
+	}
+}
+
+/* Writes 'len' bytes to the file of 'sink', compressing them on the way.
+ * With 'end' set, the current compressed frame is finished as well. */
+static void vld_sink_put(vld_sink *sink, const char *buf, size_t len, int end)
+{
+	if (sink->codec == VLD_COMPRESS_NONE) {
+		if (len) {
+			fwrite(buf, 1, len, sink->fp);
+		}
+		return;
+	}
+	/* Do not write empty frames */
+	if (!len && (!end || !sink->frame)) {
+		return;
+	}
+	sink->frame += len;
+
+	switch (sink->codec) {
+#ifdef HAVE_VLD_ZLIB
+		case VLD_COMPRESS_GZIP: {
+			z_stream *z = sink->stream;
+
+			z->next_in = (Bytef *) buf;
+			z->avail_in = (uInt) len;
+			do {
+				z->next_out = (Bytef *) sink->out;
+				z->avail_out = VLD_OUTPUT_BUFFER_SIZE;
+				deflate(z, end ? Z_FINISH : Z_NO_FLUSH);
+				fwrite(sink->out, 1, VLD_OUTPUT_BUFFER_SIZE - z->avail_out, sink->fp);
+			} while (z->avail_out == 0);
+			if (end) {
+				deflateReset(z);
+			}
+			break;
+		}
+#endif
+#ifdef HAVE_VLD_ZSTD
+		case VLD_COMPRESS_ZSTD: {
+			ZSTD_inBuffer  in = { buf, len, 0 };
+			ZSTD_outBuffer out;
+			size_t         left;
+
+			do {
+				out.dst = sink->out;
+				out.size = VLD_OUTPUT_BUFFER_SIZE;
+				out.pos = 0;
+				left = ZSTD_compressStream2(sink->stream, &out, &in, end ? ZSTD_e_end : ZSTD_e_continue);
+				if (ZSTD_isError(left)) {
+					break;
+				}
+				fwrite(sink->out, 1, out.pos, sink->fp);
+			} while (end ? left != 0 : in.pos < in.size);
+			break;
+		}
+#endif
+	}
+	if (end) {
+		sink->frame = 0;
+	}
+}
+
+/* Releases the compressor of 'sink' */
+static void vld_sink_free(vld_sink *sink)
+{
+	switch (sink->codec) {
+#ifdef HAVE_VLD_ZLIB
+		case VLD_COMPRESS_GZIP:
+			deflateEnd(sink->stream);
+			free(sink->stream);
+			break;
+#endif
+#ifdef HAVE_VLD_ZSTD
+		case VLD_COMPRESS_ZSTD:
+			ZSTD_freeCCtx(sink->stream);
+			break;
+#endif
+	}
+	free(sink->out);
+	free(sink->buf);
+}
+
+/* Decides where 'channel' goes, the first time something is written to it */
+static vld_sink *vld_output_open(int channel)
+{
+	const char *target = VLD_G(output);
+	vld_sink   *sink;
+
+	if (!target || !target[0]) {
+		sink = &VLD_G(output_sinks)[channel];
+		sink->fp = (channel == VLD_OUTPUT_ERR) ? stderr : stdout;
+	} else {
+		sink = &VLD_G(output_sinks)[VLD_OUTPUT_OUT];
+		if (!sink->fp) {
+			if (strcmp(target, "stdout") == 0) {
+				sink->fp = stdout;
+			} else if (strcmp(target, "stderr") == 0) {
+				sink->fp = stderr;
+			} else if ((sink->fp = fopen(target, "ab")) != NULL) {
+				sink->owned = 1;
+			} else {
+				php_error_docref(NULL, E_WARNING, "Can not open '%s' for writing", target);
+				sink->fp = stderr;
+			}
+		}
+	}
+	if (!sink->buf) {
+		vld_sink_init(sink);
+	}
+
+	VLD_G(output_channels)[channel] = sink;
+	return sink;
+}
+
+static void vld_sink_flush(vld_sink *sink)
+{
+	if (!sink->fp) {
+		return;
+	}
+	vld_sink_put(sink, sink->buf, sink->len, 1);
+	sink->len = 0;
+	fflush(sink->fp);
+}
+
+/* The suffix of the dump files of vld.save_per_file */
+const char *vld_output_suffix(void)
+{
+	switch (VLD_G(output_codec)) {
+		case VLD_COMPRESS_GZIP:
+			return ".vld.gz";
+		case VLD_COMPRESS_ZSTD:
+			return ".vld.zst";
+	}
+	return ".vld";
+}
+
+/* Creates the missing directories on the way to 'path' */
+static void vld_save_mkdirs(char *path)
+{
+	char *p;
+
+	for (p = path + 1; *p; p++) {
+		if (IS_SLASH(*p)) {
+			*p = '\0';
+			/* Directories that exist already, or that another process just
+			 * created, make this fail, which is fine */
+			VCWD_MKDIR(path, 0777);
+			*p = DEFAULT_SLASH;
+		}
+	}
+}
+
+/* Opens the file that the output for 'source' goes into: 'source' below
+ * vld.save_dir with 'suffix' appended, so that the directory tree of the
+ * sources is mirrored. Directories are only created when they are needed. */
+int vld_save_file_open(vld_save_file *file, const char *source, const char *suffix)
+{
+	smart_str  path = {0};
+	const char *p = source, *end;
+
+	smart_str_appends(&path, VLD_G(save_dir));
+	while (*p) {
+		while (IS_SLASH(*p)) {
+			p++;
+		}
+		for (end = p; *end && !IS_SLASH(*end); end++);
+		if (end == p) {
+			break;
+		}
+		smart_str_appendc(&path, DEFAULT_SLASH);
+		if (end - p == 2 && p[0] == '.' && p[1] == '.') {
+			/* Stay below vld.save_dir */
+			smart_str_appendl(&path, "__", 2);
+		} else {
+			for (; p < end; p++) {
+				/* The colon after a drive letter */
+				smart_str_appendc(&path, *p == ':' ? '_' : *p);
+			}
+		}
+		p = end;
+	}
+	smart_str_appends(&path, suffix);
+	smart_str_0(&path);
+
+	file->path = estrndup(ZSTR_VAL(path.s), ZSTR_LEN(path.s));
+	smart_str_free(&path);
+	/* Threads of one process share the pid, so tell them apart as well */
+#ifdef ZTS
+	spprintf(&file->tmp_path, 0, "%s.%d.%lu.tmp", file->path, (int) getpid(), (unsigned long) tsrm_thread_id());
+#else
+	spprintf(&file->tmp_path, 0, "%s.%d.tmp", file->path, (int) getpid());
+#endif
+
+	if ((file->fp = fopen(file->tmp_path, "wb")) == NULL && errno == ENOENT) {
+		vld_save_mkdirs(file->tmp_path);
+		file->fp = fopen(file->tmp_path, "wb");
+	}
+	if (!file->fp) {
+		php_error_docref(NULL, E_WARNING, "Can not open '%s' for writing", file->tmp_path);
+		efree(file->tmp_path);
+		efree(file->path);
+		memset(file, 0, sizeof(vld_save_file));
+		return 0;
+	}
+	return 1;
+}
+
+/* Closes 'file', and puts it in place when 'keep' is set. Readers either
+ * see the previous version of the file or the complete new one. */
+void vld_save_file_close(vld_save_file *file, int keep)
+{
+	if (!file->fp) {
+		return;
+	}
+	if (fclose(file->fp) != 0) {
+		keep = 0;
+	}
+	if (!keep || VCWD_RENAME(file->tmp_path, file->path) != 0) {
+		VCWD_UNLINK(file->tmp_path);
+	}
+	efree(file->tmp_path);
+	efree(file->path);
+	memset(file, 0, sizeof(vld_save_file));
+}
+
+/* Writes to the sink of 'stream' without capturing it for the cache */
+void vld_output_write_raw(FILE *stream, const char *buf, size_t len)
+{
+	int       channel = (stream == stderr) ? VLD_OUTPUT_ERR : VLD_OUTPUT_OUT;
+	vld_sink *sink = VLD_G(output_channels)[channel];
+
+	if (!sink) {
+		sink = vld_output_open(channel);
+	}
+
+	if (!sink->buf || len > VLD_OUTPUT_BUFFER_SIZE - sink->len) {
+		if (sink->len) {
+			vld_sink_put(sink, sink->buf, sink->len, 0);
+			sink->len = 0;
+		}
+		if (!sink->buf || len >= VLD_OUTPUT_BUFFER_SIZE) {
+			vld_sink_put(sink, buf, len, 0);
+			return;
+		}
+	}
+	memcpy(sink->buf + sink->len, buf, len);
+	sink->len += len;
+}
+
+/* All dump output goes through here, so that it can be captured for the
+ * result cache */
+void vld_output_write(FILE *stream, const char *buf, size_t len)
+{
+	vld_output_write_raw(stream, buf, len);
+	vld_cache_capture(stream, buf, len);
+}
+
+/* Writes out everything that is buffered. The op listing goes first, as it
+ * comes before the branches of the same function. */
+void vld_output_flush(void)
+{
+	vld_sink_flush(&VLD_G(output_sinks)[VLD_OUTPUT_ERR]);
+	vld_sink_flush(&VLD_G(output_sinks)[VLD_OUTPUT_OUT]);
+	vld_sink_flush(&VLD_G(output_file_sink));
+}
+
+/* Sends both channels to 'fp' until vld_output_file_end(), for the dump of
+ * one file with vld.save_per_file */
+void vld_output_file_begin(FILE *fp)
+{
+	vld_sink *sink = &VLD_G(output_file_sink);
+
+	vld_output_flush();
+
+	vld_sink_init(sink);
+	sink->fp = fp;
+	VLD_G(output_saved)[VLD_OUTPUT_OUT] = VLD_G(output_channels)[VLD_OUTPUT_OUT];
+	VLD_G(output_saved)[VLD_OUTPUT_ERR] = VLD_G(output_channels)[VLD_OUTPUT_ERR];
+	VLD_G(output_channels)[VLD_OUTPUT_OUT] = sink;
+	VLD_G(output_channels)[VLD_OUTPUT_ERR] = sink;
+}
+
+/* Writes out what is left for the file, and goes back to the channels that
+ * were used before. The file itself belongs to the caller. */
+void vld_output_file_end(void)
+{
+	vld_sink *sink = &VLD_G(output_file_sink);
+
+	vld_sink_flush(sink);
+	vld_sink_free(sink);
+	memset(sink, 0, sizeof(vld_sink));
+	VLD_G(output_channels)[VLD_OUTPUT_OUT] = VLD_G(output_saved)[VLD_OUTPUT_OUT];
+	VLD_G(output_channels)[VLD_OUTPUT_ERR] = VLD_G(output_saved)[VLD_OUTPUT_ERR];
+}
+
+/* Sends both channels to 'fp' from now on, for the workers of
+ * vld_scan_files(). The file of vld.output is left alone, as it belongs to
+ * the parent. */
+void vld_output_use(FILE *fp)
+{
+	vld_output_flush();
+
+	VLD_G(output_sinks)[VLD_OUTPUT_OUT].fp = fp;
+	VLD_G(output_sinks)[VLD_OUTPUT_OUT].owned = 0;
+	VLD_G(output_sinks)[VLD_OUTPUT_ERR].fp = NULL;
+	VLD_G(output_channels)[VLD_OUTPUT_OUT] = &VLD_G(output_sinks)[VLD_OUTPUT_OUT];
+	VLD_G(output_channels)[VLD_OUTPUT_ERR] = &VLD_G(output_sinks)[VLD_OUTPUT_OUT];
+	if (!VLD_G(output_sinks)[VLD_OUTPUT_OUT].buf) {
+		vld_sink_init(&VLD_G(output_sinks)[VLD_OUTPUT_OUT]);
+	}
+}
+
+/* Flushes and releases the sinks at the end of the request */
+void vld_output_close(void)
+{
+	int i;
+
+	vld_output_flush();
+	for (i = 0; i < 2; i++) {
+		vld_sink *sink = &VLD_G(output_sinks)[i];
+
+		if (sink->owned) {
+			fclose(sink->fp);
+		}
+		vld_sink_free(sink);
+		memset(sink, 0, sizeof(vld_sink));
+		VLD_G(output_channels)[i] = NULL;
+	}
+}
+
+/* Formats into a buffer on the stack, and only allocates for long messages.
+ * Both go through PHP's formatter, so that INF, NAN and NULL strings come out
+ * the same whatever the length. */
+static int vld_output_vformat(char *small, size_t small_len, char **message, const char *fmt, va_list args)
+{
+	va_list copy;
+	int     len;
+
+	va_copy(copy, args);
+	len = ap_php_vsnprintf(small, small_len, fmt, copy);
+	va_end(copy);
+
+	if (len >= 0 && (size_t) len < small_len) {
+		*message = small;
+		return len;
+	}
+	return vspprintf(message, 0, fmt, args);
+}
+
+int vld_printf(FILE *stream, const char* fmt, ...)
+{
+	char small[256];
+	char *message;
+	int len;
+	va_list args;
+	int i = 0, j;
+	const char EOL='\n';
+
+	va_start(args, fmt);
+	len = vld_output_vformat(small, sizeof(small), &message, fmt, args);
+	va_end(args);
+	if (VLD_G(format)) {
+		for (j = 0; j < len; j++) {
+			if (!isspace(message[j]) || message[j] == EOL) {
+				message[i++] = message[j];
+			}
+		}
+		message[i] = 0;
+
+		vld_output_write(stream, VLD_G(col_sep), strlen(VLD_G(col_sep)));
+		vld_output_write(stream, message, i);
+	} else {
+		vld_output_write(stream, message, len);
+	}
+
+	if (message != small) {
+		efree(message);
+	}
+
+	return len;
+}
+
+/* Like vld_printf(), but writes the message as-is */
+int vld_output_printf(FILE *stream, const char* fmt, ...)
+{
+	char small[256];
+	char *message;
+	int len;
+	va_list args;
+
+	va_start(args, fmt);
+	len = vld_output_vformat(small, sizeof(small), &message, fmt, args);
+	va_end(args);
+
+	vld_output_write(stream, message, len);
+	if (message != small) {
+		efree(message);
+	}
+
+	return len;
+}
@@ -0,0 +1,62 @@
+/*
+   +----------------------------------------------------------------------+
+   | Copyright (c) 1997-2019 Derick Rethans                               |
+   +----------------------------------------------------------------------+
+   | This source file is subject to the 2-Clause BSD license which is     |
+   | available through the LICENSE file, or online at                     |
+   | http://opensource.org/licenses/bsd-license.php                       |
+   +----------------------------------------------------------------------+
+   | Authors:  Derick Rethans <derick@derickrethans.nl>                   |
+   +----------------------------------------------------------------------+
+ */
+
+#ifndef __OUTPUT_H__
+#define __OUTPUT_H__
+
+#include <stdio.h>
+
+/* The dumpers write to stdout (branches, paths and JSON) or stderr (the op
+ * listing). Each of those is a channel, and each channel writes into a sink
+ * that buffers the output and hands it to its FILE in large pieces. */
+#define VLD_OUTPUT_OUT 0
+#define VLD_OUTPUT_ERR 1
+
+#define VLD_OUTPUT_BUFFER_SIZE (64 * 1024)
+
+/* vld.output_compression */
+#define VLD_COMPRESS_NONE 0
+#define VLD_COMPRESS_GZIP 1
+#define VLD_COMPRESS_ZSTD 2
+
+typedef struct _vld_sink {
+	FILE   *fp;
+	int     owned; /* Whether fp was opened for vld.output */
+	char   *buf;
+	size_t  len;
+	int     codec;  /* VLD_COMPRESS_* */
+	void   *stream; /* State of the compressor */
+	char   *out;    /* Compressed data on its way to fp */
+	size_t  frame;  /* Bytes that went into the current compressed frame */
+} vld_sink;
+
+/* A file of vld.save_per_file. It is written under a temporary name, and
+ * only renamed to 'path' once it is complete. */
+typedef struct _vld_save_file {
+	char *path;
+	char *tmp_path;
+	FILE *fp;
+} vld_save_file;
+
+int vld_output_compression_parse(const char *name);
+const char *vld_output_suffix(void);
+int vld_save_file_open(vld_save_file *file, const char *source, const char *suffix);
+void vld_save_file_close(vld_save_file *file, int keep);
+void vld_output_file_begin(FILE *fp);
+void vld_output_file_end(void);
+
+void vld_output_write_raw(FILE *stream, const char *buf, size_t len);
+void vld_output_flush(void);
+void vld_output_use(FILE *fp);
+void vld_output_close(void);
+
+#endif
@@ -16,6 +16,8 @@
 
 #include "php.h"
 #include "json_patch.h"
+#include "output.h"
+#include "symbols.h"
 
 extern zend_module_entry vld_module_entry;
 #define phpext_vld_ptr &vld_module_entry
@@ -47,18 +49,73 @@ ZEND_BEGIN_MODULE_GLOBALS(vld)
 	int save_paths;
 	char *save_dir;
 	FILE *path_dump_file;
+	int save_per_file;
+	vld_save_file save_files[2];
+	FILE *save_outer_dot;
+	vld_json_document save_json;
 	int dump_paths;
+	zend_long path_mode;
+	zend_long path_limit;
+	zend_long path_time_limit;
+	zend_long path_budget;
+	uint64_t path_budget_used;
 	int dump_json;
+	int json_lines;
+	int json_intern;
+	char *json_fields;
+	int json_fields_mask;
+	char *formats;
+	int formats_mask;
 	json_wrap *json_data;
+	struct _vld_arena *arena;
+	char *output;
+	char *output_compression;
+	int output_codec;
+	zend_long output_compression_level;
+	vld_sink output_sinks[2];
+	vld_sink *output_channels[2];
+	vld_sink output_file_sink;
+	vld_sink *output_saved[2];
+	HashTable symbols_seen;
+	zend_long symbols_generation;
+	vld_table_mark function_mark;
+	vld_table_mark class_mark;
+	vld_table_mark generation_function_mark;
+	vld_table_mark generation_class_mark;
+	zend_ulong *generation_ids;
+	uint32_t generation_ids_count;
+	char *cache_dir;
+	char *cache_key;
+	unsigned int cache_records;
+	int cache_discard;
+	smart_str cache_out;
+	smart_str cache_err;
+	zval *inspect;
+	int profile;
+	HashTable profile_hits;
+	const zend_op *profile_last_opcodes;
+	zend_ulong *profile_last_hits;
+	struct _vld_profile_unit *profile_units;
+	uint32_t profile_units_count;
+	int coverage;
+	HashTable coverage_info;
+	struct _vld_coverage_frame *coverage_stack;
+	uint32_t coverage_stack_top;
+	uint32_t coverage_stack_size;
 ZEND_END_MODULE_GLOBALS(vld) 
 
 int vld_printf(FILE *stream, const char* fmt, ...);
+int vld_output_printf(FILE *stream, const char* fmt, ...);
+void vld_output_write(FILE *stream, const char *buf, size_t len);
 
-#ifdef ZTS
-#define VLD_G(v) TSRMG(vld_globals_id, zend_vld_globals *, v)
-#else
-#define VLD_G(v) (vld_globals.v)
+#define VLD_G(v) ZEND_MODULE_GLOBALS_ACCESSOR(vld, v)
+
+#if defined(ZTS) && defined(COMPILE_DL_VLD)
+ZEND_TSRMLS_CACHE_EXTERN()
 #endif
+/* Whether dumps wait for the end of the request, for run time information */
+#define VLD_RUNTIME() (VLD_G(profile) || VLD_G(coverage))
+
 #define VLD_PRINT(v,args) if (VLD_G(verbosity) >= (v)) { vld_printf(stderr, args); }
 #define VLD_PRINT1(v,args,x) if (VLD_G(verbosity) >= (v)) { vld_printf(stderr, args, (x)); }
 #define VLD_PRINT2(v,args,x,y) if (VLD_G(verbosity) >= (v)) { vld_printf(stderr, args, (x), (y)); }
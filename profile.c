@@ -0,0 +1,152 @@
+/*
+   +----------------------------------------------------------------------+
+   | Copyright (c) 1997-2019 Derick Rethans                               |
+   +----------------------------------------------------------------------+
+   | This source file is subject to the 2-Clause BSD license which is     |
+   | available through the LICENSE file, or online at                     |
+   | http://opensource.org/licenses/bsd-license.php                       |
+   +----------------------------------------------------------------------+
+   | Authors:  Derick Rethans <derick@derickrethans.nl>                   |
+   +----------------------------------------------------------------------+
+ */
+
+/* Counts how often every opline is executed. A user opcode handler is
+ * installed for every opcode; it bumps the counter of the opline and then
+ * hands over to the handler that was installed before, or to the engine.
+ * The counters of an op_array are kept in one array, found through the
+ * address of its opcodes. The same handler feeds vld.coverage. */
+
+#include "php.h"
+#include "zend_vm.h"
+#include "profile.h"
+#include "coverage.h"
+
+ZEND_EXTERN_MODULE_GLOBALS(vld)
+
+static user_opcode_handler_t vld_profile_old_handlers[256];
+
+static int vld_profile_handler(zend_execute_data *execute_data)
+{
+	const zend_op *opline   = EX(opline);
+	zend_op_array *op_array = &EX(func)->op_array;
+	zend_ulong    *hits;
+
+	if (VLD_G(coverage)) {
+		vld_coverage_record(execute_data);
+	}
+	if (!VLD_G(profile)) {
+		goto chain;
+	}
+
+	if (op_array->opcodes != VLD_G(profile_last_opcodes)) {
+		hits = zend_hash_index_find_ptr(&VLD_G(profile_hits), (zend_ulong) (zend_uintptr_t) op_array->opcodes);
+		if (!hits) {
+			hits = ecalloc(op_array->last, sizeof(zend_ulong));
+			zend_hash_index_add_ptr(&VLD_G(profile_hits), (zend_ulong) (zend_uintptr_t) op_array->opcodes, hits);
+		}
+		VLD_G(profile_last_opcodes) = op_array->opcodes;
+		VLD_G(profile_last_hits)    = hits;
+	}
+	VLD_G(profile_last_hits)[opline - op_array->opcodes]++;
+
+chain:
+	if (vld_profile_old_handlers[opline->opcode]) {
+		return vld_profile_old_handlers[opline->opcode](execute_data);
+	}
+	return ZEND_USER_OPCODE_DISPATCH;
+}
+
+/* The handlers have to be in place before anything is compiled, as the
+ * engine picks the handler of an opline when it is compiled. */
+void vld_profile_minit(void)
+{
+	int i;
+
+	for (i = 0; i <= ZEND_VM_LAST_OPCODE; i++) {
+		vld_profile_old_handlers[i] = zend_get_user_opcode_handler(i);
+		zend_set_user_opcode_handler(i, vld_profile_handler);
+	}
+}
+
+void vld_profile_mshutdown(void)
+{
+	int i;
+
+	for (i = 0; i <= ZEND_VM_LAST_OPCODE; i++) {
+		zend_set_user_opcode_handler(i, vld_profile_old_handlers[i]);
+	}
+}
+
+static void vld_profile_hits_dtor(zval *zv)
+{
+	efree(Z_PTR_P(zv));
+}
+
+void vld_profile_rinit(void)
+{
+	zend_hash_init(&VLD_G(profile_hits), 32, NULL, vld_profile_hits_dtor, 0);
+	VLD_G(profile_last_opcodes) = NULL;
+	VLD_G(profile_last_hits)    = NULL;
+	VLD_G(profile_units)        = NULL;
+	VLD_G(profile_units_count)  = 0;
+}
+
+/* Releases the postponed files, which have been dumped by now */
+void vld_profile_rshutdown(void)
+{
+	uint32_t i;
+
+	for (i = 0; i < VLD_G(profile_units_count); i++) {
+		destroy_op_array(&VLD_G(profile_units)[i].op_array);
+		vld_symbols_free(&VLD_G(profile_units)[i].symbols);
+	}
+	if (VLD_G(profile_units)) {
+		efree(VLD_G(profile_units));
+		VLD_G(profile_units) = NULL;
+	}
+	VLD_G(profile_units_count) = 0;
+
+	zend_hash_destroy(&VLD_G(profile_hits));
+	VLD_G(profile_last_opcodes) = NULL;
+	VLD_G(profile_last_hits)    = NULL;
+}
+
+/* {{{ void vld_profile_defer (op_array)
+ *    Postpones the dump of a compiled file. The engine destroys the main
+ *    op_array once the file has run, so a reference to it is taken and a
+ *    copy of the struct is kept. */
+void vld_profile_defer(zend_op_array *op_array)
+{
+	vld_profile_unit *unit;
+
+	VLD_G(profile_units) = safe_erealloc(VLD_G(profile_units), VLD_G(profile_units_count) + 1, sizeof(vld_profile_unit), 0);
+	unit = &VLD_G(profile_units)[VLD_G(profile_units_count)++];
+
+	memcpy(&unit->op_array, op_array, sizeof(zend_op_array));
+	if (op_array->refcount) {
+		(*op_array->refcount)++;
+	}
+	/* The run time cache and static variables are released together with
+	 * the original, before the reference count is looked at */
+	unit->op_array.static_variables = NULL;
+#if PHP_VERSION_ID >= 70400
+	unit->op_array.fn_flags &= ~ZEND_ACC_HEAP_RT_CACHE;
+#else
+	unit->op_array.run_time_cache = NULL;
+#endif
+
+	/* Pointers rather than positions in the tables, which may have been
+	 * compacted by the end of the request */
+	memset(&unit->symbols, 0, sizeof(vld_symbols));
+	vld_symbols_collect(&unit->symbols);
+}
+/* }}} */
+
+/* Returns the counters of 'op_array', or NULL if none of its oplines ran */
+zend_ulong *vld_profile_hits(zend_op_array *op_array)
+{
+	if (!VLD_G(profile) || !op_array->opcodes) {
+		return NULL;
+	}
+	return zend_hash_index_find_ptr(&VLD_G(profile_hits), (zend_ulong) (zend_uintptr_t) op_array->opcodes);
+}
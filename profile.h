@@ -0,0 +1,35 @@
+/*
+   +----------------------------------------------------------------------+
+   | Copyright (c) 1997-2019 Derick Rethans                               |
+   +----------------------------------------------------------------------+
+   | This source file is subject to the 2-Clause BSD license which is     |
+   | available through the LICENSE file, or online at                     |
+   | http://opensource.org/licenses/bsd-license.php                       |
+   +----------------------------------------------------------------------+
+   | Authors:  Derick Rethans <derick@derickrethans.nl>                   |
+   +----------------------------------------------------------------------+
+ */
+
+#ifndef __PROFILE_H__
+#define __PROFILE_H__
+
+#include "php_vld.h"
+
+/* A compiled file whose dump is postponed until the end of the request, so
+ * that it can include the execution counts. The main op_array is kept alive
+ * by a copy holding a reference, and the functions and classes the file
+ * declared are collected when it is compiled. */
+typedef struct _vld_profile_unit {
+	zend_op_array op_array;
+	vld_symbols   symbols;
+} vld_profile_unit;
+
+void vld_profile_minit(void);
+void vld_profile_mshutdown(void);
+void vld_profile_rinit(void);
+void vld_profile_rshutdown(void);
+
+void vld_profile_defer(zend_op_array *op_array);
+zend_ulong *vld_profile_hits(zend_op_array *op_array);
+
+#endif
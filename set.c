@@ -12,56 +12,127 @@
 /* $Id: set.c,v 1.1 2006-09-26 09:40:26 derick Exp $ */
 
 #include <stdlib.h>
-#include <math.h>
 #include "set.h"
 
-vld_set *vld_set_create(unsigned int size)
+#if defined(__GNUC__) || defined(__clang__)
+# define vld_set_ctz(w)      ((unsigned int) __builtin_ctzll(w))
+# define vld_set_popcount(w) ((unsigned int) __builtin_popcountll(w))
+#else
+static unsigned int vld_set_ctz(uint64_t word)
+{
+	unsigned int n = 0;
+
+	while (!(word & 1)) {
+		word >>= 1;
+		n++;
+	}
+	return n;
+}
+
+static unsigned int vld_set_popcount(uint64_t word)
+{
+	unsigned int n = 0;
+
+	while (word) {
+		word &= word - 1;
+		n++;
+	}
+	return n;
+}
+#endif
+
+vld_set *vld_set_create(vld_arena *arena, unsigned int size)
 {
 	vld_set *tmp;
 
-	tmp = calloc(1, sizeof(vld_set));
+	tmp = vld_arena_calloc(arena, 1, sizeof(vld_set));
 	tmp->size = size;
-	size = ceil((size + 7) / 8);
-	tmp->setinfo = calloc(1, size);
+	tmp->words = VLD_SET_WORDS(size);
+	tmp->setinfo = vld_arena_calloc(arena, tmp->words ? tmp->words : 1, sizeof(uint64_t));
+	tmp->arena = arena;
 
 	return tmp;
 }
 
 void vld_set_free(vld_set *set)
 {
-	free(set->setinfo);
-	free(set);
+	vld_arena_release(set->arena, set->setinfo);
+	vld_arena_release(set->arena, set);
 }
 
 void vld_set_add(vld_set *set, unsigned int position)
 {
-	unsigned char *byte;
-	unsigned int   bit;
+	set->setinfo[position >> 6] |= (uint64_t) 1 << (position & 63);
+}
+
+void vld_set_remove(vld_set *set, unsigned int position)
+{
+	set->setinfo[position >> 6] &= ~((uint64_t) 1 << (position & 63));
+}
+
+int vld_set_in_ex(vld_set *set, unsigned int position, int noisy)
+{
+	return vld_set_in(set, position);
+}
 
-	byte = &(set->setinfo[position / 8]);
-	bit  = position % 8;
+unsigned int vld_set_count(vld_set *set)
+{
+	unsigned int i, count = 0;
 
-	*byte = *byte | 1 << bit;
+	for (i = 0; i < set->words; i++) {
+		count += vld_set_popcount(set->setinfo[i]);
+	}
+	return count;
 }
 
-void vld_set_remove(vld_set *set, unsigned int position)
+/* Returns the first position from 'position' onwards that is in the set, or
+ * set->size if there is none. Empty words are skipped as a whole. */
+unsigned int vld_set_next(vld_set *set, unsigned int position)
 {
-	unsigned char *byte;
-	unsigned int   bit;
+	unsigned int i = position >> 6;
+	uint64_t     word;
+
+	if (position >= set->size) {
+		return set->size;
+	}
 
-	byte = &(set->setinfo[position / 8]);
-	bit  = position % 8;
+	word = set->setinfo[i] & (~(uint64_t) 0 << (position & 63));
+	while (!word) {
+		if (++i >= set->words) {
+			return set->size;
+		}
+		word = set->setinfo[i];
+	}
+	position = (i << 6) + vld_set_ctz(word);
 
-	*byte = *byte & ~(1 << bit);
+	return position < set->size ? position : set->size;
 }
 
-int vld_set_in_ex(vld_set *set, unsigned int position, int noisy)
+/* The binary operations work on the words both sets have, which is all of
+ * them for sets of the same size. */
+void vld_set_union(vld_set *set, vld_set *other)
 {
-	unsigned char *byte;
-	unsigned int   bit;
+	unsigned int i;
 
-	byte = &(set->setinfo[position / 8]);
-	bit  = position % 8;
+	for (i = 0; i < set->words && i < other->words; i++) {
+		set->setinfo[i] |= other->setinfo[i];
+	}
+}
+
+void vld_set_intersect(vld_set *set, vld_set *other)
+{
+	unsigned int i;
+
+	for (i = 0; i < set->words; i++) {
+		set->setinfo[i] &= i < other->words ? other->setinfo[i] : 0;
+	}
+}
+
+void vld_set_difference(vld_set *set, vld_set *other)
+{
+	unsigned int i;
 
-	return (*byte & (1 << bit));
+	for (i = 0; i < set->words && i < other->words; i++) {
+		set->setinfo[i] &= ~other->setinfo[i];
+	}
 }
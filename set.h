@@ -14,12 +14,20 @@
 #ifndef __SET_H__
 #define __SET_H__
 
+#include <stdint.h>
+#include "arena.h"
+
+/* A bit per position, in 64 bit words */
 typedef struct _vld_set {
 	unsigned int size;
-	unsigned char *setinfo;
+	unsigned int words;
+	uint64_t *setinfo;
+	vld_arena *arena;
 } vld_set;
 
-vld_set *vld_set_create(unsigned int size);
+#define VLD_SET_WORDS(size) (((size) + 63) / 64)
+
+vld_set *vld_set_create(vld_arena *arena, unsigned int size);
 #if defined(ZEND_ENGINE_2) || defined(ZEND_ENGINE_3)
 # define VLD_DEAD_CODE 150
 #else
@@ -27,9 +35,15 @@ vld_set *vld_set_create(unsigned int size);
 #endif
 void vld_set_add(vld_set *set, unsigned int position);
 void vld_set_remove(vld_set *set, unsigned int position);
-#define vld_set_in(x,y) vld_set_in_ex(x,y,1)
+#define vld_set_in(x,y) ((int) (((x)->setinfo[(y) >> 6] >> ((y) & 63)) & 1))
 int vld_set_in_ex(vld_set *set, unsigned int position, int noisy);
 void vld_set_dump(vld_set *set);
 void vld_set_free(vld_set *set);
 
+unsigned int vld_set_count(vld_set *set);
+unsigned int vld_set_next(vld_set *set, unsigned int position);
+void vld_set_union(vld_set *set, vld_set *other);
+void vld_set_intersect(vld_set *set, vld_set *other);
+void vld_set_difference(vld_set *set, vld_set *other);
+
 #endif
@@ -20,6 +20,8 @@
 #include "ext/standard/url.h"
 #include "set.h"
 #include "php_vld.h"
+#include "profile.h"
+#include "binary.h"
 
 ZEND_EXTERN_MODULE_GLOBALS(vld)
 
@@ -656,9 +658,10 @@ const char *get_assign_operation(uint32_t extended_value)
 }
 #endif
 
-void vld_dump_op(int nr, zend_op * op_ptr, unsigned int base_address, int notdead, int entry, int start, int end, zend_op_array *opa)
+/* 'last_lineno' belongs to the dump of one op_array, and is only printed
+ * when it changes */
+void vld_dump_op(int nr, zend_op * op_ptr, unsigned int base_address, int notdead, int entry, int start, int end, zend_op_array *opa, unsigned int *last_lineno)
 {
-	static unsigned int last_lineno = (unsigned int) -1;
 	int print_sep = 0, len;
 	const char *fetch_type = "";
 	unsigned int flags, op1_type, op2_type, res_type;
@@ -780,11 +783,17 @@ void vld_dump_op(int nr, zend_op * op_ptr, unsigned int base_address, int notdea
 		}
 	}
 
-	if (op.lineno == last_lineno) {
+	if (op.lineno == *last_lineno) {
 		vld_printf(stderr, "      ");
 	} else {
 		vld_printf(stderr, "%5d ", op.lineno);
-		last_lineno = op.lineno;
+		*last_lineno = op.lineno;
+	}
+
+	if (VLD_G(profile)) {
+		zend_ulong *hits = vld_profile_hits(opa);
+
+		vld_printf(stderr, "%9lu ", hits ? (unsigned long) hits[nr] : 0UL);
 	}
 
 	if (op.opcode >= NUM_KNOWN_OPCODES) {
@@ -893,29 +902,20 @@ void vld_dump_op(int nr, zend_op * op_ptr, unsigned int base_address, int notdea
 	vld_printf (stderr, "\n");
 }
 
-void vld_analyse_oparray(zend_op_array *opa, vld_set *set, vld_branch_info *branch_info);
-void vld_analyse_branch(zend_op_array *opa, unsigned int position, vld_set *set, vld_branch_info *branch_info);
+void vld_analyse_oparray(zend_op_array *opa, vld_set *set, vld_branch_info *branch_info, int quiet);
+int vld_find_jumps(zend_op_array *opa, unsigned int position, size_t *jump_count, int *jumps);
 
-void vld_dump_oparray(zend_op_array *opa)
+/* Writes the op listing and the branch analysis of 'opa' as text. */
+static void vld_text_dump_oparray(vld_analysis *analysis)
 {
 	unsigned int i;
 	int          j;
-	vld_set *set;
-	vld_branch_info *branch_info;
+	zend_op_array   *opa = analysis->opa;
+	vld_set         *set = analysis->set;
+	vld_branch_info *branch_info = analysis->branch_info;
 	unsigned int base_address = (unsigned int)(zend_intptr_t)&(opa->opcodes[0]);
+	unsigned int last_lineno = (unsigned int) -1;
 
-	if (VLD_G(dump_json))
-	{
-		cJSON_vld_dump_oparray(opa);
-		return;
-	}
-
-	set = vld_set_create(opa->last);
-	branch_info = vld_branch_info_create(opa->last);
-
-	if (VLD_G(dump_paths)) {
-		vld_analyse_oparray(opa, set, branch_info);
-	}
 	if (VLD_G(format)) {
 		vld_printf (stderr, "filename:%s%s\n", VLD_G(col_sep), ZSTRING_VALUE(opa->filename));
 		vld_printf (stderr, "function name:%s%s\n", VLD_G(col_sep), ZSTRING_VALUE(opa->function_name));
@@ -934,25 +934,137 @@ void vld_dump_oparray(zend_op_array *opa)
 		vld_printf(stderr, "none\n");
 	}
 
-	if (VLD_G(format)) {
+	if (VLD_G(format) && VLD_G(profile)) {
+		vld_printf(stderr, "line%shits%s# *%s%s%sop%sfetch%sext%sreturn%soperands\n",VLD_G(col_sep),VLD_G(col_sep),VLD_G(col_sep),VLD_G(col_sep),VLD_G(col_sep),VLD_G(col_sep),VLD_G(col_sep),VLD_G(col_sep),VLD_G(col_sep));
+	} else if (VLD_G(format)) {
 		vld_printf(stderr, "line%s# *%s%s%sop%sfetch%sext%sreturn%soperands\n",VLD_G(col_sep),VLD_G(col_sep),VLD_G(col_sep),VLD_G(col_sep),VLD_G(col_sep),VLD_G(col_sep),VLD_G(col_sep),VLD_G(col_sep));
+	} else if (VLD_G(profile)) {
+		vld_printf(stderr, "line       hits    #* E I O op                           fetch          ext  return  operands\n");
+		vld_printf(stderr, "-----------------------------------------------------------------------------------------------\n");
 	} else {
 		vld_printf(stderr, "line     #* E I O op                           fetch          ext  return  operands\n");
 		vld_printf(stderr, "-------------------------------------------------------------------------------------\n");
 	}
 	for (i = 0; i < opa->last; i++) {
-		vld_dump_op(i, opa->opcodes, base_address, vld_set_in(set, i), vld_set_in(branch_info->entry_points, i), vld_set_in(branch_info->starts, i), vld_set_in(branch_info->ends, i), opa);
+		vld_dump_op(i, opa->opcodes, base_address, vld_set_in(set, i), vld_set_in(branch_info->entry_points, i), vld_set_in(branch_info->starts, i), vld_set_in(branch_info->ends, i), opa, &last_lineno);
 	}
 	vld_printf(stderr, "\n");
 
-	if (VLD_G(dump_paths)) {
-		vld_branch_post_process(opa, branch_info);
-		vld_branch_find_paths(branch_info);
+	if (analysis->paths) {
 		vld_branch_info_dump(opa, branch_info);
 	}
+}
+
+static void vld_dot_dump_oparray(vld_analysis *analysis)
+{
+	if (analysis->paths) {
+		vld_branch_info_dump_dot(analysis->opa, analysis->branch_info);
+	}
+}
+
+/* Every output format, in the order they are written for each op_array. */
+static const vld_emitter vld_emitter_list[] = {
+	{ "text", VLD_EMIT_TEXT, vld_text_dump_oparray },
+	{ "json", VLD_EMIT_JSON, vld_json_dump_oparray },
+	{ "dot",  VLD_EMIT_DOT,  vld_dot_dump_oparray },
+	{ "binary", VLD_EMIT_BINARY, vld_binary_dump_oparray },
+	{ NULL, 0, NULL }
+};
+
+/* Turns a comma separated list of format names into VLD_EMIT_* flags, or
+ * returns -1 when one of them is not known. Binary records can not be told
+ * apart from text or JSON written to the same stream, so "binary" can only
+ * be combined with "dot". */
+int vld_emitters_parse(const char *formats)
+{
+	const char *p = formats, *end;
+	size_t len;
+	int mask = 0, i;
+
+	while (*p) {
+		while (*p == ',' || *p == ' ') {
+			p++;
+		}
+		for (end = p; *end && *end != ',' && *end != ' '; end++);
+		len = end - p;
+		if (len) {
+			for (i = 0; vld_emitter_list[i].name; i++) {
+				if (strlen(vld_emitter_list[i].name) == len && strncasecmp(vld_emitter_list[i].name, p, len) == 0) {
+					break;
+				}
+			}
+			if (!vld_emitter_list[i].name) {
+				return -1;
+			}
+			mask |= vld_emitter_list[i].flag;
+		}
+		p = end;
+	}
+	if ((mask & VLD_EMIT_BINARY) && (mask & (VLD_EMIT_TEXT | VLD_EMIT_JSON))) {
+		return -1;
+	}
+	return mask;
+}
+
+/* The formats the current dump is written in. vld.formats picks them when it
+ * is set, but vld.dump_json (or the "json" option) still decides about JSON
+ * so that it can be toggled per call, unless binary records are written.
+ * Without it, the dump is JSON or text. */
+unsigned int vld_emitters(void)
+{
+	unsigned int mask;
+
+	if (VLD_G(inspect)) {
+		return VLD_EMIT_JSON;
+	}
+
+	mask = VLD_G(formats_mask) & ~VLD_EMIT_JSON;
+	if (VLD_G(dump_json) && !(mask & VLD_EMIT_BINARY)) {
+		mask |= VLD_EMIT_JSON;
+	} else if (!VLD_G(formats_mask)) {
+		mask |= VLD_EMIT_TEXT;
+	}
+	if (VLD_G(path_dump_file)) {
+		mask |= VLD_EMIT_DOT;
+	}
+	return mask;
+}
+
+void vld_dump_oparray(zend_op_array *opa)
+{
+	unsigned int mask = vld_emitters();
+	vld_analysis analysis;
+	int i;
+
+	if (!VLD_G(arena)) {
+		VLD_G(arena) = vld_arena_create();
+	}
+
+	analysis.opa = opa;
+	analysis.set = vld_set_create(VLD_G(arena), opa->last);
+	analysis.branch_info = vld_branch_info_create(VLD_G(arena), opa->last);
+	analysis.paths = VLD_G(dump_paths);
+
+	if (analysis.paths) {
+		/* The trace of the analysis is part of the text output only */
+		vld_analyse_oparray(opa, analysis.set, analysis.branch_info, !(mask & VLD_EMIT_TEXT));
+		vld_branch_post_process(opa, analysis.branch_info);
+		vld_branch_find_paths(analysis.branch_info);
+
+		/* What the clock cut short depends on this run, not on the file */
+		if (analysis.branch_info->truncated_by_time) {
+			VLD_G(cache_discard) = 1;
+		}
+	}
+
+	for (i = 0; vld_emitter_list[i].name; i++) {
+		if (mask & vld_emitter_list[i].flag) {
+			vld_emitter_list[i].emit(&analysis);
+		}
+	}
 
-	vld_set_free(set);
-	vld_branch_info_free(branch_info);
+	/* Everything the analysis allocated goes at once */
+	vld_arena_reset(VLD_G(arena));
 }
 
 void opt_set_nop (zend_op_array *opa, int nr)
@@ -960,6 +1072,38 @@ void opt_set_nop (zend_op_array *opa, int nr)
 	opa->opcodes[nr].opcode = ZEND_NOP;
 }
 
+#if PHP_VERSION_ID >= 70200
+static HashTable *vld_switch_table(zend_op_array *opa, unsigned int position)
+{
+	zval *array_value;
+
+#if PHP_VERSION_ID >= 70300
+	array_value = RT_CONSTANT((opa->opcodes) + position, opa->opcodes[position].op2);
+#else
+	array_value = RT_CONSTANT_EX(opa->literals, opa->opcodes[position].op2);
+#endif
+	return Z_ARRVAL_P(array_value);
+}
+#endif
+
+/* The most targets vld_find_jumps() reports for the opcode at 'position':
+ * every case of a switch plus its default and the next opcode, and at most
+ * two for the other jumps. */
+unsigned int vld_find_jumps_max(zend_op_array *opa, unsigned int position)
+{
+#if PHP_VERSION_ID >= 70200
+	if (
+		opa->opcodes[position].opcode == ZEND_SWITCH_LONG ||
+		opa->opcodes[position].opcode == ZEND_SWITCH_STRING
+	) {
+		return zend_hash_num_elements(vld_switch_table(opa, position)) + 2;
+	}
+#endif
+	return 2;
+}
+
+/* Stores the targets of the jump at 'position' in 'jumps', which has to
+ * have room for vld_find_jumps_max() of them. */
 int vld_find_jumps(zend_op_array *opa, unsigned int position, size_t *jump_count, int *jumps)
 {
 #if ZEND_USE_ABS_JMP_ADDR
@@ -1054,23 +1198,13 @@ int vld_find_jumps(zend_op_array *opa, unsigned int position, size_t *jump_count
 		opcode.opcode == ZEND_SWITCH_LONG ||
 		opcode.opcode == ZEND_SWITCH_STRING
 	) {
-		zval *array_value;
-		HashTable *myht;
+		HashTable *myht = vld_switch_table(opa, position);
 		zval *val;
 
-#if PHP_VERSION_ID >= 70300
-		array_value = RT_CONSTANT((opa->opcodes) + position, opcode.op2);
-#else
-		array_value = RT_CONSTANT_EX(opa->literals, opcode.op2);
-#endif
-		myht = Z_ARRVAL_P(array_value);
-
 		/* All 'case' statements */
 		ZEND_HASH_FOREACH_VAL_IND(myht, val) {
-			if (*jump_count < VLD_BRANCH_MAX_OUTS - 2) {
-				jumps[*jump_count] = position + (val->value.lval / sizeof(zend_op));
-				(*jump_count)++;
-			}
+			jumps[*jump_count] = position + (val->value.lval / sizeof(zend_op));
+			(*jump_count)++;
 		} ZEND_HASH_FOREACH_END();
 
 		/* The 'default' case */
@@ -1088,56 +1222,56 @@ int vld_find_jumps(zend_op_array *opa, unsigned int position, size_t *jump_count
 	return 0;
 }
 
-void vld_analyse_oparray(zend_op_array *opa, vld_set *set, vld_branch_info *branch_info)
-{
-	unsigned int position = 0;
-
-	VLD_PRINT(1, "Finding entry points\n");
-	while (position < opa->last) {
-		if (position == 0) {
-			vld_analyse_branch(opa, position, set, branch_info);
-			vld_set_add(branch_info->entry_points, position);
-		} else if (opa->opcodes[position].opcode == ZEND_CATCH) {
-			if (VLD_G(format)) {
-				VLD_PRINT2(1, "Found catch point at position:%s%d\n", VLD_G(col_sep),position);
-			} else {
-				VLD_PRINT1(1, "Found catch point at position: %d\n", position);
-			}
-			vld_analyse_branch(opa, position, set, branch_info);
-			vld_set_add(branch_info->entry_points, position);
-		}
-		position++;
-	}
-	vld_set_add(branch_info->ends, opa->last-1);
-	branch_info->branches[opa->last-1].start_lineno = opa->opcodes[opa->last-1].lineno;
-}
+#define VLD_PRINT_NOISY(v,args) if (!quiet) { VLD_PRINT(v,args); }
+#define VLD_PRINT1_NOISY(v,args,x) if (!quiet) { VLD_PRINT1(v,args,x); }
+#define VLD_PRINT2_NOISY(v,args,x,y) if (!quiet) { VLD_PRINT2(v,args,x,y); }
 
-void vld_analyse_branch(zend_op_array *opa, unsigned int position, vld_set *set, vld_branch_info *branch_info)
+/* Marks 'position' as the start of a branch, and queues it on the work list
+ * unless its opcodes have been walked already. Every position is queued at
+ * most once, so the work list never needs more than opa->last slots. */
+static void vld_analyse_queue(zend_op_array *opa, unsigned int position, vld_set *set, vld_branch_info *branch_info, unsigned int *worklist, unsigned int *worklist_count, int quiet)
 {
 	if (VLD_G(format)) {
-		VLD_PRINT2(1, "Branch analysis from position:%s%d\n", VLD_G(col_sep),position);
+		VLD_PRINT2_NOISY(1, "Branch analysis from position:%s%d\n", VLD_G(col_sep),position);
 	} else {
-		VLD_PRINT1(1, "Branch analysis from position: %d\n", position);
+		VLD_PRINT1_NOISY(1, "Branch analysis from position: %d\n", position);
 	}
 
+	if (vld_set_in(branch_info->starts, position)) {
+		return;
+	}
 	vld_set_add(branch_info->starts, position);
-	branch_info->branches[position].start_lineno = opa->opcodes[position].lineno;
 
-	/* First we see if the branch has been visited, if so we bail out. */
-	if (vld_set_in(set, position)) {
-		return;
+	if (!vld_set_in(set, position)) {
+		worklist[(*worklist_count)++] = position;
 	}
+}
+
+/* Walks the opcodes from the branch start 'position' until the end of the
+ * array, a jump, or an opcode that an earlier walk already covered. The jump
+ * targets are queued instead of being followed. */
+static void vld_analyse_branch(zend_op_array *opa, unsigned int position, vld_set *set, vld_branch_info *branch_info, unsigned int *worklist, unsigned int *worklist_count, int **jumps_buf, unsigned int *jumps_size, int quiet)
+{
 	/* Loop over the opcodes until the end of the array, or until a jump point has been found */
-	VLD_PRINT1(2, "Add %d\n", position);
-	vld_set_add(set, position);
-	while (position < opa->last) {
-		size_t jump_count = 0;
-		int    jumps[VLD_BRANCH_MAX_OUTS];
-		size_t i;
+	while (position < opa->last && !vld_set_in(set, position)) {
+		size_t       jump_count = 0;
+		int         *jumps;
+		size_t       i;
+		unsigned int jumps_max = vld_find_jumps_max(opa, position);
+
+		VLD_PRINT1_NOISY(2, "Add %d\n", position);
+		vld_set_add(set, position);
+
+		/* Switches can jump to any number of places */
+		if (jumps_max > *jumps_size) {
+			*jumps_buf = vld_arena_realloc(branch_info->arena, *jumps_buf, sizeof(int) * *jumps_size, sizeof(int) * jumps_max);
+			*jumps_size = jumps_max;
+		}
+		jumps = *jumps_buf;
 
 		/* See if we have a jump instruction */
 		if (vld_find_jumps(opa, position, &jump_count, jumps)) {
-			VLD_PRINT2(
+			VLD_PRINT2_NOISY(
 				1, "%d jumps found. (Code = %d) ",
 				jump_count,
 				opa->opcodes[position].opcode
@@ -1145,53 +1279,94 @@ void vld_analyse_branch(zend_op_array *opa, unsigned int position, vld_set *set,
 
 			for (i = 0; i < jump_count; i++) {
 				if (i > 0) {
-					VLD_PRINT(1, ", ");
+					VLD_PRINT_NOISY(1, ", ");
 				}
-				VLD_PRINT2(1, "Position %d = %d", i + 1, jumps[i]);
+				VLD_PRINT2_NOISY(1, "Position %d = %d", i + 1, jumps[i]);
 			}
-			VLD_PRINT(1, "\n");
+			VLD_PRINT_NOISY(1, "\n");
 
 			for (i = 0; i < jump_count; i++) {
 				if (jumps[i] == VLD_JMP_EXIT || jumps[i] >= 0) {
-					vld_branch_info_update(branch_info, position, opa->opcodes[position].lineno, i, jumps[i]);
-					if (jumps[i] != VLD_JMP_EXIT) {
-						vld_analyse_branch(opa, jumps[i], set, branch_info);
+					vld_branch_info_update(branch_info, position, i, jumps[i]);
+					if (jumps[i] != VLD_JMP_EXIT && (unsigned int) jumps[i] < opa->last) {
+						vld_analyse_queue(opa, jumps[i], set, branch_info, worklist, worklist_count, quiet);
 					}
 				}
 			}
 
-			break;
+			return;
 		}
 
 		/* See if we have a throw instruction */
 		if (opa->opcodes[position].opcode == ZEND_THROW) {
-			VLD_PRINT1(1, "Throw found at %d\n", position);
+			VLD_PRINT1_NOISY(1, "Throw found at %d\n", position);
 			vld_set_add(branch_info->ends, position);
-			branch_info->branches[position].start_lineno = opa->opcodes[position].lineno;
-			break;
+			return;
 		}
 
 		/* See if we have an exit instruction */
 		if (opa->opcodes[position].opcode == ZEND_EXIT) {
-			VLD_PRINT(1, "Exit found\n");
+			VLD_PRINT_NOISY(1, "Exit found\n");
 			vld_set_add(branch_info->ends, position);
-			branch_info->branches[position].start_lineno = opa->opcodes[position].lineno;
-			break;
+			return;
 		}
 		/* See if we have a return instruction */
 		if (
 			opa->opcodes[position].opcode == ZEND_RETURN
 			|| opa->opcodes[position].opcode == ZEND_RETURN_BY_REF
 		) {
-			VLD_PRINT(1, "Return found\n");
+			VLD_PRINT_NOISY(1, "Return found\n");
 			vld_set_add(branch_info->ends, position);
-			branch_info->branches[position].start_lineno = opa->opcodes[position].lineno;
-			break;
+			return;
 		}
 
 		position++;
-		VLD_PRINT1(2, "Add %d\n", position);
-		vld_set_add(set, position);
 	}
 }
 
+/* Finds the branches of 'opa' with an explicit work list instead of one
+ * recursive call per jump target, so neither the C stack nor the run time
+ * grows with the number of jumps: every opcode is walked exactly once. The
+ * debug output is suppressed with 'quiet', which the JSON and coverage
+ * analysis use. */
+void vld_analyse_oparray(zend_op_array *opa, vld_set *set, vld_branch_info *branch_info, int quiet)
+{
+	unsigned int  position = 0;
+	unsigned int *worklist;
+	unsigned int  worklist_count = 0;
+	int          *jumps;
+	unsigned int  jumps_size = 2;
+
+	if (opa->last == 0) {
+		return;
+	}
+
+	worklist = vld_arena_alloc(branch_info->arena, sizeof(unsigned int) * opa->last);
+	jumps = vld_arena_alloc(branch_info->arena, sizeof(int) * jumps_size);
+
+	VLD_PRINT_NOISY(1, "Finding entry points\n");
+	while (position < opa->last) {
+		if (position == 0 || opa->opcodes[position].opcode == ZEND_CATCH) {
+			if (position != 0) {
+				if (VLD_G(format)) {
+					VLD_PRINT2_NOISY(1, "Found catch point at position:%s%d\n", VLD_G(col_sep),position);
+				} else {
+					VLD_PRINT1_NOISY(1, "Found catch point at position: %d\n", position);
+				}
+			}
+			vld_analyse_queue(opa, position, set, branch_info, worklist, &worklist_count, quiet);
+			vld_set_add(branch_info->entry_points, position);
+
+			while (worklist_count > 0) {
+				worklist_count--;
+				vld_analyse_branch(opa, worklist[worklist_count], set, branch_info, worklist, &worklist_count, &jumps, &jumps_size, quiet);
+			}
+		}
+		position++;
+	}
+	vld_set_add(branch_info->ends, opa->last-1);
+
+	vld_arena_release(branch_info->arena, jumps);
+	vld_arena_release(branch_info->arena, worklist);
+}
+
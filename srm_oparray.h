@@ -16,6 +16,8 @@
 #define VLD_OPARRAY_H
 
 #include "php.h"
+#include "set.h"
+#include "branchinfo.h"
 
 
 #define VLD_ZNODE znode_op
@@ -61,6 +63,30 @@ typedef struct _op_usage {
 	unsigned int flags;
 } op_usage;
 
+/* What the analysis of one op_array found. It is computed once by
+ * vld_dump_oparray() and handed to every enabled emitter in turn; 'paths' is
+ * set when the branches and paths in 'branch_info' have been worked out. */
+typedef struct _vld_analysis {
+	zend_op_array   *opa;
+	vld_set         *set;
+	vld_branch_info *branch_info;
+	int              paths;
+} vld_analysis;
+
+typedef struct _vld_emitter {
+	const char  *name;
+	unsigned int flag;
+	void       (*emit)(vld_analysis *analysis);
+} vld_emitter;
+
+// output formats, as selected by vld.formats
+#define VLD_EMIT_TEXT (1<<0)
+#define VLD_EMIT_JSON (1<<1)
+#define VLD_EMIT_DOT  (1<<2)
+#define VLD_EMIT_BINARY (1<<3)
+
+int vld_emitters_parse(const char *formats);
+unsigned int vld_emitters(void);
 void vld_dump_oparray (zend_op_array *opa);
 void vld_mark_dead_code (zend_op_array *opa);
 
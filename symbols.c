@@ -0,0 +1,233 @@
+/*
+   +----------------------------------------------------------------------+
+   | Copyright (c) 1997-2019 Derick Rethans                               |
+   +----------------------------------------------------------------------+
+   | This source file is subject to the 2-Clause BSD license which is     |
+   | available through the LICENSE file, or online at                     |
+   | http://opensource.org/licenses/bsd-license.php                       |
+   +----------------------------------------------------------------------+
+   | Authors:  Derick Rethans <derick@derickrethans.nl>                   |
+   +----------------------------------------------------------------------+
+ */
+
+/* Finds the functions and classes that were declared since the last look at
+ * the global tables, so that every one of them is dumped exactly once per
+ * request. Two things get in the way of simply remembering how far the
+ * tables were looked at:
+ *
+ * - A conditionally declared function or class is added under a run time
+ *   definition key when it is compiled, and bound under its real name when
+ *   the declaration runs. That adds a second bucket for the same class
+ *   entry, or for a copy of the op_array that shares its opcodes.
+ * - Deleting buckets leaves holes (PHP 7.0 to 7.3 delete the run time
+ *   definition key of every early bound class), and a table with enough
+ *   holes is compacted when it grows, which moves buckets to lower indexes.
+ *
+ * So every symbol that was seen is remembered by its class entry or by the
+ * address of its opcodes, and the position of the last walk is only trusted
+ * while the bucket in front of it still holds the same entry. Otherwise the
+ * whole table is walked again, and the symbols seen before are skipped. */
+
+#include "php.h"
+#include "php_vld.h"
+#include "symbols.h"
+
+ZEND_EXTERN_MODULE_GLOBALS(vld)
+
+void vld_symbols_rinit(void)
+{
+	zend_hash_init(&VLD_G(symbols_seen), 64, NULL, NULL, 0);
+	VLD_G(symbols_generation) = 0;
+	memset(&VLD_G(function_mark), 0, sizeof(vld_table_mark));
+	memset(&VLD_G(class_mark), 0, sizeof(vld_table_mark));
+	VLD_G(generation_ids)       = NULL;
+	VLD_G(generation_ids_count) = 0;
+}
+
+void vld_symbols_rshutdown(void)
+{
+	zend_hash_destroy(&VLD_G(symbols_seen));
+	if (VLD_G(generation_ids)) {
+		efree(VLD_G(generation_ids));
+		VLD_G(generation_ids) = NULL;
+	}
+	VLD_G(generation_ids_count) = 0;
+}
+
+/* The identity of a user function or class; internal ones have none */
+static zend_ulong vld_symbol_id(void *ptr, int classes)
+{
+	if (classes) {
+		return ((zend_class_entry *) ptr)->type == ZEND_INTERNAL_CLASS ? 0 : (zend_ulong) (zend_uintptr_t) ptr;
+	}
+	if (((zend_function *) ptr)->type != ZEND_USER_FUNCTION) {
+		return 0;
+	}
+	/* Binding copies the op_array, but not its opcodes */
+	return (zend_ulong) (zend_uintptr_t) ((zend_op_array *) ptr)->opcodes;
+}
+
+/* Returns where to continue walking 'ht' from */
+static uint32_t vld_table_resume(HashTable *ht, vld_table_mark *mark)
+{
+	Bucket *p;
+
+	if (!mark->pos || mark->pos > ht->nNumUsed) {
+		return 0;
+	}
+	p = ht->arData + mark->pos - 1;
+	if (Z_TYPE(p->val) == IS_UNDEF || Z_PTR(p->val) != mark->last || p->key != mark->last_key || p->h != mark->last_h) {
+		return 0;
+	}
+	return mark->pos;
+}
+
+/* Remembers the end of 'ht', just past its last bucket in use */
+static void vld_table_mark_set(HashTable *ht, vld_table_mark *mark)
+{
+	uint32_t idx = ht->nNumUsed;
+	Bucket  *p;
+
+	while (idx > 0) {
+		p = ht->arData + idx - 1;
+		if (Z_TYPE(p->val) != IS_UNDEF) {
+			mark->pos      = idx;
+			mark->last     = Z_PTR(p->val);
+			mark->last_key = p->key;
+			mark->last_h   = p->h;
+			return;
+		}
+		idx--;
+	}
+	memset(mark, 0, sizeof(vld_table_mark));
+}
+
+static void vld_symbols_walk(HashTable *ht, vld_table_mark *mark, int classes, vld_symbol **list, uint32_t *count)
+{
+	uint32_t    idx;
+	Bucket     *p;
+	zend_ulong  id;
+	zval        generation;
+	vld_symbol *symbol;
+
+	ZVAL_LONG(&generation, VLD_G(symbols_generation));
+
+	for (idx = vld_table_resume(ht, mark); idx < ht->nNumUsed; idx++) {
+		p = ht->arData + idx;
+		if (Z_TYPE(p->val) == IS_UNDEF) {
+			continue;
+		}
+		id = vld_symbol_id(Z_PTR(p->val), classes);
+		if (!id || zend_hash_index_exists(&VLD_G(symbols_seen), id)) {
+			continue;
+		}
+		zend_hash_index_add_new(&VLD_G(symbols_seen), id, &generation);
+		if (VLD_G(symbols_generation)) {
+			VLD_G(generation_ids) = safe_erealloc(VLD_G(generation_ids), VLD_G(generation_ids_count) + 1, sizeof(zend_ulong), 0);
+			VLD_G(generation_ids)[VLD_G(generation_ids_count)++] = id;
+		}
+
+		if (list) {
+			*list = safe_erealloc(*list, *count + 1, sizeof(vld_symbol), 0);
+			symbol = &(*list)[(*count)++];
+			symbol->ptr = Z_PTR(p->val);
+			symbol->key = p->key ? zend_string_copy(p->key) : NULL;
+			symbol->h   = p->h;
+		}
+	}
+	vld_table_mark_set(ht, mark);
+}
+
+/* Adds the functions and classes that were not seen before to 'symbols',
+ * which may be NULL to only take note of them */
+void vld_symbols_collect(vld_symbols *symbols)
+{
+	vld_symbols_walk(CG(function_table), &VLD_G(function_mark), 0, symbols ? &symbols->functions : NULL, symbols ? &symbols->functions_count : NULL);
+	vld_symbols_walk(CG(class_table), &VLD_G(class_mark), 1, symbols ? &symbols->classes : NULL, symbols ? &symbols->classes_count : NULL);
+}
+
+void vld_symbols_free(vld_symbols *symbols)
+{
+	uint32_t i;
+
+	for (i = 0; i < symbols->functions_count; i++) {
+		if (symbols->functions[i].key) {
+			zend_string_release(symbols->functions[i].key);
+		}
+	}
+	for (i = 0; i < symbols->classes_count; i++) {
+		if (symbols->classes[i].key) {
+			zend_string_release(symbols->classes[i].key);
+		}
+	}
+	if (symbols->functions) {
+		efree(symbols->functions);
+	}
+	if (symbols->classes) {
+		efree(symbols->classes);
+	}
+	memset(symbols, 0, sizeof(vld_symbols));
+}
+
+/* Starts a new generation: the symbols collected from now on can be removed
+ * from the global tables again with vld_symbols_remove(). The ends of the
+ * tables are remembered, as the symbols of the generation can only show up
+ * past them. */
+zend_long vld_symbols_generation(void)
+{
+	VLD_G(generation_function_mark) = VLD_G(function_mark);
+	VLD_G(generation_class_mark)    = VLD_G(class_mark);
+	VLD_G(generation_ids_count)     = 0;
+
+	return ++VLD_G(symbols_generation);
+}
+
+static void vld_symbols_remove_from(HashTable *ht, vld_table_mark *start, vld_table_mark *mark, int classes, zend_long generation)
+{
+	uint32_t    idx;
+	Bucket     *p;
+	zend_ulong  id;
+	zval       *seen;
+
+	/* Collecting walked the same part of the table, unless it was compacted
+	 * in between; then both start over from the front */
+	for (idx = vld_table_resume(ht, start); idx < ht->nNumUsed; idx++) {
+		p = ht->arData + idx;
+		if (Z_TYPE(p->val) == IS_UNDEF || !(id = vld_symbol_id(Z_PTR(p->val), classes))) {
+			continue;
+		}
+		seen = zend_hash_index_find(&VLD_G(symbols_seen), id);
+		if (seen && Z_LVAL_P(seen) == generation) {
+			zend_hash_del_bucket(ht, p);
+		}
+	}
+
+	/* The next walk takes the same way, so that it still finds whatever was
+	 * added without being collected */
+	if (vld_table_resume(ht, start) == start->pos) {
+		*mark = *start;
+	} else {
+		vld_table_mark_set(ht, mark);
+	}
+}
+
+/* Deletes the functions and classes that were first seen in 'generation',
+ * which has to be the current one, from the global tables. Their buckets are
+ * deleted wherever they are past the ends the tables had when the generation
+ * started. */
+void vld_symbols_remove(zend_long generation)
+{
+	uint32_t i;
+
+	if (generation != VLD_G(symbols_generation)) {
+		return;
+	}
+	vld_symbols_remove_from(CG(function_table), &VLD_G(generation_function_mark), &VLD_G(function_mark), 0, generation);
+	vld_symbols_remove_from(CG(class_table), &VLD_G(generation_class_mark), &VLD_G(class_mark), 1, generation);
+
+	/* Their memory may be reused for other symbols now */
+	for (i = 0; i < VLD_G(generation_ids_count); i++) {
+		zend_hash_index_del(&VLD_G(symbols_seen), VLD_G(generation_ids)[i]);
+	}
+	VLD_G(generation_ids_count) = 0;
+}
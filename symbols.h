@@ -0,0 +1,51 @@
+/*
+   +----------------------------------------------------------------------+
+   | Copyright (c) 1997-2019 Derick Rethans                               |
+   +----------------------------------------------------------------------+
+   | This source file is subject to the 2-Clause BSD license which is     |
+   | available through the LICENSE file, or online at                     |
+   | http://opensource.org/licenses/bsd-license.php                       |
+   +----------------------------------------------------------------------+
+   | Authors:  Derick Rethans <derick@derickrethans.nl>                   |
+   +----------------------------------------------------------------------+
+ */
+
+#ifndef __SYMBOLS_H__
+#define __SYMBOLS_H__
+
+#include "php.h"
+
+/* A user function or class, and the key it was found under */
+typedef struct _vld_symbol {
+	void        *ptr; /* The zend_op_array or zend_class_entry */
+	zend_string *key;
+	zend_ulong   h;
+} vld_symbol;
+
+/* The functions and classes that showed up in the global tables since the
+ * previous vld_symbols_collect() */
+typedef struct _vld_symbols {
+	vld_symbol *functions;
+	uint32_t    functions_count;
+	vld_symbol *classes;
+	uint32_t    classes_count;
+} vld_symbols;
+
+/* Where the last walk over a global table stopped, and the bucket in front
+ * of that spot, which tells whether the table was compacted since */
+typedef struct _vld_table_mark {
+	uint32_t     pos;
+	void        *last;
+	zend_string *last_key;
+	zend_ulong   last_h;
+} vld_table_mark;
+
+void vld_symbols_rinit(void);
+void vld_symbols_rshutdown(void);
+
+void vld_symbols_collect(vld_symbols *symbols);
+void vld_symbols_free(vld_symbols *symbols);
+zend_long vld_symbols_generation(void);
+void vld_symbols_remove(zend_long generation);
+
+#endif
@@ -0,0 +1,59 @@
+--TEST--
+Read the binary records back with utils/vld-bin2json
+--SKIPIF--
+<?php
+if (!extension_loaded("vld")) print "skip";
+if (!function_exists('exec')) print "skip exec() is disabled";
+exec('cc --version 2>&1', $lines, $status);
+if ($status !== 0) print "skip no C compiler";
+?>
+--INI--
+vld.active=0
+vld.formats=binary
+vld.output={PWD}/binary-record.bin
+--FILE--
+<?php
+$utils = __DIR__ . '/../utils';
+$reader = __DIR__ . '/binary-record-reader';
+$file = __DIR__ . '/binary-record.inc';
+$out = __DIR__ . '/binary-record.bin';
+
+exec(sprintf('cc -o %s %s %s -lm 2>&1', escapeshellarg($reader), escapeshellarg("$utils/vld-bin2json.c"), escapeshellarg("$utils/vldbin.c")), $lines, $status);
+var_dump($status);
+
+file_put_contents($file, '<?php
+function add($a, $b) { $c = $a + $b; return $c; }
+class Shape { function area($w, $h) { return $w > 0 ? $w * $h : 0; } }
+');
+@unlink($out);
+var_dump(vld_dump_files([$file], ['dump_paths' => true]));
+
+/* The reader checks every length prefix and version, and rejects records
+ * that do not end where their length says */
+$lines = [];
+exec(sprintf('%s -l %s 2>&1', escapeshellarg($reader), escapeshellarg($out)), $lines, $status);
+var_dump($status);
+
+/* ... and has to give back what the JSON output holds */
+$expected = vld_inspect_file($file, ['dump_paths' => true]);
+var_dump(count($lines) === count($expected));
+foreach ($lines as $i => $line) {
+	$record = json_decode($line, true);
+	echo $record['function name'] ?: 'main', ': ', $record == $expected[$i] ? 'same' : 'differs', "\n";
+}
+
+unlink($file);
+unlink($out);
+unlink($reader);
+?>
+--EXPECTF--
+int(0)
+array(1) {
+  ["%sbinary-record.inc"]=>
+  bool(true)
+}
+int(0)
+bool(true)
+main: same
+add: same
+area: same
@@ -0,0 +1,15 @@
+--TEST--
+Binary records with vld.formats=binary
+--SKIPIF--
+<?php if (!extension_loaded("vld")) print "skip"; ?>
+--INI--
+vld.active=1
+vld.execute=0
+vld.formats=binary
+vld.dump_paths=1
+--FILE--
+<?php
+function foo() {}
+?>
+--EXPECTF--
+VLDB%a%sbinary.php%aVLDB%afoo%a
@@ -0,0 +1,29 @@
+--TEST--
+Replay the dump of an unchanged file from vld.cache_dir
+--SKIPIF--
+<?php if (!extension_loaded("vld")) print "skip"; ?>
+--INI--
+vld.active=0
+vld.cache_dir={PWD}
+--FILE--
+<?php
+$file = __DIR__ . '/cache-dir.inc';
+file_put_contents($file, '<?php function cached() {}');
+foreach (glob(__DIR__ . '/*.vld') as $entry) {
+	unlink($entry);
+}
+$options = ['json' => true, 'json_lines' => true, 'dump_paths' => false];
+vld_dump_files([$file], $options);
+var_dump(count(glob(__DIR__ . '/*.vld')));
+vld_dump_files([$file], $options);
+foreach (glob(__DIR__ . '/*.vld') as $entry) {
+	unlink($entry);
+}
+unlink($file);
+?>
+--EXPECTF--
+{"class":null,"filename":"%scache-dir.inc","function name":null,%s}
+{"class":null,"filename":"%scache-dir.inc","function name":"cached",%s}
+int(1)
+{"class":null,"filename":"%scache-dir.inc","function name":null,%s}
+{"class":null,"filename":"%scache-dir.inc","function name":"cached",%s}
@@ -0,0 +1,27 @@
+--TEST--
+Conditionally declared functions and classes are dumped once
+--SKIPIF--
+<?php if (!extension_loaded("vld")) print "skip"; ?>
+--INI--
+vld.active=1
+vld.execute=1
+vld.dump_json=1
+vld.json_lines=1
+vld.dump_paths=0
+--FILE--
+<?php
+if (!function_exists('foo')) {
+	function foo() { return 1; }
+}
+if (!class_exists('Bar')) {
+	class Bar { function baz() {} }
+}
+include __DIR__ . '/conditional-declarations.inc';
+echo foo(), "\n";
+?>
+--EXPECTF--
+{"class":null,"filename":"%sconditional-declarations.php","function name":null,%s}
+{"class":null,"filename":"%sconditional-declarations.php","function name":"foo",%s}
+{"class":"Bar","filename":"%sconditional-declarations.php","function name":"baz",%s}
+{"class":null,"filename":"%sconditional-declarations.inc","function name":null,%s}
+1
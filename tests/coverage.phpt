@@ -0,0 +1,24 @@
+--TEST--
+Branch and path coverage at run time
+--SKIPIF--
+<?php if (!extension_loaded("vld")) print "skip"; ?>
+--INI--
+vld.active=1
+vld.coverage=1
+vld.dump_json=1
+vld.json_lines=1
+--FILE--
+<?php
+function pick($a) {
+	if ($a) {
+		return 1;
+	}
+	return 2;
+}
+pick(true);
+echo "done\n";
+?>
+--EXPECTF--
+done
+{"class":null,"filename":"%scoverage.php","function name":null,%s}
+{"class":null,"filename":"%scoverage.php","function name":"pick",%s"path":[[0,%d],[0,%d]],"path_hit":[1,0],"branch":{"sline":[%s],"eline":[%s],"sop":[0,%d,%d],"eop":[%s],"outs":[[%d,%d],[-2],[-2]],"hit":[1,1,0],"outs_hit":[[1,0],[1],[0]]}}
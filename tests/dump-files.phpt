@@ -0,0 +1,29 @@
+--TEST--
+Dump a batch of files without executing them
+--SKIPIF--
+<?php if (!extension_loaded("vld")) print "skip"; ?>
+--INI--
+vld.active=0
+--FILE--
+<?php
+$a = __DIR__ . '/dump-files-a.inc';
+$b = __DIR__ . '/dump-files-b.inc';
+file_put_contents($a, '<?php function same() { echo "a"; }');
+file_put_contents($b, '<?php function same() { echo "b"; } function (');
+var_dump(vld_dump_files([$a, $b, $a], ['json' => true, 'json_lines' => true, 'dump_paths' => false]));
+var_dump(function_exists('same'));
+unlink($a);
+unlink($b);
+?>
+--EXPECTF--
+{"class":null,"filename":"%sdump-files-a.inc","function name":null,%s}
+{"class":null,"filename":"%sdump-files-a.inc","function name":"same",%s}
+{"class":null,"filename":"%sdump-files-a.inc","function name":null,%s}
+{"class":null,"filename":"%sdump-files-a.inc","function name":"same",%s}
+array(2) {
+  ["%sdump-files-a.inc"]=>
+  bool(true)
+  ["%sdump-files-b.inc"]=>
+  bool(false)
+}
+bool(false)
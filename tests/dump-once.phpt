@@ -0,0 +1,14 @@
+--TEST--
+Functions are only dumped once per request
+--SKIPIF--
+<?php if (!extension_loaded("vld")) print "skip"; ?>
+--INI--
+vld.active=1
+vld.dump_paths=0
+--FILE--
+<?php
+function foo() {}
+eval('function bar() {}');
+?>
+--EXPECTREGEX--
+(?!(?:.*Function foo:){2}).*Function foo:.*Function bar:.*
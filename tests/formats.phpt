@@ -0,0 +1,22 @@
+--TEST--
+Text and JSON output from one analysis with vld.formats
+--SKIPIF--
+<?php if (!extension_loaded("vld")) print "skip"; ?>
+--INI--
+vld.active=1
+vld.execute=0
+vld.formats=text,json
+vld.json_lines=1
+vld.dump_paths=0
+--FILE--
+<?php
+function foo() {}
+?>
+--EXPECTF--
+%Afunction name:  (null)
+%A{"class":null,"filename":"%sformats.php","function name":null,"number of ops":%d,"compiled vars":[],"ops":{%s}}
+%AFunction foo:
+%Afunction name:  foo
+%A{"class":null,"filename":"%sformats.php","function name":"foo","number of ops":%d,"compiled vars":[],"ops":{%s}}
+%AEnd of function foo
+%A
@@ -0,0 +1,45 @@
+--TEST--
+Return the dump records as arrays
+--SKIPIF--
+<?php if (!extension_loaded("vld")) print "skip"; ?>
+--INI--
+vld.active=0
+--FILE--
+<?php
+$records = vld_inspect_code('class A { function b($c) { return $c; } }', ['dump_paths' => true]);
+var_dump(count($records));
+var_dump($records[1]['class'], $records[1]['function name'], $records[1]['compiled vars']);
+var_dump($records[1]['ops']['op']);
+var_dump($records[1]['path'], $records[1]['branch']['sop']);
+var_dump(class_exists('A', false));
+var_dump(vld_inspect_code('function ('));
+?>
+--EXPECT--
+int(2)
+string(1) "A"
+string(1) "b"
+array(1) {
+  [0]=>
+  string(1) "c"
+}
+array(3) {
+  [0]=>
+  string(4) "RECV"
+  [1]=>
+  string(6) "RETURN"
+  [2]=>
+  string(6) "RETURN"
+}
+array(1) {
+  [0]=>
+  array(1) {
+    [0]=>
+    int(0)
+  }
+}
+array(1) {
+  [0]=>
+  int(0)
+}
+bool(false)
+bool(false)
@@ -0,0 +1,18 @@
+--TEST--
+Line delimited JSON output
+--SKIPIF--
+<?php if (!extension_loaded("vld")) print "skip"; ?>
+--INI--
+vld.active=1
+vld.execute=0
+vld.dump_json=1
+vld.json_lines=1
+vld.dump_paths=0
+vld.format=1
+--FILE--
+<?php
+function foo() {}
+?>
+--EXPECTF--
+{"class":null,"filename":"%sjson-lines.php","function name":null,"number of ops":%d,"compiled vars":[],"ops":{%s}}
+{"class":null,"filename":"%sjson-lines.php","function name":"foo","number of ops":%d,"compiled vars":[],"ops":{%s}}
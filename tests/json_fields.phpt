@@ -0,0 +1,17 @@
+--TEST--
+Selected JSON columns with vld.json_fields
+--SKIPIF--
+<?php if (!extension_loaded("vld")) print "skip"; ?>
+--INI--
+vld.active=1
+vld.execute=0
+vld.dump_json=1
+vld.json_lines=1
+vld.json_fields=line,op,op1,op2,return
+vld.dump_paths=1
+--FILE--
+<?php
+$a = 1;
+?>
+--EXPECTF--
+{"class":null,"filename":"%s","function name":null,"number of ops":%d,"compiled vars":["a"],"ops":{"line":[%s],"op":[%s],"return":[%s],"op1":[%s],"op2":[%s]}}
@@ -0,0 +1,18 @@
+--TEST--
+Interned strings with vld.json_intern
+--SKIPIF--
+<?php if (!extension_loaded("vld")) print "skip"; ?>
+--INI--
+vld.active=1
+vld.execute=0
+vld.dump_json=1
+vld.json_lines=1
+vld.json_intern=1
+vld.dump_paths=0
+--FILE--
+<?php
+function foo() { return 1; }
+?>
+--EXPECTF--
+{"strings_first":0,"strings":[%s],"class":null,"filename":%d,"function name":null,"number of ops":%d,"compiled vars":[],"ops":{%s"op":[%d%s}}
+{%A"class":null,"filename":%d,"function name":"foo","number of ops":%d,"compiled vars":[],"ops":{%s"op":[%d%s}}
@@ -0,0 +1,29 @@
+--TEST--
+vld.output_compression writes every compiled file as its own gzip member
+--SKIPIF--
+<?php
+if (!extension_loaded("vld")) print "skip";
+if (!extension_loaded("zlib")) print "skip zlib extension not available";
+if (ini_get("vld.output_compression") !== "gzip") print "skip vld built without gzip support";
+?>
+--INI--
+vld.active=1
+vld.execute=1
+vld.dump_json=1
+vld.json_lines=1
+vld.dump_paths=0
+vld.output={PWD}/output-compression.json.gz
+vld.output_compression=gzip
+--FILE--
+<?php
+$data = file_get_contents(__DIR__ . '/output-compression.json.gz');
+var_dump(substr($data, 0, 2) === "\x1f\x8b");
+echo gzdecode($data);
+?>
+--CLEAN--
+<?php
+@unlink(__DIR__ . '/output-compression.json.gz');
+?>
+--EXPECTF--
+bool(true)
+{"class":null,"filename":"%soutput-compression.php","function name":null,%s}
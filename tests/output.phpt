@@ -0,0 +1,23 @@
+--TEST--
+vld.output keeps the branches next to the ops they belong to
+--SKIPIF--
+<?php if (!extension_loaded("vld")) print "skip"; ?>
+--INI--
+vld.active=1
+vld.execute=0
+vld.verbosity=0
+vld.output=stdout
+--FILE--
+<?php
+function foo() {}
+?>
+--EXPECTF--
+%Afunction name:  (null)
+%Abranch: #  0; line:%s
+path #1: 0, 
+Function foo:
+%Afunction name:  foo
+%Abranch: #  0; line:%s
+path #1: 0, 
+End of function foo
+
@@ -0,0 +1,22 @@
+--TEST--
+Path limit and truncation reporting
+--SKIPIF--
+<?php if (!extension_loaded("vld")) print "skip"; ?>
+--INI--
+vld.active=0
+--FILE--
+<?php
+$code = 'function f($a, $b, $c) { if ($a) { echo 1; } if ($b) { echo 2; } if ($c) { echo 3; } }';
+
+$records = vld_inspect_code($code, ['dump_paths' => true, 'path_limit' => 3]);
+var_dump(count($records[1]['path']), $records[1]['paths_total_estimate'], $records[1]['truncated']);
+
+$records = vld_inspect_code($code, ['dump_paths' => true, 'path_limit' => 0]);
+var_dump(count($records[1]['path']), $records[1]['truncated']);
+?>
+--EXPECT--
+int(3)
+int(8)
+bool(true)
+int(8)
+bool(false)
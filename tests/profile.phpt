@@ -0,0 +1,22 @@
+--TEST--
+Execution counts in the hits column
+--SKIPIF--
+<?php if (!extension_loaded("vld")) print "skip"; ?>
+--INI--
+vld.active=1
+vld.profile=1
+vld.dump_json=1
+vld.json_lines=1
+vld.dump_paths=0
+--FILE--
+<?php
+function f() { return 1; }
+for ($i = 0; $i < 3; $i++) {
+	f();
+}
+echo "done\n";
+?>
+--EXPECTF--
+done
+{"class":null,"filename":"%sprofile.php","function name":null,%s"hits":[%s]}}
+{"class":null,"filename":"%sprofile.php","function name":"f",%s"hits":[3,0]}}
@@ -0,0 +1,39 @@
+--TEST--
+vld.save_per_file writes the dump of every file below vld.save_dir
+--SKIPIF--
+<?php if (!extension_loaded("vld")) print "skip"; ?>
+--INI--
+vld.active=1
+vld.execute=1
+vld.dump_json=1
+vld.json_lines=1
+vld.dump_paths=1
+vld.save_paths=1
+vld.save_per_file=1
+vld.save_dir={PWD}/save-per-file
+--FILE--
+<?php
+$base = __DIR__ . '/save-per-file' . __FILE__;
+echo file_get_contents($base . '.vld');
+echo file_get_contents($base . '.dot');
+var_dump(count(glob($base . '*.tmp')));
+?>
+--CLEAN--
+<?php
+function vld_rmdir($dir)
+{
+	foreach (scandir($dir) as $entry) {
+		if ($entry !== '.' && $entry !== '..') {
+			is_dir("$dir/$entry") ? vld_rmdir("$dir/$entry") : unlink("$dir/$entry");
+		}
+	}
+	rmdir($dir);
+}
+vld_rmdir(__DIR__ . '/save-per-file');
+?>
+--EXPECTF--
+{"class":null,"filename":"%ssave-per-file.php","function name":null,%s}
+digraph {
+subgraph cluster_file_%s
+%A}
+int(0)
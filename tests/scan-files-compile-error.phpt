@@ -0,0 +1,47 @@
+--TEST--
+Start a new worker after a compile error in one file of a scan
+--SKIPIF--
+<?php
+if (!extension_loaded("vld")) print "skip";
+if (substr(PHP_OS, 0, 3) == 'WIN') print "skip not for Windows";
+?>
+--INI--
+vld.active=0
+display_errors=0
+log_errors=0
+--FILE--
+<?php
+$files = [];
+$code = [
+	'a' => '<?php function a() {}',
+	'b' => '<?php function partial() {} abstract class Broken { abstract function f() {} }',
+	'c' => '<?php function c() {}',
+];
+foreach ($code as $name => $source) {
+	$files[] = $file = __DIR__ . "/scan-files-compile-error-$name.inc";
+	file_put_contents($file, $source);
+}
+$output = __DIR__ . '/scan-files-compile-error.out';
+var_dump(vld_scan_files($files, $output, 1, ['json' => true, 'dump_paths' => false]));
+echo file_get_contents($output);
+var_dump(function_exists('partial'), class_exists('Broken', false));
+foreach ($files as $file) {
+	unlink($file);
+}
+unlink($output);
+?>
+--EXPECTF--
+array(3) {
+  ["%sscan-files-compile-error-a.inc"]=>
+  bool(true)
+  ["%sscan-files-compile-error-b.inc"]=>
+  bool(false)
+  ["%sscan-files-compile-error-c.inc"]=>
+  bool(true)
+}
+{"class":null,"filename":"%sscan-files-compile-error-a.inc","function name":null,%s}
+{"class":null,"filename":"%sscan-files-compile-error-a.inc","function name":"a",%s}
+{"class":null,"filename":"%sscan-files-compile-error-c.inc","function name":null,%s}
+{"class":null,"filename":"%sscan-files-compile-error-c.inc","function name":"c",%s}
+bool(false)
+bool(false)
@@ -0,0 +1,42 @@
+--TEST--
+Dump a batch of files with forked workers
+--SKIPIF--
+<?php
+if (!extension_loaded("vld")) print "skip";
+if (substr(PHP_OS, 0, 3) == 'WIN') print "skip not for Windows";
+?>
+--INI--
+vld.active=0
+--FILE--
+<?php
+$files = [];
+foreach (['a', 'b', 'c'] as $name) {
+	$files[] = $file = __DIR__ . "/scan-files-$name.inc";
+	file_put_contents($file, "<?php function $name() {}");
+}
+$output = __DIR__ . '/scan-files.out';
+var_dump(vld_scan_files($files, $output, 2, ['json' => true, 'dump_paths' => false]));
+echo file_get_contents($output);
+var_dump(file_exists("$output.0"), file_exists("$output.1"));
+foreach ($files as $file) {
+	unlink($file);
+}
+unlink($output);
+?>
+--EXPECTF--
+array(3) {
+  ["%sscan-files-a.inc"]=>
+  bool(true)
+  ["%sscan-files-b.inc"]=>
+  bool(true)
+  ["%sscan-files-c.inc"]=>
+  bool(true)
+}
+{"class":null,"filename":"%sscan-files-a.inc","function name":null,%s}
+{"class":null,"filename":"%sscan-files-a.inc","function name":"a",%s}
+{"class":null,"filename":"%sscan-files-b.inc","function name":null,%s}
+{"class":null,"filename":"%sscan-files-b.inc","function name":"b",%s}
+{"class":null,"filename":"%sscan-files-c.inc","function name":null,%s}
+{"class":null,"filename":"%sscan-files-c.inc","function name":"c",%s}
+bool(false)
+bool(false)
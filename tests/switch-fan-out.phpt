@@ -0,0 +1,23 @@
+--TEST--
+Switches with more than 32 cases keep all their outs
+--SKIPIF--
+<?php if (!extension_loaded("vld")) print "skip"; ?>
+<?php if (PHP_VERSION_ID < 70200) print "skip PHP 7.2 required"; ?>
+--INI--
+vld.active=0
+--FILE--
+<?php
+$code = 'function f($a) { switch ($a) {';
+for ($i = 0; $i < 40; $i++) {
+	$code .= " case $i: echo $i; break;";
+}
+$code .= ' default: echo "none"; } }';
+
+$records = vld_inspect_code($code, ['dump_paths' => true]);
+$outs = array_map('count', $records[1]['branch']['outs']);
+var_dump(max($outs));
+var_dump($records[1]['truncated']);
+?>
+--EXPECT--
+int(42)
+bool(false)
@@ -0,0 +1,113 @@
+/*
+   +----------------------------------------------------------------------+
+   | Copyright (c) 2020 Chanth Miao                                       |
+   +----------------------------------------------------------------------+
+   | This source file is subject to the 2-Clause BSD license which is     |
+   | available through the LICENSE file, or online at                     |
+   | http://opensource.org/licenses/bsd-license.php                       |
+   +----------------------------------------------------------------------+
+   | Authors:  Chanth Miao <chanthmiao@foxmail.com>                       |
+   +----------------------------------------------------------------------+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "vldbin.h"
+
+void help_msg(void)
+{
+    fputs("Usage:\n", stderr);
+    fputs("vld-bin2json [-f] [-l] [file...]\n", stderr);
+    fputs("  -f  pretty print, as vld.format=1\n", stderr);
+    fputs("  -l  one record per line, as vld.json_lines=1\n", stderr);
+}
+
+// 转换一个输入中的全部记录, 返回是否成功
+static int convert(FILE *in, const char *name, int pretty, int lines, unsigned long *count)
+{
+    vldbin_record rec;
+    int res;
+
+    while ((res = vldbin_read(in, &rec)) == VLDBIN_OK)
+    {
+        if (lines)
+        {
+            vldbin_to_json(&rec, stdout, 0);
+            fputc('\n', stdout);
+        }
+        else
+        {
+            // 与vld_json_write_separator()相同的分隔符
+            if (*count)
+            {
+                fputs(pretty ? ",\n" : ",", stdout);
+            }
+            vldbin_to_json(&rec, stdout, pretty);
+        }
+        (*count)++;
+        vldbin_free(&rec);
+    }
+    vldbin_free(&rec);
+    if (res != VLDBIN_EOF)
+    {
+        fprintf(stderr, "%s: record %lu: %s\n", name, *count + 1, vldbin_strerror(res));
+        return 0;
+    }
+    return 1;
+}
+
+int main(int argc, char const *argv[])
+{
+    int pretty = 0, lines = 0, ok = 1, i;
+    unsigned long count = 0;
+    FILE *in;
+
+    // 解析选项
+    for (i = 1; i < argc && argv[i][0] == '-' && argv[i][1]; i++)
+    {
+        if (strcmp(argv[i], "-f") == 0)
+        {
+            pretty = 1;
+        }
+        else if (strcmp(argv[i], "-l") == 0)
+        {
+            lines = 1;
+        }
+        else
+        {
+            help_msg();
+            return 1;
+        }
+    }
+    if (!lines)
+    {
+        fputs(pretty ? "[\n" : "[", stdout);
+    }
+    // 未给出文件时读取标准输入
+    if (i == argc)
+    {
+        ok = convert(stdin, "-", pretty, lines, &count);
+    }
+    for (; i < argc && ok; i++)
+    {
+        in = strcmp(argv[i], "-") == 0 ? stdin : fopen(argv[i], "rb");
+        if (!in)
+        {
+            fprintf(stderr, "%s: %s\n", argv[i], strerror(errno));
+            ok = 0;
+            break;
+        }
+        ok = convert(in, argv[i], pretty, lines, &count);
+        if (in != stdin)
+        {
+            fclose(in);
+        }
+    }
+    if (!lines)
+    {
+        fputs("]\n", stdout);
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,1018 @@
+/*
+   +----------------------------------------------------------------------+
+   | Copyright (c) 2020 Chanth Miao                                       |
+   +----------------------------------------------------------------------+
+   | This source file is subject to the 2-Clause BSD license which is     |
+   | available through the LICENSE file, or online at                     |
+   | http://opensource.org/licenses/bsd-license.php                       |
+   +----------------------------------------------------------------------+
+   | Authors:  Chanth Miao <chanthmiao@foxmail.com>                       |
+   +----------------------------------------------------------------------+
+*/
+
+/**
+ * 解析vld的二进制记录, 并按json_patch.c的格式还原为JSON.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <inttypes.h>
+#include "vldbin.h"
+
+// 单条记录正文的上限, 防止损坏的长度字段导致巨量分配
+#define VLDBIN_MAX_BODY (1024u * 1024u * 1024u)
+
+typedef struct _vldbin_cursor
+{
+    const unsigned char *p;
+    const unsigned char *end;
+    int bad;
+} vldbin_cursor;
+
+static int vldbin_need(vldbin_cursor *c, size_t n)
+{
+    if (c->bad || (size_t)(c->end - c->p) < n)
+    {
+        c->bad = 1;
+        return 0;
+    }
+    return 1;
+}
+
+static uint8_t vldbin_u8(vldbin_cursor *c)
+{
+    if (!vldbin_need(c, 1))
+    {
+        return 0;
+    }
+    return *c->p++;
+}
+
+static uint16_t vldbin_u16(vldbin_cursor *c)
+{
+    uint16_t v;
+
+    if (!vldbin_need(c, 2))
+    {
+        return 0;
+    }
+    v = (uint16_t)(c->p[0] | (c->p[1] << 8));
+    c->p += 2;
+    return v;
+}
+
+static uint32_t vldbin_u32(vldbin_cursor *c)
+{
+    uint32_t v = 0;
+    int i;
+
+    if (!vldbin_need(c, 4))
+    {
+        return 0;
+    }
+    for (i = 3; i >= 0; i--)
+    {
+        v = (v << 8) | c->p[i];
+    }
+    c->p += 4;
+    return v;
+}
+
+static uint64_t vldbin_u64(vldbin_cursor *c)
+{
+    uint64_t v = 0;
+    int i;
+
+    if (!vldbin_need(c, 8))
+    {
+        return 0;
+    }
+    for (i = 7; i >= 0; i--)
+    {
+        v = (v << 8) | c->p[i];
+    }
+    c->p += 8;
+    return v;
+}
+
+// 读取字符串序号, 越界即视为损坏
+static uint32_t vldbin_string_id(vldbin_cursor *c, const vldbin_record *rec)
+{
+    uint32_t id = vldbin_u32(c);
+
+    if (id != VLD_BIN_NONE && id >= rec->strings_count)
+    {
+        c->bad = 1;
+    }
+    return id;
+}
+
+// 为count个元素分配内存; 每个元素在记录中至少占min_bytes字节, 据此拒绝不可能的数量
+static void *vldbin_alloc(vldbin_cursor *c, uint32_t count, size_t size, size_t min_bytes)
+{
+    void *res;
+
+    if (c->bad || (min_bytes && count > (size_t)(c->end - c->p) / min_bytes))
+    {
+        c->bad = 1;
+        return NULL;
+    }
+    res = calloc(count ? count : 1, size);
+    if (!res)
+    {
+        c->bad = 1;
+    }
+    return res;
+}
+
+static void vldbin_read_value(vldbin_cursor *c, vldbin_record *rec, vldbin_value *v)
+{
+    uint32_t i;
+    uint64_t bits;
+
+    v->tag = vldbin_u8(c);
+    switch (v->tag)
+    {
+    case VLD_BIN_VAL_NULL:
+        break;
+    case VLD_BIN_VAL_LONG:
+        v->lval = (int64_t)vldbin_u64(c);
+        break;
+    case VLD_BIN_VAL_DOUBLE:
+        bits = vldbin_u64(c);
+        memcpy(&v->dval, &bits, sizeof(bits));
+        break;
+    case VLD_BIN_VAL_STRING:
+    case VLD_BIN_VAL_TEXT:
+        v->str = vldbin_string_id(c, rec);
+        if (v->str == VLD_BIN_NONE)
+        {
+            c->bad = 1;
+        }
+        break;
+    case VLD_BIN_VAL_JMP_ARRAY:
+        v->count = vldbin_u32(c);
+        v->jmps = (vldbin_jmp *)vldbin_alloc(c, v->count, sizeof(vldbin_jmp), VLD_BIN_JMP_SIZE);
+        for (i = 0; !c->bad && i < v->count; i++)
+        {
+            v->jmps[i].key_kind = vldbin_u8(c);
+            v->jmps[i].key = (int64_t)vldbin_u64(c);
+            v->jmps[i].target = (int32_t)vldbin_u32(c);
+            if (v->jmps[i].key_kind > 1 || (v->jmps[i].key_kind == 1 && (uint64_t)v->jmps[i].key >= rec->strings_count))
+            {
+                c->bad = 1;
+            }
+        }
+        break;
+    default:
+        c->bad = 1;
+    }
+}
+
+static void vldbin_read_operand(vldbin_cursor *c, vldbin_record *rec, vldbin_operand *o)
+{
+    o->kind = vldbin_u8(c);
+    vldbin_u8(c);
+    vldbin_u16(c);
+    o->aux = vldbin_u32(c);
+    o->value = (int32_t)vldbin_u32(c);
+    switch (o->kind)
+    {
+    case VLD_BIN_KIND_CONST:
+    case VLD_BIN_KIND_CLASS:
+        if ((uint32_t)o->value >= rec->values_count || rec->values[o->value].tag == VLD_BIN_VAL_JMP_ARRAY)
+        {
+            c->bad = 1;
+        }
+        break;
+    case VLD_BIN_KIND_JMP_ARRAY:
+        if ((uint32_t)o->value >= rec->values_count || rec->values[o->value].tag != VLD_BIN_VAL_JMP_ARRAY)
+        {
+            c->bad = 1;
+        }
+        break;
+    case VLD_BIN_KIND_INCLUDE:
+        if ((uint32_t)o->value >= rec->strings_count)
+        {
+            c->bad = 1;
+        }
+        break;
+    default:
+        if (o->kind > VLD_BIN_KIND_INCLUDE)
+        {
+            c->bad = 1;
+        }
+    }
+}
+
+static void vldbin_read_branches(vldbin_cursor *c, vldbin_record *rec)
+{
+    uint32_t i, j;
+    int coverage = rec->flags & VLD_BIN_HAS_COVERAGE;
+
+    rec->paths_total = vldbin_u64(c);
+    rec->truncated = vldbin_u8(c);
+    rec->branches_count = vldbin_u32(c);
+    rec->branches = (vldbin_branch *)vldbin_alloc(c, rec->branches_count, sizeof(vldbin_branch), 21);
+    for (i = 0; !c->bad && i < rec->branches_count; i++)
+    {
+        vldbin_branch *b = &rec->branches[i];
+
+        b->start_op = vldbin_u32(c);
+        b->end_op = vldbin_u32(c);
+        b->start_line = vldbin_u32(c);
+        b->end_line = vldbin_u32(c);
+        b->hit = vldbin_u8(c);
+        b->outs_count = vldbin_u32(c);
+        b->outs = (int32_t *)vldbin_alloc(c, b->outs_count, sizeof(int32_t), 4);
+        for (j = 0; !c->bad && j < b->outs_count; j++)
+        {
+            b->outs[j] = (int32_t)vldbin_u32(c);
+        }
+        if (coverage)
+        {
+            b->outs_hit = (uint32_t *)vldbin_alloc(c, b->outs_count, sizeof(uint32_t), 4);
+            for (j = 0; !c->bad && j < b->outs_count; j++)
+            {
+                b->outs_hit[j] = vldbin_u32(c);
+            }
+        }
+    }
+
+    rec->paths_count = vldbin_u32(c);
+    rec->paths = (vldbin_path *)vldbin_alloc(c, rec->paths_count, sizeof(vldbin_path), 4);
+    for (i = 0; !c->bad && i < rec->paths_count; i++)
+    {
+        vldbin_path *path = &rec->paths[i];
+
+        path->count = vldbin_u32(c);
+        path->start_ops = (uint32_t *)vldbin_alloc(c, path->count, sizeof(uint32_t), 4);
+        for (j = 0; !c->bad && j < path->count; j++)
+        {
+            path->start_ops[j] = vldbin_u32(c);
+        }
+        if (coverage)
+        {
+            path->hit = vldbin_u32(c);
+        }
+    }
+}
+
+int vldbin_parse(const unsigned char *header, unsigned char *body, size_t len, vldbin_record *rec)
+{
+    vldbin_cursor c;
+    uint32_t i, j;
+
+    memset(rec, 0, sizeof(vldbin_record));
+    rec->data = body;
+    if (memcmp(header, VLD_BIN_MAGIC, 4) != 0)
+    {
+        return VLDBIN_BAD;
+    }
+    rec->version = (uint16_t)(header[4] | (header[5] << 8));
+    rec->flags = header[6];
+    rec->verbosity = header[7];
+    if (rec->version != VLD_BIN_VERSION)
+    {
+        return VLDBIN_VERSION;
+    }
+
+    c.p = body;
+    c.end = body + len;
+    c.bad = 0;
+
+    // 字符串表
+    rec->strings_count = vldbin_u32(&c);
+    rec->strings = (vldbin_string *)vldbin_alloc(&c, rec->strings_count, sizeof(vldbin_string), 4);
+    for (i = 0; !c.bad && i < rec->strings_count; i++)
+    {
+        rec->strings[i].len = vldbin_u32(&c);
+        if (vldbin_need(&c, rec->strings[i].len))
+        {
+            rec->strings[i].str = (const char *)c.p;
+            c.p += rec->strings[i].len;
+        }
+    }
+
+    // 常量
+    rec->values_count = vldbin_u32(&c);
+    rec->values = (vldbin_value *)vldbin_alloc(&c, rec->values_count, sizeof(vldbin_value), 1);
+    for (i = 0; !c.bad && i < rec->values_count; i++)
+    {
+        vldbin_read_value(&c, rec, &rec->values[i]);
+    }
+
+    rec->class_name = vldbin_string_id(&c, rec);
+    rec->filename = vldbin_string_id(&c, rec);
+    rec->function_name = vldbin_string_id(&c, rec);
+
+    rec->vars_count = vldbin_u32(&c);
+    rec->vars = (uint32_t *)vldbin_alloc(&c, rec->vars_count, sizeof(uint32_t), 4);
+    for (i = 0; !c.bad && i < rec->vars_count; i++)
+    {
+        rec->vars[i] = vldbin_string_id(&c, rec);
+    }
+
+    // 定长的op记录
+    rec->ops_count = vldbin_u32(&c);
+    rec->ops = (vldbin_op *)vldbin_alloc(&c, rec->ops_count, sizeof(vldbin_op), VLD_BIN_OP_SIZE);
+    for (i = 0; !c.bad && i < rec->ops_count; i++)
+    {
+        vldbin_op *op = &rec->ops[i];
+
+        op->lineno = vldbin_u32(&c);
+        op->name = vldbin_string_id(&c, rec);
+        op->fetch = vldbin_string_id(&c, rec);
+        op->ext = vldbin_u32(&c);
+        op->opcode = vldbin_u16(&c);
+        op->marks = vldbin_u8(&c);
+        op->flags = vldbin_u8(&c);
+        for (j = 0; j < 4; j++)
+        {
+            vldbin_read_operand(&c, rec, &op->operands[j]);
+        }
+    }
+
+    if (rec->flags & VLD_BIN_HAS_HITS)
+    {
+        rec->hits = (uint64_t *)vldbin_alloc(&c, rec->ops_count, sizeof(uint64_t), 8);
+        for (i = 0; !c.bad && i < rec->ops_count; i++)
+        {
+            rec->hits[i] = vldbin_u64(&c);
+        }
+    }
+    if (rec->flags & VLD_BIN_HAS_PATHS)
+    {
+        vldbin_read_branches(&c, rec);
+    }
+
+    if (c.bad || c.p != c.end)
+    {
+        return VLDBIN_BAD;
+    }
+    return VLDBIN_OK;
+}
+
+int vldbin_read(FILE *fp, vldbin_record *rec)
+{
+    unsigned char header[VLD_BIN_HEADER_SIZE];
+    unsigned char *body;
+    size_t got;
+    uint32_t len;
+
+    memset(rec, 0, sizeof(vldbin_record));
+    got = fread(header, 1, sizeof(header), fp);
+    if (got == 0 && feof(fp))
+    {
+        return VLDBIN_EOF;
+    }
+    if (got != sizeof(header) || memcmp(header, VLD_BIN_MAGIC, 4) != 0)
+    {
+        return VLDBIN_BAD;
+    }
+    len = (uint32_t)header[8] | ((uint32_t)header[9] << 8) | ((uint32_t)header[10] << 16) | ((uint32_t)header[11] << 24);
+    if (len > VLDBIN_MAX_BODY)
+    {
+        return VLDBIN_BAD;
+    }
+    body = (unsigned char *)malloc(len ? len : 1);
+    if (!body)
+    {
+        return VLDBIN_NOMEM;
+    }
+    if (fread(body, 1, len, fp) != len)
+    {
+        free(body);
+        return VLDBIN_BAD;
+    }
+    return vldbin_parse(header, body, len, rec);
+}
+
+void vldbin_free(vldbin_record *rec)
+{
+    uint32_t i;
+
+    if (rec->values)
+    {
+        for (i = 0; i < rec->values_count; i++)
+        {
+            free(rec->values[i].jmps);
+        }
+    }
+    if (rec->branches)
+    {
+        for (i = 0; i < rec->branches_count; i++)
+        {
+            free(rec->branches[i].outs);
+            free(rec->branches[i].outs_hit);
+        }
+    }
+    if (rec->paths)
+    {
+        for (i = 0; i < rec->paths_count; i++)
+        {
+            free(rec->paths[i].start_ops);
+        }
+    }
+    free(rec->strings);
+    free(rec->values);
+    free(rec->vars);
+    free(rec->ops);
+    free(rec->hits);
+    free(rec->branches);
+    free(rec->paths);
+    free(rec->data);
+    memset(rec, 0, sizeof(vldbin_record));
+}
+
+const char *vldbin_strerror(int code)
+{
+    switch (code)
+    {
+    case VLDBIN_BAD:
+        return "truncated or corrupt record";
+    case VLDBIN_VERSION:
+        return "unsupported record version";
+    case VLDBIN_NOMEM:
+        return "out of memory";
+    }
+    return "no error";
+}
+
+/* JSON输出, 与json_patch.c逐字节一致 */
+
+typedef struct _vldbin_json
+{
+    FILE *out;
+    int pretty;
+} vldbin_json;
+
+typedef struct _vldbin_json_array
+{
+    vldbin_json *json;
+    unsigned int count;
+} vldbin_json_array;
+
+static void vldbin_json_escaped(FILE *out, const char *str, size_t len)
+{
+    static const char hex[] = "0123456789abcdef";
+    size_t i;
+
+    fputc('"', out);
+    for (i = 0; i < len; i++)
+    {
+        unsigned char c = (unsigned char)str[i];
+
+        switch (c)
+        {
+        case '"':
+            fputs("\\\"", out);
+            break;
+        case '\\':
+            fputs("\\\\", out);
+            break;
+        case '\b':
+            fputs("\\b", out);
+            break;
+        case '\f':
+            fputs("\\f", out);
+            break;
+        case '\n':
+            fputs("\\n", out);
+            break;
+        case '\r':
+            fputs("\\r", out);
+            break;
+        case '\t':
+            fputs("\\t", out);
+            break;
+        default:
+            if (c > 31)
+            {
+                fputc(c, out);
+            }
+            else
+            {
+                fprintf(out, "\\u00%c%c", hex[c >> 4], hex[c & 0xf]);
+            }
+        }
+    }
+    fputc('"', out);
+}
+
+// 与php_url_encode()相同的编码, 结果写入新分配的内存
+static char *vldbin_url_encode(const char *str, size_t len, size_t *new_len)
+{
+    static const char hex[] = "0123456789ABCDEF";
+    char *res = (char *)malloc(len * 3 + 1);
+    size_t i, j = 0;
+
+    if (!res)
+    {
+        return NULL;
+    }
+    for (i = 0; i < len; i++)
+    {
+        unsigned char c = (unsigned char)str[i];
+
+        if (c == ' ')
+        {
+            res[j++] = '+';
+        }
+        else if ((c < '0' && c != '-' && c != '.') || (c < 'A' && c > '9') || (c > 'Z' && c < 'a' && c != '_') || (c > 'z'))
+        {
+            res[j++] = '%';
+            res[j++] = hex[c >> 4];
+            res[j++] = hex[c & 15];
+        }
+        else
+        {
+            res[j++] = (char)c;
+        }
+    }
+    res[j] = '\0';
+    *new_len = j;
+    return res;
+}
+
+static void vldbin_json_double(FILE *out, double number)
+{
+    char tmp[32];
+    char *p;
+    double test = 0.0;
+
+    if (isnan(number) || isinf(number))
+    {
+        fputs("null", out);
+        return;
+    }
+    snprintf(tmp, sizeof(tmp), "%1.15g", number);
+    if (sscanf(tmp, "%lg", &test) != 1 || test != number)
+    {
+        snprintf(tmp, sizeof(tmp), "%1.17g", number);
+    }
+    for (p = tmp; *p; p++)
+    {
+        if (*p == ',')
+        {
+            *p = '.';
+        }
+    }
+    fputs(tmp, out);
+}
+
+static void vldbin_json_indent(vldbin_json *json, int depth)
+{
+    int i;
+
+    for (i = 0; i < depth; i++)
+    {
+        fputc('\t', json->out);
+    }
+}
+
+static void vldbin_json_key(vldbin_json *json, int depth, const char *key, int first)
+{
+    if (!first)
+    {
+        fputc(',', json->out);
+    }
+    if (json->pretty)
+    {
+        if (!first)
+        {
+            fputc('\n', json->out);
+        }
+        vldbin_json_indent(json, depth);
+    }
+    vldbin_json_escaped(json->out, key, strlen(key));
+    fputs(json->pretty ? ":\t" : ":", json->out);
+}
+
+static void vldbin_json_object_open(vldbin_json *json)
+{
+    fputs(json->pretty ? "{\n" : "{", json->out);
+}
+
+static void vldbin_json_object_close(vldbin_json *json, int depth)
+{
+    if (json->pretty)
+    {
+        fputc('\n', json->out);
+        vldbin_json_indent(json, depth);
+    }
+    fputc('}', json->out);
+}
+
+// 开始一个数组成员
+static FILE *vldbin_json_elem(vldbin_json_array *array)
+{
+    if (array->count++)
+    {
+        fputs(array->json->pretty ? ", " : ",", array->json->out);
+    }
+    return array->json->out;
+}
+
+static void vldbin_json_array_open(vldbin_json *json, vldbin_json_array *array)
+{
+    fputc('[', json->out);
+    array->json = json;
+    array->count = 0;
+}
+
+static void vldbin_json_array_close(vldbin_json_array *array)
+{
+    fputc(']', array->json->out);
+}
+
+static void vldbin_json_null(vldbin_json_array *array)
+{
+    fputs("null", vldbin_json_elem(array));
+}
+
+static void vldbin_json_long(vldbin_json_array *array, int64_t number)
+{
+    fprintf(vldbin_json_elem(array), "%" PRId64, number);
+}
+
+static void vldbin_json_cstring(vldbin_json_array *array, const char *str)
+{
+    vldbin_json_escaped(vldbin_json_elem(array), str, strlen(str));
+}
+
+static void vldbin_json_string(vldbin_json_array *array, const vldbin_record *rec, uint32_t id)
+{
+    if (id == VLD_BIN_NONE)
+    {
+        vldbin_json_null(array);
+        return;
+    }
+    vldbin_json_escaped(vldbin_json_elem(array), rec->strings[id].str, rec->strings[id].len);
+}
+
+static void vldbin_json_value(vldbin_json_array *array, const vldbin_record *rec, const vldbin_value *v)
+{
+    const vldbin_string *s;
+    char *enc;
+    size_t enc_len;
+
+    switch (v->tag)
+    {
+    case VLD_BIN_VAL_LONG:
+        vldbin_json_long(array, v->lval);
+        break;
+    case VLD_BIN_VAL_DOUBLE:
+        vldbin_json_double(vldbin_json_elem(array), v->dval);
+        break;
+    case VLD_BIN_VAL_STRING:
+        s = &rec->strings[v->str];
+        enc = vldbin_url_encode(s->str, s->len, &enc_len);
+        if (enc)
+        {
+            vldbin_json_escaped(vldbin_json_elem(array), enc, enc_len);
+            free(enc);
+        }
+        else
+        {
+            vldbin_json_null(array);
+        }
+        break;
+    case VLD_BIN_VAL_TEXT:
+        vldbin_json_string(array, rec, v->str);
+        break;
+    default:
+        vldbin_json_null(array);
+    }
+}
+
+static void vldbin_json_jmp_array(vldbin_json_array *array, const vldbin_record *rec, const vldbin_value *v)
+{
+    vldbin_json_array list;
+    uint32_t i;
+    char buf[128];
+
+    vldbin_json_elem(array);
+    vldbin_json_array_open(array->json, &list);
+    for (i = 0; i < v->count; i++)
+    {
+        const vldbin_jmp *jmp = &v->jmps[i];
+
+        if (jmp->key_kind == 0)
+        {
+            snprintf(buf, sizeof(buf), "%" PRId64 ":->%d, ", jmp->key, jmp->target);
+            vldbin_json_cstring(&list, buf);
+        }
+        else
+        {
+            const vldbin_string *s = &rec->strings[jmp->key];
+            size_t enc_len;
+            char *enc = vldbin_url_encode(s->str, s->len, &enc_len);
+            char *text = enc ? (char *)malloc(enc_len + 32) : NULL;
+
+            if (text)
+            {
+                snprintf(text, enc_len + 32, "'%s':->%d, ", enc, jmp->target);
+                vldbin_json_cstring(&list, text);
+            }
+            else
+            {
+                vldbin_json_null(&list);
+            }
+            free(text);
+            free(enc);
+        }
+    }
+    vldbin_json_array_close(&list);
+}
+
+// 对应vld_json_dump_znode()中的类型列
+static void vldbin_json_operand_type(vldbin_json_array *array, const vldbin_operand *o)
+{
+    static const char *type_names[] = {NULL, "IS_UNUSED", NULL, "IS_TMP_VAR", "IS_VAR", "IS_CV", "IS_OPNUM", "IS_OPLINE", "IS_CLASS", "IS_JMP_ARRAY", "EXT_JMP_ABS", "EXT_JMP_REL", "OP2_INCLUDE"};
+    char buf[64];
+
+    if (o->kind == VLD_BIN_KIND_CONST)
+    {
+        snprintf(buf, sizeof(buf), "IS_CONST (%d)", (int)o->aux);
+        vldbin_json_cstring(array, buf);
+    }
+    else if (type_names[o->kind])
+    {
+        vldbin_json_cstring(array, type_names[o->kind]);
+    }
+    else
+    {
+        vldbin_json_null(array);
+    }
+}
+
+// 对应vld_json_dump_znode()中的值列
+static void vldbin_json_operand_value(vldbin_json_array *array, const vldbin_record *rec, const vldbin_operand *o)
+{
+    char buf[64];
+
+    switch (o->kind)
+    {
+    case VLD_BIN_KIND_CONST:
+    case VLD_BIN_KIND_CLASS:
+        vldbin_json_value(array, rec, &rec->values[o->value]);
+        break;
+    case VLD_BIN_KIND_TMP:
+        snprintf(buf, sizeof(buf), "~%d", o->value);
+        vldbin_json_cstring(array, buf);
+        break;
+    case VLD_BIN_KIND_VAR:
+        snprintf(buf, sizeof(buf), "$%d", o->value);
+        vldbin_json_cstring(array, buf);
+        break;
+    case VLD_BIN_KIND_CV:
+        snprintf(buf, sizeof(buf), "!%d", o->value);
+        vldbin_json_cstring(array, buf);
+        break;
+    case VLD_BIN_KIND_OPNUM:
+    case VLD_BIN_KIND_OPLINE:
+    case VLD_BIN_KIND_JMP_ABS:
+    case VLD_BIN_KIND_JMP_REL:
+        snprintf(buf, sizeof(buf), "->%d", o->value);
+        vldbin_json_cstring(array, buf);
+        break;
+    case VLD_BIN_KIND_JMP_ARRAY:
+        vldbin_json_jmp_array(array, rec, &rec->values[o->value]);
+        break;
+    case VLD_BIN_KIND_INCLUDE:
+        vldbin_json_string(array, rec, (uint32_t)o->value);
+        break;
+    default:
+        vldbin_json_null(array);
+    }
+}
+
+// "ops"对象的各列, 与json_patch.c中的op_cols一致
+static const char *vldbin_op_cols[] = {"line", "#", "*", "E", "I", "O", "op_code", "op", "fetch", "ext", "return_type", "return", "op1_type", "op1", "op2_type", "op2", "ext_op_type", "ext_op", "hits"};
+static const int vldbin_verbosity_flags[] = {1, 1, 1, 1, 1, 1, 3, 1, 1, 1, 3, 1, 3, 1, 3, 1, 3, 1, 1};
+static const char *vldbin_branch_cols[] = {"sline", "eline", "sop", "eop", "outs", "hit", "outs_hit"};
+
+#define VLDBIN_OP_COLS (sizeof(vldbin_op_cols) / sizeof(vldbin_op_cols[0]))
+#define VLDBIN_BRANCH_COLS (sizeof(vldbin_branch_cols) / sizeof(vldbin_branch_cols[0]))
+#define VLDBIN_HITS_COL 18
+
+// 写出"ops"对象的第col列
+static void vldbin_json_op_col(vldbin_json *json, const vldbin_record *rec, unsigned int col)
+{
+    static const char *marks[] = {"*", "E", ">", ">"};
+    vldbin_json_array array;
+    uint32_t i, last_lineno = (uint32_t)-1;
+
+    vldbin_json_array_open(json, &array);
+    for (i = 0; i < rec->ops_count; i++)
+    {
+        const vldbin_op *op = &rec->ops[i];
+
+        switch (col)
+        {
+        case 0:
+            if (op->lineno == last_lineno)
+            {
+                vldbin_json_null(&array);
+            }
+            else
+            {
+                vldbin_json_long(&array, op->lineno);
+                last_lineno = op->lineno;
+            }
+            break;
+        case 1:
+            vldbin_json_long(&array, i);
+            break;
+        case 2:
+        case 3:
+        case 4:
+        case 5:
+            if (op->marks & (1 << (col - 2)))
+            {
+                vldbin_json_cstring(&array, marks[col - 2]);
+            }
+            else
+            {
+                vldbin_json_null(&array);
+            }
+            break;
+        case 6:
+            vldbin_json_long(&array, op->opcode);
+            break;
+        case 7:
+            vldbin_json_string(&array, rec, op->name);
+            break;
+        case 8:
+            vldbin_json_string(&array, rec, op->fetch);
+            break;
+        case 9:
+            if (op->flags & VLD_BIN_OP_EXT_LAST)
+            {
+                vldbin_json_cstring(&array, "last");
+            }
+            else if (op->flags & VLD_BIN_OP_EXT)
+            {
+                vldbin_json_long(&array, op->ext);
+            }
+            else
+            {
+                vldbin_json_null(&array);
+            }
+            break;
+        case VLDBIN_HITS_COL:
+            vldbin_json_long(&array, rec->hits ? (int64_t)rec->hits[i] : 0);
+            break;
+        default:
+            // 10至17为result, op1, op2与ext_op的类型列和值列
+            if (col % 2 == 0)
+            {
+                vldbin_json_operand_type(&array, &op->operands[(col - 10) / 2]);
+            }
+            else
+            {
+                vldbin_json_operand_value(&array, rec, &op->operands[(col - 10) / 2]);
+            }
+        }
+    }
+    vldbin_json_array_close(&array);
+}
+
+// 写出"branch"对象的第col列
+static void vldbin_json_branch_col(vldbin_json *json, const vldbin_record *rec, unsigned int col)
+{
+    vldbin_json_array array, outs;
+    uint32_t i, j;
+
+    vldbin_json_array_open(json, &array);
+    for (i = 0; i < rec->branches_count; i++)
+    {
+        const vldbin_branch *b = &rec->branches[i];
+
+        switch (col)
+        {
+        case 0:
+            vldbin_json_long(&array, b->start_line);
+            break;
+        case 1:
+            vldbin_json_long(&array, b->end_line);
+            break;
+        case 2:
+            vldbin_json_long(&array, b->start_op);
+            break;
+        case 3:
+            vldbin_json_long(&array, b->end_op);
+            break;
+        case 5:
+            vldbin_json_long(&array, b->hit ? 1 : 0);
+            break;
+        default:
+            vldbin_json_elem(&array);
+            vldbin_json_array_open(json, &outs);
+            for (j = 0; j < b->outs_count; j++)
+            {
+                vldbin_json_long(&outs, col == 4 ? b->outs[j] : (b->outs_hit ? (int32_t)b->outs_hit[j] : 0));
+            }
+            vldbin_json_array_close(&outs);
+        }
+    }
+    vldbin_json_array_close(&array);
+}
+
+// 以json_patch.c的格式写出一条记录, 不含其后的分隔符
+void vldbin_to_json(const vldbin_record *rec, FILE *out, int pretty)
+{
+    vldbin_json json;
+    vldbin_json_array array, path;
+    uint32_t i, j;
+    int coverage = rec->flags & VLD_BIN_HAS_COVERAGE;
+    int first;
+
+    json.out = out;
+    json.pretty = pretty;
+
+    vldbin_json_object_open(&json);
+    vldbin_json_key(&json, 1, "class", 1);
+    array.json = &json;
+    array.count = 0;
+    vldbin_json_string(&array, rec, rec->class_name);
+    vldbin_json_key(&json, 1, "filename", 0);
+    array.count = 0;
+    vldbin_json_string(&array, rec, rec->filename);
+    vldbin_json_key(&json, 1, "function name", 0);
+    array.count = 0;
+    vldbin_json_string(&array, rec, rec->function_name);
+    vldbin_json_key(&json, 1, "number of ops", 0);
+    fprintf(out, "%" PRIu32, rec->ops_count);
+
+    vldbin_json_key(&json, 1, "compiled vars", 0);
+    vldbin_json_array_open(&json, &array);
+    for (i = 0; i < rec->vars_count; i++)
+    {
+        vldbin_json_string(&array, rec, rec->vars[i]);
+    }
+    vldbin_json_array_close(&array);
+
+    vldbin_json_key(&json, 1, "ops", 0);
+    vldbin_json_object_open(&json);
+    first = 1;
+    for (i = 0; i < VLDBIN_OP_COLS; i++)
+    {
+        if (rec->verbosity < vldbin_verbosity_flags[i] || (i == VLDBIN_HITS_COL && !(rec->flags & VLD_BIN_HAS_HITS)))
+        {
+            continue;
+        }
+        vldbin_json_key(&json, 2, vldbin_op_cols[i], first);
+        vldbin_json_op_col(&json, rec, i);
+        first = 0;
+    }
+    vldbin_json_object_close(&json, 1);
+
+    if (rec->flags & VLD_BIN_HAS_PATHS)
+    {
+        vldbin_json_key(&json, 1, "paths_total_estimate", 0);
+        fprintf(out, "%" PRIu64, rec->paths_total > (uint64_t)INT64_MAX ? (uint64_t)INT64_MAX : rec->paths_total);
+        vldbin_json_key(&json, 1, "truncated", 0);
+        fputs(rec->truncated ? "true" : "false", out);
+
+        vldbin_json_key(&json, 1, "path", 0);
+        vldbin_json_array_open(&json, &array);
+        for (i = 0; i < rec->paths_count; i++)
+        {
+            vldbin_json_elem(&array);
+            vldbin_json_array_open(&json, &path);
+            for (j = 0; j < rec->paths[i].count; j++)
+            {
+                vldbin_json_long(&path, rec->paths[i].start_ops[j]);
+            }
+            vldbin_json_array_close(&path);
+        }
+        vldbin_json_array_close(&array);
+        if (coverage)
+        {
+            vldbin_json_key(&json, 1, "path_hit", 0);
+            vldbin_json_array_open(&json, &array);
+            for (i = 0; i < rec->paths_count; i++)
+            {
+                vldbin_json_long(&array, (int32_t)rec->paths[i].hit);
+            }
+            vldbin_json_array_close(&array);
+        }
+
+        vldbin_json_key(&json, 1, "branch", 0);
+        vldbin_json_object_open(&json);
+        for (i = 0; i < VLDBIN_BRANCH_COLS; i++)
+        {
+            // 最后两列仅在vld.coverage开启时存在
+            if (i < 5 || coverage)
+            {
+                vldbin_json_key(&json, 2, vldbin_branch_cols[i], i == 0);
+                vldbin_json_branch_col(&json, rec, i);
+            }
+        }
+        vldbin_json_object_close(&json, 1);
+    }
+    vldbin_json_object_close(&json, 0);
+}
@@ -0,0 +1,128 @@
+/*
+   +----------------------------------------------------------------------+
+   | Copyright (c) 2020 Chanth Miao                                       |
+   +----------------------------------------------------------------------+
+   | This source file is subject to the 2-Clause BSD license which is     |
+   | available through the LICENSE file, or online at                     |
+   | http://opensource.org/licenses/bsd-license.php                       |
+   +----------------------------------------------------------------------+
+   | Authors:  Chanth Miao <chanthmiao@foxmail.com>                       |
+   +----------------------------------------------------------------------+
+*/
+
+/**
+ * vld 二进制转储(vld.formats=binary)的读取库, 不依赖PHP.
+ * 记录的格式见上级目录的binary.h.
+*/
+
+#ifndef VLDBIN_H
+#define VLDBIN_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include "../binary.h"
+
+// vldbin_read()的返回值
+#define VLDBIN_OK 1
+#define VLDBIN_EOF 0
+#define VLDBIN_BAD -1     // 记录不完整或已损坏
+#define VLDBIN_VERSION -2 // 不支持的版本
+#define VLDBIN_NOMEM -3
+
+typedef struct _vldbin_string
+{
+    const char *str; // 指向记录内部, 不以'\0'结尾
+    uint32_t len;
+} vldbin_string;
+
+typedef struct _vldbin_jmp
+{
+    uint8_t key_kind; // 0: 整数键, 1: 字符串键(key为字符串序号)
+    int64_t key;
+    int32_t target;
+} vldbin_jmp;
+
+typedef struct _vldbin_value
+{
+    uint8_t tag; // VLD_BIN_VAL_*
+    int64_t lval;
+    double dval;
+    uint32_t str;
+    uint32_t count;
+    vldbin_jmp *jmps;
+} vldbin_value;
+
+typedef struct _vldbin_operand
+{
+    uint8_t kind; // VLD_BIN_KIND_*
+    uint32_t aux;
+    int32_t value;
+} vldbin_operand;
+
+typedef struct _vldbin_op
+{
+    uint32_t lineno;
+    uint32_t name;
+    uint32_t fetch;
+    uint32_t ext;
+    uint16_t opcode;
+    uint8_t marks;
+    uint8_t flags;
+    vldbin_operand operands[4]; // result, op1, op2, ext_op
+} vldbin_op;
+
+typedef struct _vldbin_branch
+{
+    uint32_t start_op;
+    uint32_t end_op;
+    uint32_t start_line;
+    uint32_t end_line;
+    uint8_t hit;
+    uint32_t outs_count;
+    int32_t *outs;
+    uint32_t *outs_hit; // 仅当含有VLD_BIN_HAS_COVERAGE
+} vldbin_branch;
+
+typedef struct _vldbin_path
+{
+    uint32_t count;
+    uint32_t *start_ops;
+    uint32_t hit;
+} vldbin_path;
+
+// 一个op_array的完整记录
+typedef struct _vldbin_record
+{
+    uint16_t version;
+    uint8_t flags;
+    uint8_t verbosity;
+    uint32_t strings_count;
+    vldbin_string *strings;
+    uint32_t values_count;
+    vldbin_value *values;
+    uint32_t class_name;
+    uint32_t filename;
+    uint32_t function_name;
+    uint32_t vars_count;
+    uint32_t *vars;
+    uint32_t ops_count;
+    vldbin_op *ops;
+    uint64_t *hits; // 仅当含有VLD_BIN_HAS_HITS
+    uint64_t paths_total;
+    uint8_t truncated;
+    uint32_t branches_count;
+    vldbin_branch *branches;
+    uint32_t paths_count;
+    vldbin_path *paths;
+    unsigned char *data; // 记录正文, 字符串均指向此处
+} vldbin_record;
+
+// 读取下一条记录; 无论成功与否, 之后都应调用vldbin_free()
+int vldbin_read(FILE *fp, vldbin_record *rec);
+// body须由malloc()分配, 解析后归rec所有, 由vldbin_free()释放
+int vldbin_parse(const unsigned char *header, unsigned char *body, size_t len, vldbin_record *rec);
+void vldbin_free(vldbin_record *rec);
+const char *vldbin_strerror(int code);
+void vldbin_to_json(const vldbin_record *rec, FILE *out, int pretty);
+
+#endif /*VLDBIN_H*/
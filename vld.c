@@ -21,8 +21,22 @@
 #include "ext/standard/url.h"
 #include "php_vld.h"
 #include "srm_oparray.h"
+#include "arena.h"
+#include "cache.h"
+#include "profile.h"
+#include "symbols.h"
+#include "coverage.h"
 #include "php_globals.h"
+#include "zend_exceptions.h"
 
+#ifndef PHP_WIN32
+# include <fcntl.h>
+# include <unistd.h>
+# include <sys/wait.h>
+#endif
+
+/* The original hooks are stored once, at module startup, and are only read
+ * after that, so they are shared safely by all threads. */
 static zend_op_array* (*old_compile_file)(zend_file_handle* file_handle, int type);
 static zend_op_array* vld_compile_file(zend_file_handle*, int);
 
@@ -33,16 +47,57 @@ static void (*old_execute_ex)(zend_execute_data *execute_data);
 static void vld_execute_ex(zend_execute_data *execute_data);
 
 /* {{{ forward declarations */
+static PHP_GINIT_FUNCTION(vld);
+static PHP_GSHUTDOWN_FUNCTION(vld);
 static int vld_check_fe (zend_op_array *fe, zend_bool *have_fe);
-static int vld_dump_fe (zend_op_array *fe, int num_args, va_list args, zend_hash_key *hash_key);
+static int vld_dump_fe (zend_op_array *fe, zend_hash_key *hash_key);
 static int vld_dump_cle (zend_class_entry *class_entry);
+static void vld_dump_new_symbols (void);
+static void vld_dump_profiled (void);
+static int vld_save_begin (zend_op_array *op_array);
+static void vld_save_end (int keep);
 /* }}} */
 
+/* {{{ arginfo */
+ZEND_BEGIN_ARG_INFO_EX(arginfo_vld_dump_files, 0, 0, 1)
+	ZEND_ARG_ARRAY_INFO(0, paths, 0)
+	ZEND_ARG_ARRAY_INFO(0, options, 0)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_vld_inspect_file, 0, 0, 1)
+	ZEND_ARG_INFO(0, path)
+	ZEND_ARG_ARRAY_INFO(0, options, 0)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_vld_inspect_code, 0, 0, 1)
+	ZEND_ARG_INFO(0, code)
+	ZEND_ARG_ARRAY_INFO(0, options, 0)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_vld_scan_files, 0, 0, 2)
+	ZEND_ARG_ARRAY_INFO(0, paths, 0)
+	ZEND_ARG_INFO(0, output)
+	ZEND_ARG_INFO(0, workers)
+	ZEND_ARG_ARRAY_INFO(0, options, 0)
+ZEND_END_ARG_INFO()
+/* }}} */
+
+PHP_FUNCTION(vld_dump_files);
+PHP_FUNCTION(vld_scan_files);
+PHP_FUNCTION(vld_inspect_file);
+PHP_FUNCTION(vld_inspect_code);
+
 zend_function_entry vld_functions[] = {
+	PHP_FE(vld_dump_files, arginfo_vld_dump_files)
+	PHP_FE(vld_scan_files, arginfo_vld_scan_files)
+	PHP_FE(vld_inspect_file, arginfo_vld_inspect_file)
+	PHP_FE(vld_inspect_code, arginfo_vld_inspect_code)
 	ZEND_FE_END
 };
 
 
+ZEND_DECLARE_MODULE_GLOBALS(vld)
+
 zend_module_entry vld_module_entry = {
 	STANDARD_MODULE_HEADER,
 	"vld",
@@ -53,15 +108,55 @@ zend_module_entry vld_module_entry = {
 	PHP_RSHUTDOWN(vld),
 	PHP_MINFO(vld),
 	"0.16.0",
-	STANDARD_MODULE_PROPERTIES
+	PHP_MODULE_GLOBALS(vld),
+	PHP_GINIT(vld),
+	PHP_GSHUTDOWN(vld),
+	NULL,
+	STANDARD_MODULE_PROPERTIES_EX
 };
 
 
 #ifdef COMPILE_DL_VLD
+# ifdef ZTS
+ZEND_TSRMLS_CACHE_DEFINE()
+# endif
 ZEND_GET_MODULE(vld)
 #endif
 
-ZEND_DECLARE_MODULE_GLOBALS(vld)
+/* {{{ PHP_INI_MH(OnUpdateFormats) */
+static PHP_INI_MH(OnUpdateFormats)
+{
+	int mask = vld_emitters_parse(ZSTR_VAL(new_value));
+
+	if (mask < 0) {
+		return FAILURE;
+	}
+	VLD_G(formats_mask) = mask;
+	return OnUpdateString(entry, new_value, mh_arg1, mh_arg2, mh_arg3, stage);
+}
+
+static PHP_INI_MH(OnUpdateJsonFields)
+{
+	int mask = vld_json_fields_parse(ZSTR_VAL(new_value));
+
+	if (mask < 0) {
+		return FAILURE;
+	}
+	VLD_G(json_fields_mask) = mask;
+	return OnUpdateString(entry, new_value, mh_arg1, mh_arg2, mh_arg3, stage);
+}
+
+static PHP_INI_MH(OnUpdateCompression)
+{
+	int codec = vld_output_compression_parse(ZSTR_VAL(new_value));
+
+	if (codec < 0) {
+		return FAILURE;
+	}
+	VLD_G(output_codec) = codec;
+	return OnUpdateString(entry, new_value, mh_arg1, mh_arg2, mh_arg3, stage);
+}
+/* }}} */
 
 PHP_INI_BEGIN()
     STD_PHP_INI_ENTRY("vld.active",       "0", PHP_INI_SYSTEM, OnUpdateBool, active,       zend_vld_globals, vld_globals)
@@ -73,12 +168,32 @@ PHP_INI_BEGIN()
     STD_PHP_INI_ENTRY("vld.col_sep",      "\t", PHP_INI_SYSTEM, OnUpdateString, col_sep,   zend_vld_globals, vld_globals)
 	STD_PHP_INI_ENTRY("vld.save_dir",     "/tmp", PHP_INI_SYSTEM, OnUpdateString, save_dir, zend_vld_globals, vld_globals)
 	STD_PHP_INI_ENTRY("vld.save_paths",   "0", PHP_INI_SYSTEM, OnUpdateBool, save_paths,   zend_vld_globals, vld_globals)
+	STD_PHP_INI_ENTRY("vld.save_per_file", "0", PHP_INI_SYSTEM, OnUpdateBool, save_per_file, zend_vld_globals, vld_globals)
 	STD_PHP_INI_ENTRY("vld.dump_paths",   "1", PHP_INI_SYSTEM, OnUpdateBool, dump_paths,   zend_vld_globals, vld_globals)
+	STD_PHP_INI_ENTRY("vld.path_mode",   "0", PHP_INI_SYSTEM, OnUpdateLong, path_mode,   zend_vld_globals, vld_globals)
+	STD_PHP_INI_ENTRY("vld.path_limit",  "256", PHP_INI_SYSTEM, OnUpdateLong, path_limit, zend_vld_globals, vld_globals)
+	STD_PHP_INI_ENTRY("vld.path_time_limit", "0", PHP_INI_SYSTEM, OnUpdateLong, path_time_limit, zend_vld_globals, vld_globals)
+	STD_PHP_INI_ENTRY("vld.path_budget", "0", PHP_INI_SYSTEM, OnUpdateLong, path_budget, zend_vld_globals, vld_globals)
 	STD_PHP_INI_ENTRY("vld.dump_json",   "0", PHP_INI_SYSTEM, OnUpdateBool, dump_json,   zend_vld_globals, vld_globals)
+	STD_PHP_INI_ENTRY("vld.json_lines",  "0", PHP_INI_SYSTEM, OnUpdateBool, json_lines,  zend_vld_globals, vld_globals)
+	STD_PHP_INI_ENTRY("vld.json_intern", "0", PHP_INI_SYSTEM, OnUpdateBool, json_intern, zend_vld_globals, vld_globals)
+	STD_PHP_INI_ENTRY("vld.json_fields", "", PHP_INI_SYSTEM, OnUpdateJsonFields, json_fields, zend_vld_globals, vld_globals)
+	STD_PHP_INI_ENTRY("vld.output",      "", PHP_INI_SYSTEM, OnUpdateString, output, zend_vld_globals, vld_globals)
+	STD_PHP_INI_ENTRY("vld.output_compression", "", PHP_INI_SYSTEM, OnUpdateCompression, output_compression, zend_vld_globals, vld_globals)
+	STD_PHP_INI_ENTRY("vld.output_compression_level", "0", PHP_INI_SYSTEM, OnUpdateLong, output_compression_level, zend_vld_globals, vld_globals)
+	STD_PHP_INI_ENTRY("vld.formats",     "", PHP_INI_SYSTEM, OnUpdateFormats, formats, zend_vld_globals, vld_globals)
+	STD_PHP_INI_ENTRY("vld.cache_dir",   "", PHP_INI_SYSTEM, OnUpdateString, cache_dir, zend_vld_globals, vld_globals)
+	STD_PHP_INI_ENTRY("vld.profile",     "0", PHP_INI_SYSTEM, OnUpdateBool, profile,     zend_vld_globals, vld_globals)
+	STD_PHP_INI_ENTRY("vld.coverage",    "0", PHP_INI_SYSTEM, OnUpdateBool, coverage,    zend_vld_globals, vld_globals)
 PHP_INI_END()
  
-static void vld_init_globals(zend_vld_globals *vg)
+static PHP_GINIT_FUNCTION(vld)
 {
+	zend_vld_globals *vg = vld_globals;
+
+#if defined(COMPILE_DL_VLD) && defined(ZTS)
+	ZEND_TSRMLS_CACHE_UPDATE();
+#endif
 	vg->active       = 0;
 	vg->skip_prepend = 0;
 	vg->skip_append  = 0;
@@ -87,24 +202,93 @@ static void vld_init_globals(zend_vld_globals *vg)
 	vg->col_sep      = (char*) "\t";
 	vg->path_dump_file = NULL;
 	vg->dump_paths   = 1;
+	vg->path_mode    = 0;
+	vg->path_limit   = 256;
+	vg->path_time_limit = 0;
+	vg->path_budget  = 0;
+	vg->path_budget_used = 0;
 	vg->save_paths   = 0;
+	vg->save_per_file = 0;
+	vg->save_outer_dot = NULL;
+	memset(vg->save_files, 0, sizeof(vg->save_files));
 	vg->verbosity    = 1;
 	vg->dump_json    = 0;
+	vg->json_lines   = 0;
+	vg->json_intern  = 0;
+	vg->json_fields  = (char*) "";
+	vg->json_fields_mask = 0;
+	vg->formats      = (char*) "";
+	vg->formats_mask = 0;
 	vg->json_data    = json_patch_init();
+	vg->arena        = NULL;
+	vg->output       = (char*) "";
+	vg->output_compression = (char*) "";
+	vg->output_codec = VLD_COMPRESS_NONE;
+	vg->output_compression_level = 0;
+	memset(vg->output_sinks, 0, sizeof(vg->output_sinks));
+	memset(vg->output_channels, 0, sizeof(vg->output_channels));
+	memset(&vg->output_file_sink, 0, sizeof(vg->output_file_sink));
+	memset(vg->output_saved, 0, sizeof(vg->output_saved));
+	vg->cache_dir    = (char*) "";
+	vg->cache_key    = NULL;
+	vg->cache_discard = 0;
+	vg->inspect      = NULL;
+	vg->profile      = 0;
+	vg->profile_units = NULL;
+	vg->profile_units_count = 0;
+	vg->coverage     = 0;
+	vg->coverage_stack = NULL;
+	vg->coverage_stack_top = 0;
+	vg->coverage_stack_size = 0;
+	memset(&vg->cache_out, 0, sizeof(smart_str));
+	memset(&vg->cache_err, 0, sizeof(smart_str));
 }
 
+static PHP_GSHUTDOWN_FUNCTION(vld)
+{
+	json_patch_free(vld_globals->json_data);
+	vld_globals->json_data = NULL;
+}
 
+
+/* The hooks are process wide. They are installed here rather than for every
+ * request, as replacing them while other threads are compiling or running
+ * code is not safe. All vld.* settings are PHP_INI_SYSTEM, so whether they
+ * are needed is known now. */
 PHP_MINIT_FUNCTION(vld)
 {
-	ZEND_INIT_MODULE_GLOBALS(vld, vld_init_globals, NULL);
 	REGISTER_INI_ENTRIES();
 
+	old_compile_file   = zend_compile_file;
+	old_compile_string = zend_compile_string;
+	old_execute_ex     = zend_execute_ex;
+
+	if (VLD_RUNTIME()) {
+		vld_profile_minit();
+	}
+	if (VLD_G(coverage) && VLD_G(execute)) {
+		vld_coverage_minit(old_execute_ex);
+		zend_execute_ex = vld_coverage_execute_ex;
+	}
+
+	if (VLD_G(active)) {
+		zend_compile_file   = vld_compile_file;
+		zend_compile_string = vld_compile_string;
+		if (!VLD_G(execute)) {
+			zend_execute_ex = vld_execute_ex;
+		}
+	}
+
 	return SUCCESS;
 }
 
 
 PHP_MSHUTDOWN_FUNCTION(vld)
 {
+	if (VLD_RUNTIME()) {
+		vld_profile_mshutdown();
+	}
+
 	UNREGISTER_INI_ENTRIES();
 
 	zend_compile_file   = old_compile_file;
@@ -118,30 +302,34 @@ PHP_MSHUTDOWN_FUNCTION(vld)
 
 PHP_RINIT_FUNCTION(vld)
 {
-	old_compile_file = zend_compile_file;
-	old_compile_string = zend_compile_string;
-	old_execute_ex = zend_execute_ex;
+#if defined(COMPILE_DL_VLD) && defined(ZTS)
+	ZEND_TSRMLS_CACHE_UPDATE();
+#endif
 
-	if (VLD_G(active)) {
-		zend_compile_file = vld_compile_file;
-		zend_compile_string = vld_compile_string;
-		if (!VLD_G(execute)) {
-			zend_execute_ex = vld_execute_ex;
-		}
-		if (VLD_G(dump_json))
-		{
-			if (VLD_G(format))
-			{
-				fprintf(stdout, "[\n");
-			}
-			else
-			{
-				fprintf(stdout, "[");
-			}
+	VLD_G(path_budget_used)   = 0;
+	vld_symbols_rinit();
+
+	if (VLD_RUNTIME()) {
+		vld_profile_rinit();
+	}
+	if (VLD_G(coverage)) {
+		vld_coverage_rinit();
+	}
+
+	/* vld.formats takes over from vld.dump_json and vld.save_paths */
+	if (VLD_G(formats_mask)) {
+		VLD_G(dump_json) = (VLD_G(formats_mask) & VLD_EMIT_JSON) ? 1 : 0;
+		if (VLD_G(formats_mask) & VLD_EMIT_DOT) {
+			VLD_G(save_paths) = 1;
 		}
 	}
 
-	if (VLD_G(save_paths)) {
+	if (VLD_G(active) && VLD_G(dump_json)) {
+		vld_json_document_open();
+	}
+
+	/* With vld.save_per_file, every file gets a DOT file of its own instead */
+	if (VLD_G(save_paths) && !VLD_G(save_per_file)) {
 		char *filename;
 
 		filename = malloc(strlen("paths.dot") + strlen(VLD_G(save_dir)) + 2);
@@ -161,21 +349,41 @@ PHP_RINIT_FUNCTION(vld)
 
 PHP_RSHUTDOWN_FUNCTION(vld)
 {
-	zend_compile_file   = old_compile_file;
-	zend_compile_string = old_compile_string;
-	zend_execute_ex     = old_execute_ex;
+	if (VLD_RUNTIME()) {
+		vld_dump_profiled();
+		vld_profile_rshutdown();
+	}
+	if (VLD_G(coverage)) {
+		vld_coverage_rshutdown();
+	}
+
+	/* A bailout half way through the dump of a file leaves its files incomplete */
+	vld_save_end(0);
 
 	if (VLD_G(path_dump_file)) {
 		fprintf(VLD_G(path_dump_file), "}\n");
 		fclose(VLD_G(path_dump_file));
 	}
 
-	if (VLD_G(dump_json))
-	{
-		fprintf(stdout, "]\n");
-		json_patch_free();
+	if (VLD_G(arena)) {
+		vld_arena_free(VLD_G(arena));
+		VLD_G(arena) = NULL;
+	}
+
+	/* A bailout half way through a dump leaves an incomplete entry behind */
+	if (VLD_G(cache_key)) {
+		efree(VLD_G(cache_key));
+		VLD_G(cache_key) = NULL;
+		smart_str_free(&VLD_G(cache_out));
+		smart_str_free(&VLD_G(cache_err));
 	}
 
+	vld_json_document_close();
+	vld_json_strings_reset();
+	vld_json_pool_clear();
+	vld_output_close();
+	vld_symbols_rshutdown();
+
 	return SUCCESS;
 }
 
@@ -184,6 +392,14 @@ PHP_MINFO_FUNCTION(vld)
 {
 	php_info_print_table_start();
 	php_info_print_table_header(2, "vld support", "enabled");
+	php_info_print_table_row(2, "output compression", ""
+#ifdef HAVE_VLD_ZLIB
+		"gzip "
+#endif
+#ifdef HAVE_VLD_ZSTD
+		"zstd "
+#endif
+		"none");
 	php_info_print_table_end();
 
 	DISPLAY_INI_ENTRIES();
@@ -200,48 +416,11 @@ static int vld_check_fe_wrapper (zval *el, zend_bool *have_fe)
 
 static int vld_dump_fe_wrapper(zval *el, int num_args, va_list args, zend_hash_key *hash_key)
 {
-	return vld_dump_fe((zend_op_array *) Z_PTR_P(el), num_args, args, hash_key);
+	return vld_dump_fe((zend_op_array *) Z_PTR_P(el), hash_key);
 }
 
-static int vld_dump_cle_wrapper (zval *el)
-{
-	return vld_dump_cle((zend_class_entry *) Z_PTR_P(el));
-}
 /* }}} */
 
-int vld_printf(FILE *stream, const char* fmt, ...)
-{
-	char *message;
-	int len;
-	va_list args;
-	int i = 0;
-	size_t j = 0;
-	char *ptr;
-	const char EOL='\n';
-	
-	va_start(args, fmt);
-	len = vspprintf(&message, 0, fmt, args);
-	va_end(args);
-	if (VLD_G(format)) {
-		ptr = message;
-		while (j < strlen(ptr)) {
-			if (!isspace(ptr[j]) || ptr[j] == EOL) {
-				ptr[i++] = ptr[j];
-			}
-			j++;
-		}
-		ptr[i] = 0;
-
-		fprintf(stream, "%s%s", VLD_G(col_sep), ptr);
-	} else {
-		fprintf(stream, "%s", message);
-	}
-
-	efree(message);
-	
-	return len;
-}
-
 static int vld_check_fe (zend_op_array *fe, zend_bool *have_fe)
 {
 	if (fe->type == ZEND_USER_FUNCTION) {
@@ -251,24 +430,20 @@ static int vld_check_fe (zend_op_array *fe, zend_bool *have_fe)
 	return 0;
 }
 
-static int vld_dump_fe (zend_op_array *fe, int num_args, va_list args, zend_hash_key *hash_key)
+static int vld_dump_fe (zend_op_array *fe, zend_hash_key *hash_key)
 {
-	if (VLD_G(dump_json))
-	{
-		if (fe->type == ZEND_USER_FUNCTION)
-		{
-			cJSON_vld_dump_oparray(fe);
-		}
-		return ZEND_HASH_APPLY_KEEP;
-	}
 	if (fe->type == ZEND_USER_FUNCTION) {
-		ZVAL_VALUE_STRING_TYPE *new_str;
+		ZVAL_VALUE_STRING_TYPE *new_str = NULL;
 
-		new_str = php_url_encode(ZHASHKEYSTR(hash_key), ZHASHKEYLEN(hash_key) PHP_URLENCODE_NEW_LEN(new_len));
-		vld_printf(stderr, "Function %s:\n", ZSTRING_VALUE(new_str));
+		if (vld_emitters() & VLD_EMIT_TEXT) {
+			new_str = php_url_encode(ZHASHKEYSTR(hash_key), ZHASHKEYLEN(hash_key) PHP_URLENCODE_NEW_LEN(new_len));
+			vld_printf(stderr, "Function %s:\n", ZSTRING_VALUE(new_str));
+		}
 		vld_dump_oparray(fe);
-		vld_printf(stderr, "End of function %s\n\n", ZSTRING_VALUE(new_str));
-		efree(new_str);
+		if (new_str) {
+			vld_printf(stderr, "End of function %s\n\n", ZSTRING_VALUE(new_str));
+			efree(new_str);
+		}
 	}
 
 	return ZEND_HASH_APPLY_KEEP;
@@ -279,6 +454,7 @@ static int vld_dump_cle (zend_class_entry *class_entry)
 {
 	zend_class_entry *ce;
 	zend_bool have_fe = 0;
+	int text;
 	ce = class_entry;
 
 	if (ce->type != ZEND_INTERNAL_CLASS) {	
@@ -288,24 +464,20 @@ static int vld_dump_cle (zend_class_entry *class_entry)
 
 		zend_hash_apply_with_argument(&ce->function_table, (apply_func_arg_t) VLD_WRAP_PHP7(vld_check_fe), (void *)&have_fe);
 
-		if (VLD_G(dump_json))
-		{
-			VLD_G(json_data)->class = ZSTRING_VALUE(ce->name);
-			if (have_fe) {
-				zend_hash_apply_with_arguments(&ce->function_table, (apply_func_args_t)VLD_WRAP_PHP7(vld_dump_fe), 0);
-			}
-			VLD_G(json_data)->class = NULL;
-			goto end;
-		}
-
+		text = vld_emitters() & VLD_EMIT_TEXT;
+		VLD_G(json_data)->class = ZSTRING_VALUE(ce->name);
 		if (have_fe) {
-			vld_printf(stderr, "Class %s:\n", ZSTRING_VALUE(ce->name));
+			if (text) {
+				vld_printf(stderr, "Class %s:\n", ZSTRING_VALUE(ce->name));
+			}
 			zend_hash_apply_with_arguments(&ce->function_table, (apply_func_args_t) VLD_WRAP_PHP7(vld_dump_fe), 0);
-			vld_printf(stderr, "End of class %s.\n\n", ZSTRING_VALUE(ce->name));
-		} else {
+			if (text) {
+				vld_printf(stderr, "End of class %s.\n\n", ZSTRING_VALUE(ce->name));
+			}
+		} else if (text) {
 			vld_printf(stderr, "Class %s: [no user functions]\n", ZSTRING_VALUE(ce->name));
 		}
-end:
+		VLD_G(json_data)->class = NULL;
 		if (VLD_G(path_dump_file)) {
 			fprintf(VLD_G(path_dump_file), "}\n");
 		}
@@ -314,6 +486,114 @@ end:
 	return ZEND_HASH_APPLY_KEEP;
 }
 
+/* {{{ void vld_dump_symbols (symbols)
+ *    Dumps the functions and classes in 'symbols' */
+static void vld_dump_symbols(vld_symbols *symbols)
+{
+	uint32_t      i;
+	zend_hash_key hash_key;
+
+	for (i = 0; i < symbols->functions_count; i++) {
+		hash_key.h   = symbols->functions[i].h;
+		hash_key.key = symbols->functions[i].key;
+		vld_dump_fe((zend_op_array *) symbols->functions[i].ptr, &hash_key);
+	}
+	for (i = 0; i < symbols->classes_count; i++) {
+		vld_dump_cle((zend_class_entry *) symbols->classes[i].ptr);
+	}
+}
+/* }}} */
+
+/* {{{ void vld_dump_new_symbols ()
+ *    Dumps the functions and classes that were declared since the last
+ *    call, each of them once per request; see symbols.c. */
+static void vld_dump_new_symbols(void)
+{
+	vld_symbols symbols = {0};
+
+	vld_symbols_collect(&symbols);
+	vld_dump_symbols(&symbols);
+	vld_symbols_free(&symbols);
+}
+/* }}} */
+
+/* {{{ int vld_save_begin (op_array)
+ *    With vld.save_per_file, sends the dump of the file 'op_array' was
+ *    compiled from to files of its own below vld.save_dir: the ops, branches
+ *    and JSON to one, the DOT graph to another. Returns whether it did. */
+static int vld_save_begin(zend_op_array *op_array)
+{
+	const char *source;
+
+	if (!VLD_G(save_per_file) || VLD_G(inspect) || !op_array || !op_array->filename) {
+		return 0;
+	}
+	source = ZSTRING_VALUE(op_array->filename);
+
+	if (!vld_save_file_open(&VLD_G(save_files)[0], source, vld_output_suffix())) {
+		return 0;
+	}
+	vld_output_file_begin(VLD_G(save_files)[0].fp);
+	vld_json_document_push(&VLD_G(save_json));
+
+	if (VLD_G(save_paths) && vld_save_file_open(&VLD_G(save_files)[1], source, ".dot")) {
+		VLD_G(save_outer_dot) = VLD_G(path_dump_file);
+		VLD_G(path_dump_file) = VLD_G(save_files)[1].fp;
+		fprintf(VLD_G(path_dump_file), "digraph {\n");
+	}
+	return 1;
+}
+/* }}} */
+
+/* {{{ void vld_save_end (keep)
+ *    Completes the files of vld_save_begin(), and puts them in place when
+ *    'keep' is set */
+static void vld_save_end(int keep)
+{
+	if (!VLD_G(save_files)[0].fp) {
+		return;
+	}
+
+	vld_json_document_pop(&VLD_G(save_json));
+	vld_output_file_end();
+	vld_save_file_close(&VLD_G(save_files)[0], keep);
+
+	if (VLD_G(save_files)[1].fp) {
+		fprintf(VLD_G(path_dump_file), "}\n");
+		VLD_G(path_dump_file) = VLD_G(save_outer_dot);
+		VLD_G(save_outer_dot) = NULL;
+		vld_save_file_close(&VLD_G(save_files)[1], keep);
+	}
+}
+/* }}} */
+
+/* {{{ void vld_dump_profiled ()
+ *    With vld.profile or vld.coverage, files are dumped at the end of the
+ *    request, in the order they were compiled, so that what ran is known. */
+static void vld_dump_profiled(void)
+{
+	uint32_t          i;
+	vld_profile_unit *unit;
+
+	for (i = 0; i < VLD_G(profile_units_count); i++) {
+		unit = &VLD_G(profile_units)[i];
+
+		vld_save_begin(&unit->op_array);
+		if (VLD_G(path_dump_file)) {
+			fprintf(VLD_G(path_dump_file), "subgraph cluster_file_%p { label=\"file %s\";\n", unit, unit->op_array.filename ? ZSTRING_VALUE(unit->op_array.filename) : "__main");
+		}
+		vld_dump_oparray(&unit->op_array);
+		vld_dump_symbols(&unit->symbols);
+		if (VLD_G(path_dump_file)) {
+			fprintf(VLD_G(path_dump_file), "}\n");
+		}
+		vld_save_end(1);
+	}
+
+	/* Functions and classes declared while running */
+	vld_dump_new_symbols();
+}
+/* }}} */
 
 /* {{{ zend_op_array vld_compile_file (file_handle, type)
  *    This function provides a hook for compilation */
@@ -336,6 +616,22 @@ static zend_op_array *vld_compile_file(zend_file_handle *file_handle, int type)
 
 	op_array = old_compile_file (file_handle, type);
 
+	if (VLD_RUNTIME()) {
+		if (op_array) {
+			vld_profile_defer(op_array);
+		}
+		return op_array;
+	}
+
+	vld_save_begin(op_array);
+
+	if (op_array && vld_cache_begin(op_array)) {
+		/* The output was replayed from the cache, skip what this file declared */
+		vld_symbols_collect(NULL);
+		vld_save_end(1);
+		return op_array;
+	}
+
 	if (VLD_G(path_dump_file)) {
 		fprintf(VLD_G(path_dump_file), "subgraph cluster_file_%p { label=\"file %s\";\n", op_array, op_array->filename ? ZSTRING_VALUE(op_array->filename) : "__main");
 	}
@@ -343,12 +639,14 @@ static zend_op_array *vld_compile_file(zend_file_handle *file_handle, int type)
 		vld_dump_oparray (op_array);
 	}
 
-	zend_hash_apply_with_arguments (CG(function_table), (apply_func_args_t) VLD_WRAP_PHP7(vld_dump_fe), 0);
-	zend_hash_apply (CG(class_table), (apply_func_t) VLD_WRAP_PHP7(vld_dump_cle));
+	vld_dump_new_symbols();
+	vld_cache_end();
+	vld_output_flush();
 
 	if (VLD_G(path_dump_file)) {
 		fprintf(VLD_G(path_dump_file), "}\n");
 	}
+	vld_save_end(1);
 
 	return op_array;
 }
@@ -362,11 +660,16 @@ static zend_op_array *vld_compile_string(zval *source_string, char *filename)
 
 	op_array = old_compile_string (source_string, filename);
 
+	if (op_array && VLD_RUNTIME()) {
+		vld_profile_defer(op_array);
+		return op_array;
+	}
+
 	if (op_array) {
 		vld_dump_oparray (op_array);
 
-		zend_hash_apply_with_arguments (CG(function_table), (apply_func_args_t) vld_dump_fe_wrapper, 0);
-		zend_hash_apply (CG(class_table), (apply_func_t) vld_dump_cle_wrapper);
+		vld_dump_new_symbols();
+		vld_output_flush();
 	}
 
 	return op_array;
@@ -380,3 +683,457 @@ static void vld_execute_ex(zend_execute_data *execute_data)
 	// nothing to do
 }
 /* }}} */
+
+/* {{{ Batch dumping */
+typedef struct _vld_saved_options {
+	int verbosity;
+	int format;
+	int dump_paths;
+	zend_long path_mode;
+	zend_long path_limit;
+	int dump_json;
+	int json_lines;
+} vld_saved_options;
+
+static void vld_option_bool(HashTable *options, const char *name, size_t name_len, int *setting)
+{
+	zval *value;
+
+	if ((value = zend_hash_str_find(options, name, name_len)) != NULL) {
+		*setting = zend_is_true(value);
+	}
+}
+
+/* Overrides the dump settings with the ones found in 'options', and stores
+ * the original values in 'saved' */
+static void vld_options_apply(HashTable *options, vld_saved_options *saved)
+{
+	zval *value;
+
+	saved->verbosity  = VLD_G(verbosity);
+	saved->format     = VLD_G(format);
+	saved->dump_paths = VLD_G(dump_paths);
+	saved->path_mode  = VLD_G(path_mode);
+	saved->path_limit = VLD_G(path_limit);
+	saved->dump_json  = VLD_G(dump_json);
+	saved->json_lines = VLD_G(json_lines);
+
+	if (!options) {
+		return;
+	}
+	if ((value = zend_hash_str_find(options, ZEND_STRL("verbosity"))) != NULL) {
+		VLD_G(verbosity) = zval_get_long(value);
+	}
+	vld_option_bool(options, ZEND_STRL("format"), &VLD_G(format));
+	vld_option_bool(options, ZEND_STRL("dump_paths"), &VLD_G(dump_paths));
+	if ((value = zend_hash_str_find(options, ZEND_STRL("path_mode"))) != NULL) {
+		VLD_G(path_mode) = zval_get_long(value);
+	}
+	if ((value = zend_hash_str_find(options, ZEND_STRL("path_limit"))) != NULL) {
+		VLD_G(path_limit) = zval_get_long(value);
+	}
+	vld_option_bool(options, ZEND_STRL("json"), &VLD_G(dump_json));
+	vld_option_bool(options, ZEND_STRL("json_lines"), &VLD_G(json_lines));
+
+	/* JSON would end up between the binary records */
+	if (VLD_G(dump_json) && (VLD_G(formats_mask) & VLD_EMIT_BINARY)) {
+		php_error_docref(NULL, E_WARNING, "The json option can not be combined with vld.formats=binary");
+		VLD_G(dump_json) = 0;
+	}
+}
+
+static void vld_options_restore(vld_saved_options *saved)
+{
+	VLD_G(verbosity)  = saved->verbosity;
+	VLD_G(format)     = saved->format;
+	VLD_G(dump_paths) = saved->dump_paths;
+	VLD_G(path_mode)  = saved->path_mode;
+	VLD_G(path_limit) = saved->path_limit;
+	VLD_G(dump_json)  = saved->dump_json;
+	VLD_G(json_lines) = saved->json_lines;
+}
+
+/* {{{ int vld_dump_one (path, code)
+ *    Compiles and dumps one file, or the PHP code in 'code' when it is set,
+ *    through the compile hooks without executing it. Everything that was
+ *    declared is thrown away afterwards, so that the next call starts from
+ *    the same state. */
+static int vld_dump_one(zend_string *path, zval *code)
+{
+	zend_file_handle  file_handle;
+	zend_op_array    *volatile op_array = NULL;
+	zend_long         generation;
+	int               profile      = VLD_G(profile);
+	int               coverage     = VLD_G(coverage);
+	int               ret = 0;
+	volatile int      bailout = 0;
+
+	/* Nothing runs, so there is nothing to wait for before dumping */
+	VLD_G(profile)  = 0;
+	VLD_G(coverage) = 0;
+
+	/* Only dump what this file declares, and keep track of it */
+	vld_symbols_collect(NULL);
+	generation = vld_symbols_generation();
+
+	if (!code) {
+#if PHP_VERSION_ID >= 70400
+		zend_stream_init_filename(&file_handle, ZSTR_VAL(path));
+#else
+		memset(&file_handle, 0, sizeof(file_handle));
+		file_handle.type          = ZEND_HANDLE_FILENAME;
+		file_handle.filename      = ZSTR_VAL(path);
+		file_handle.free_filename = 0;
+		file_handle.opened_path   = NULL;
+#endif
+	}
+
+	/* A compile error bails out of the compiler and leaves the request
+	 * unusable. Clean up after this file, and then pass the bailout on */
+	zend_try {
+		if (code) {
+			op_array = vld_compile_string(code, (char*) "vld code");
+		} else {
+			op_array = vld_compile_file(&file_handle, ZEND_INCLUDE);
+		}
+	} zend_catch {
+		op_array = NULL;
+		bailout  = 1;
+	} zend_end_try();
+
+	if (!code) {
+		zend_destroy_file_handle(&file_handle);
+	}
+
+	if (op_array) {
+		destroy_op_array(op_array);
+		efree(op_array);
+		ret = 1;
+	}
+	if (EG(exception)) {
+		zend_clear_exception();
+		ret = 0;
+	}
+
+	vld_symbols_remove(generation);
+	VLD_G(profile)            = profile;
+	VLD_G(coverage)           = coverage;
+
+	if (bailout) {
+		zend_bailout();
+	}
+	return ret;
+}
+/* }}} */
+
+/* {{{ proto array vld_dump_files(array paths [, array options])
+ *    Dumps every file in 'paths' in turn, without executing any of them.
+ *    Returns an array with the path as key, and whether it compiled as
+ *    value. */
+PHP_FUNCTION(vld_dump_files)
+{
+	HashTable         *paths;
+	HashTable         *options = NULL;
+	zval              *entry;
+	zend_string       *path;
+	vld_saved_options  saved;
+	int                opened = 0;
+
+	if (zend_parse_parameters(ZEND_NUM_ARGS(), "h|h", &paths, &options) == FAILURE) {
+		return;
+	}
+
+	vld_options_apply(options, &saved);
+	if (VLD_G(dump_json)) {
+		opened = vld_json_document_open();
+	}
+
+	array_init(return_value);
+	ZEND_HASH_FOREACH_VAL(paths, entry) {
+		path = zval_get_string(entry);
+		add_assoc_bool_ex(return_value, ZSTR_VAL(path), ZSTR_LEN(path), vld_dump_one(path, NULL));
+		zend_string_release(path);
+	} ZEND_HASH_FOREACH_END();
+
+	if (opened) {
+		vld_json_document_close();
+	}
+	vld_options_restore(&saved);
+}
+/* }}} */
+
+#ifndef PHP_WIN32
+/* The status byte of a file that ended its worker with a compile error */
+#define VLD_SCAN_BAILOUT 'x'
+
+/* {{{ void vld_scan_worker (paths, first, count, shard, result_fd)
+ *    Runs in a forked child. Both stdout and stderr are pointed at the shard
+ *    file, and one status byte per dumped file is sent back to the parent.
+ *    A compile error leaves the child unusable, so it reports the file with
+ *    VLD_SCAN_BAILOUT and stops; the parent starts a new child for the
+ *    rest. The child leaves through _exit() so that none of the request
+ *    shutdown of the parent runs twice. */
+static void vld_scan_worker(zval *paths, uint32_t first, uint32_t count, const char *shard, int result_fd)
+{
+	int           fd;
+	uint32_t      i;
+	volatile char status;
+	zend_string  *path;
+
+	fd = open(shard, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		_exit(1);
+	}
+	dup2(fd, STDOUT_FILENO);
+	dup2(fd, STDERR_FILENO);
+	close(fd);
+	vld_output_use(stdout);
+
+	/* Shards are concatenated, so every record has to stand on its own, and
+	 * the interned strings of a shard start over */
+	VLD_G(json_lines) = 1;
+	vld_json_strings_reset();
+
+	for (i = first; i < first + count; i++) {
+		path = zval_get_string(&paths[i]);
+		zend_try {
+			status = vld_dump_one(path, NULL) ? '1' : '0';
+		} zend_catch {
+			status = VLD_SCAN_BAILOUT;
+		} zend_end_try();
+		zend_string_release(path);
+		vld_output_flush();
+		if (write(result_fd, (char*) &status, 1) != 1 || status == VLD_SCAN_BAILOUT) {
+			break;
+		}
+	}
+	close(result_fd);
+	_exit(0);
+}
+/* }}} */
+
+/* Appends the contents of 'shard' to 'out', and removes the shard */
+static void vld_scan_merge(FILE *out, const char *shard)
+{
+	FILE   *in;
+	char    buf[8192];
+	size_t  len;
+
+	if ((in = fopen(shard, "rb")) != NULL) {
+		while ((len = fread(buf, 1, sizeof(buf), in)) > 0) {
+			fwrite(buf, 1, len, out);
+		}
+		fclose(in);
+	}
+	unlink(shard);
+}
+
+/* Forks a child that dumps 'count' paths from 'first' on into 'shard'. Returns
+ * the end of the pipe that the statuses come through, or -1 when no child
+ * could be started. */
+static int vld_scan_start(zval *paths, uint32_t first, uint32_t count, const char *shard, pid_t *pid)
+{
+	int fds[2];
+
+	*pid = -1;
+	unlink(shard);
+	if (pipe(fds) != 0) {
+		return -1;
+	}
+	*pid = fork();
+	if (*pid == 0) {
+		close(fds[0]);
+		vld_scan_worker(paths, first, count, shard, fds[1]);
+	}
+	close(fds[1]);
+	if (*pid < 0) {
+		close(fds[0]);
+		return -1;
+	}
+	return fds[0];
+}
+
+/* Waits for the child and appends its shard to 'out' */
+static void vld_scan_finish(FILE *out, const char *shard, pid_t pid, int result_fd)
+{
+	int status;
+
+	close(result_fd);
+	waitpid(pid, &status, 0);
+	vld_scan_merge(out, shard);
+}
+#endif
+
+/* {{{ proto array vld_scan_files(array paths, string output [, int workers [, array options]])
+ *    Like vld_dump_files(), but splits 'paths' into 'workers' contiguous
+ *    shards that are dumped by forked children. Every child writes to its
+ *    own shard file, and the shards are concatenated into 'output' in shard
+ *    order, so the result does not depend on which child finished first.
+ *    JSON is always written line delimited. */
+PHP_FUNCTION(vld_scan_files)
+{
+	HashTable         *paths_ht;
+	HashTable         *options = NULL;
+	char              *output;
+	size_t             output_len;
+	zend_long          workers = 0;
+#ifndef PHP_WIN32
+	vld_saved_options  saved;
+	zval              *paths, *entry;
+	uint32_t           nr_paths, i = 0, first = 0, count, j;
+	pid_t             *pids;
+	int               *result_fds;
+	char               result;
+	char              *shard;
+	zend_string       *path;
+	FILE              *out;
+	zend_long          k;
+#endif
+
+	if (zend_parse_parameters(ZEND_NUM_ARGS(), "hs|lh", &paths_ht, &output, &output_len, &workers, &options) == FAILURE) {
+		return;
+	}
+
+#ifdef PHP_WIN32
+	php_error_docref(NULL, E_WARNING, "vld_scan_files() is not available on this platform, use vld_dump_files()");
+	RETURN_FALSE;
+#else
+	if ((out = fopen(output, "wb")) == NULL) {
+		php_error_docref(NULL, E_WARNING, "Can not open '%s' for writing", output);
+		RETURN_FALSE;
+	}
+
+	nr_paths = zend_hash_num_elements(paths_ht);
+	paths = safe_emalloc(nr_paths ? nr_paths : 1, sizeof(zval), 0);
+	ZEND_HASH_FOREACH_VAL(paths_ht, entry) {
+		ZVAL_COPY_VALUE(&paths[i++], entry);
+	} ZEND_HASH_FOREACH_END();
+
+	if (workers <= 0) {
+		workers = sysconf(_SC_NPROCESSORS_ONLN);
+	}
+	if (workers <= 0) {
+		workers = 1;
+	}
+	if ((zend_ulong) workers > nr_paths) {
+		workers = nr_paths ? nr_paths : 1;
+	}
+
+	pids = ecalloc(workers, sizeof(pid_t));
+	result_fds = ecalloc(workers, sizeof(int));
+
+	vld_options_apply(options, &saved);
+	vld_output_flush();
+
+	for (k = 0; k < workers; k++) {
+		count = nr_paths / workers + ((zend_ulong) k < nr_paths % workers ? 1 : 0);
+		spprintf(&shard, 0, "%s.%d", output, (int) k);
+
+		if ((result_fds[k] = vld_scan_start(paths, first, count, shard, &pids[k])) < 0) {
+			php_error_docref(NULL, E_WARNING, "Could not start worker %d", (int) k);
+		}
+		efree(shard);
+		first += count;
+	}
+
+	/* Collect the results and shards in shard order */
+	array_init(return_value);
+	first = 0;
+	for (k = 0; k < workers; k++) {
+		count = nr_paths / workers + ((zend_ulong) k < nr_paths % workers ? 1 : 0);
+		spprintf(&shard, 0, "%s.%d", output, (int) k);
+		for (j = first; j < first + count; j++) {
+			path = zval_get_string(&paths[j]);
+			result = '0';
+			if (result_fds[k] >= 0 && read(result_fds[k], &result, 1) != 1) {
+				result = '0';
+			}
+			add_assoc_bool_ex(return_value, ZSTR_VAL(path), ZSTR_LEN(path), result == '1');
+			zend_string_release(path);
+
+			/* The worker gave up after a compile error, continue with a
+			 * new one that starts from a clean state */
+			if (result == VLD_SCAN_BAILOUT && j + 1 < first + count) {
+				vld_scan_finish(out, shard, pids[k], result_fds[k]);
+				if ((result_fds[k] = vld_scan_start(paths, j + 1, first + count - j - 1, shard, &pids[k])) < 0) {
+					php_error_docref(NULL, E_WARNING, "Could not start worker %d", (int) k);
+				}
+			}
+		}
+		if (pids[k] > 0) {
+			vld_scan_finish(out, shard, pids[k], result_fds[k]);
+		}
+		efree(shard);
+		first += count;
+	}
+
+	vld_options_restore(&saved);
+	fclose(out);
+	efree(result_fds);
+	efree(pids);
+	efree(paths);
+#endif
+}
+/* }}} */
+
+/* {{{ void vld_inspect (path, code, options, return_value)
+ *    Collects the JSON records of everything 'path' or 'code' declares as
+ *    PHP arrays in 'return_value', instead of writing them out. */
+static void vld_inspect(zend_string *path, zval *code, HashTable *options, zval *return_value)
+{
+	vld_saved_options  saved;
+	FILE              *path_dump_file = VLD_G(path_dump_file);
+	int                ok;
+
+	vld_options_apply(options, &saved);
+	VLD_G(dump_json)      = 1;
+	VLD_G(path_dump_file) = NULL;
+	VLD_G(inspect)        = return_value;
+
+	array_init(return_value);
+	ok = vld_dump_one(path, code);
+
+	VLD_G(inspect)        = NULL;
+	VLD_G(path_dump_file) = path_dump_file;
+	vld_options_restore(&saved);
+
+	if (!ok) {
+		zval_ptr_dtor(return_value);
+		RETVAL_FALSE;
+	}
+}
+/* }}} */
+
+/* {{{ proto array vld_inspect_file(string path [, array options])
+ *    Returns the records vld.dump_json would write for 'path', one per
+ *    function, or false if the file does not compile. */
+PHP_FUNCTION(vld_inspect_file)
+{
+	zend_string *path;
+	HashTable   *options = NULL;
+
+	if (zend_parse_parameters(ZEND_NUM_ARGS(), "S|h", &path, &options) == FAILURE) {
+		return;
+	}
+
+	vld_inspect(path, NULL, options, return_value);
+}
+/* }}} */
+
+/* {{{ proto array vld_inspect_code(string code [, array options])
+ *    Like vld_inspect_file(), for a string of PHP code in the form eval()
+ *    accepts, so without the opening tag. */
+PHP_FUNCTION(vld_inspect_code)
+{
+	zval       *code;
+	HashTable  *options = NULL;
+
+	if (zend_parse_parameters(ZEND_NUM_ARGS(), "z|h", &code, &options) == FAILURE) {
+		return;
+	}
+	convert_to_string(code);
+
+	vld_inspect(NULL, code, options, return_value);
+}
+/* }}} */
+/* }}} */